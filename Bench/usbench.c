@@ -0,0 +1,548 @@
+/* usbench.c: this program benchmarks usmalloc()/usfree() against other allocators
+ *   Usage: usbench [-p procs,...] [-n ops] [-w window] [-a allocators] [-P patterns]
+ *                  [-s bytes] [-t label] [-o csvfile]
+ *     -p procs    : comma-separated qtys of worker processes (default: 1,2,4)
+ *     -n ops      : allocations plus frees per worker (default: 200000)
+ *     -w window   : live allocations per worker (default: 1024)
+ *     -a list     : allocators, comma-separated (default: us,glibc,naive)
+ *                     us    : usmalloc()/usfree(), all workers on one arena
+ *                     glibc : malloc()/free(), each worker on its own heap
+ *                     naive : power-of-two free lists and a bump pointer in
+ *                             one shared mmap, under one pthread mutex
+ *     -P list     : patterns, comma-separated (default: fixed,uniform,powerlaw,prodcons)
+ *                     fixed    : 64 byte allocations, freed oldest first
+ *                     uniform  : 16-4096 bytes, freed at random
+ *                     powerlaw : Pareto sizes (16 bytes up, alpha 1.2, up to
+ *                                256KB); lifetimes also heavy-tailed
+ *                     prodcons : workers pair off; one allocates 16-4096
+ *                                bytes, the other frees them (not glibc)
+ *     -s bytes    : arena (and naive heap) size (default: 256MB)
+ *     -t label    : label for the CSV rows (ex. the library version)
+ *     -o csvfile  : append the results to csvfile (header written if new)
+ *
+ *   The workers are forked, wait for one another, and then each times
+ *   every allocation and free (CLOCK_MONOTONIC), into latency histograms
+ *   (see uslatbucket()).  Reported per run: the throughput (allocations
+ *   plus frees per second, all workers together) and the p50/p99/p99.9
+ *   allocation and free times.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <stdio.h>
+#include <math.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Definitions: {{{2
+ */
+#define BENCHMAXPROCS  256         /* max qty of workers                        */
+#define BENCHPCRING   4096         /* prodcons: allocations in flight per pair  */
+#define NAIVECLASSES    48         /* naive: free lists of 2^0 .. 2^47 bytes    */
+#define BENCH_FIXED      0         /* patterns                                  */
+#define BENCH_UNIFORM    1
+#define BENCH_POWERLAW   2
+#define BENCH_PRODCONS   3
+#define BENCH_PATTERNS   4
+#define BENCH_US         0         /* allocators                                */
+#define BENCH_GLIBC      1
+#define BENCH_NAIVE      2
+#define BENCH_ALLOCATORS 3
+
+/* ------------------------------------------------------------------------
+ * Typedefs: {{{2
+ */
+typedef struct BenchShare_str BenchShare;
+typedef struct BenchRing_str  BenchRing;
+typedef struct NaiveHeap_str  NaiveHeap;
+
+/* ------------------------------------------------------------------------
+ * Local Data Structures: {{{2
+ */
+struct BenchRing_str {                  /* BenchRing: prodcons hand-off, one per pair    */
+    unsigned long head __attribute__((aligned(USCACHELINE))); /* qty ever produced       */
+    unsigned long tail __attribute__((aligned(USCACHELINE))); /* qty ever consumed       */
+    usoffset      off[BENCHPCRING];     /* allocations, as offsets from the heap's base  */
+    };
+struct BenchShare_str {                 /* BenchShare: shared by the workers of a run    */
+    int           ready;                /* qty of workers ready to go                    */
+    int           go;                   /* start!                                        */
+    unsigned long t0;                   /* usclock() at the start                        */
+    unsigned long tend[BENCHMAXPROCS];  /* usclock() when each worker finished           */
+    unsigned long fail[BENCHMAXPROCS];  /* qty of failed allocations per worker          */
+    uslat_t       lat[BENCHMAXPROCS];   /* per worker: US_LATMALLOC and US_LATFREE times */
+    BenchRing     ring[BENCHMAXPROCS/2];/* prodcons hand-offs                            */
+    };
+struct NaiveHeap_str {                  /* NaiveHeap: the naive baseline allocator       */
+    pthread_mutex_t lock;               /* guards everything                             */
+    usoffset      size;                 /* bytes in the heap                             */
+    usoffset      top;                  /* bump pointer                                  */
+    usoffset      freelist[NAIVECLASSES]; /* free blocks, by power of two                */
+    };
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static char *patname[BENCH_PATTERNS]    = {"fixed","uniform","powerlaw","prodcons"};
+static char *allocname[BENCH_ALLOCATORS]= {"us","glibc","naive"};
+static int            benchalloc;         /* allocator being run                  */
+static usptr_t       *bencharena= NULL;   /* us: the arena                        */
+static NaiveHeap     *naive     = NULL;   /* naive: the heap                      */
+static usbase        *benchbase = NULL;   /* base for prodcons offsets            */
+static unsigned long  benchrand;          /* this worker's xorshift state         */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+int main( int, char **);                                      /* usbench.c */
+static int BenchRun(int,int,int,unsigned long,int,size_t,BenchShare *,double *); /* usbench.c */
+static void BenchWorker(int,int,int,unsigned long,int,BenchShare *);          /* usbench.c */
+static void *BenchAlloc(size_t);                              /* usbench.c */
+static void BenchFree(void *);                                /* usbench.c */
+static size_t BenchSize(int);                                 /* usbench.c */
+static unsigned long BenchRand(void);                         /* usbench.c */
+static int BenchList(char *,char **,int);                     /* usbench.c */
+static void *NaiveAlloc(size_t);                              /* usbench.c */
+static void NaiveFree(void *);                                /* usbench.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* main: it all starts here! {{{2 */
+int main(
+  int    argc,
+  char **argv)
+{
+int            iarg;
+int            ialloc;
+int            ipat;
+int            procqty;
+int            allocs  = (1 << BENCH_ALLOCATORS) - 1;
+int            pats    = (1 << BENCH_PATTERNS) - 1;
+int            window  = 1024;
+unsigned long  ops     = 200000;
+size_t         size    = (size_t) 256 << 20;
+char          *procs   = "1,2,4";
+char          *label   = "";
+char          *csvfile = NULL;
+char          *p;
+double         res[8];
+FILE          *csv     = NULL;
+BenchShare    *share;
+
+
+for(iarg= 1; iarg < argc; ++iarg) {
+    if     (!strcmp(argv[iarg],"-p") && iarg+1 < argc) procs  = argv[++iarg];
+    else if(!strcmp(argv[iarg],"-n") && iarg+1 < argc) ops    = strtoul(argv[++iarg],NULL,0);
+    else if(!strcmp(argv[iarg],"-w") && iarg+1 < argc) window = atoi(argv[++iarg]);
+    else if(!strcmp(argv[iarg],"-a") && iarg+1 < argc) allocs = BenchList(argv[++iarg],allocname,BENCH_ALLOCATORS);
+    else if(!strcmp(argv[iarg],"-P") && iarg+1 < argc) pats   = BenchList(argv[++iarg],patname,BENCH_PATTERNS);
+    else if(!strcmp(argv[iarg],"-s") && iarg+1 < argc) size   = strtoul(argv[++iarg],NULL,0);
+    else if(!strcmp(argv[iarg],"-t") && iarg+1 < argc) label  = argv[++iarg];
+    else if(!strcmp(argv[iarg],"-o") && iarg+1 < argc) csvfile= argv[++iarg];
+    else {
+        allocs= -1;
+        break;
+        }
+    }
+if(allocs <= 0 || pats <= 0 || window < 1 || ops < 2) {
+    fprintf(stderr,"usage: usbench [-p procs,...] [-n ops] [-w window] [-a us,glibc,naive] [-P fixed,uniform,powerlaw,prodcons] [-s bytes] [-t label] [-o csvfile]\n");
+    return 1;
+    }
+
+if(csvfile) {
+    csv= fopen(csvfile,"a");
+    if(!csv) {
+        perror(csvfile);
+        return 1;
+        }
+    if(ftell(csv) == 0) fprintf(csv,"label,allocator,pattern,procs,ops,secs,ops_per_sec,malloc_p50_ns,malloc_p99_ns,malloc_p999_ns,free_p50_ns,free_p99_ns,free_p999_ns,failures\n");
+    }
+share= (BenchShare *) mmap(NULL,sizeof(BenchShare),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,(off_t) 0);
+if(share == MAP_FAILED) {
+    perror("(usbench) mmap");
+    return 1;
+    }
+
+printf("%-6s %-9s %5s %10s %12s %9s %9s %9s %9s %9s %9s\n",
+  "alloc","pattern","procs","secs","ops/sec","m-p50","m-p99","m-p99.9","f-p50","f-p99","f-p99.9");
+for(p= procs; p && *p; p= strchr(p,',')? strchr(p,',')+1 : NULL) {
+    procqty= atoi(p);
+    if(procqty < 1 || procqty > BENCHMAXPROCS) continue;
+    for(ipat= 0; ipat < BENCH_PATTERNS; ++ipat) {
+        if(!(pats & (1 << ipat))) continue;
+        for(ialloc= 0; ialloc < BENCH_ALLOCATORS; ++ialloc) {
+            if(!(allocs & (1 << ialloc))) continue;
+            if(ipat == BENCH_PRODCONS && (ialloc == BENCH_GLIBC || procqty < 2)) continue; /* needs a shared heap, and a pair */
+            if(BenchRun(ialloc,ipat,procqty,ops,window,size,share,res)) continue;
+            printf("%-6s %-9s %5d %10.3f %12.0f %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f%s\n",
+              allocname[ialloc],patname[ipat],procqty,res[0],(double) (ops*(unsigned long) procqty)/res[0],
+              res[1],res[2],res[3],res[4],res[5],res[6],res[7] > 0.? "  (allocations failed)" : "");
+            fflush(stdout);
+            if(csv) {
+                fprintf(csv,"%s,%s,%s,%d,%lu,%.6f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f\n",
+                  label,allocname[ialloc],patname[ipat],procqty,ops*(unsigned long) procqty,res[0],
+                  (double) (ops*(unsigned long) procqty)/res[0],res[1],res[2],res[3],res[4],res[5],res[6],res[7]);
+                fflush(csv);
+                }
+            }
+        }
+    }
+if(csv) fclose(csv);
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* BenchRun: this function runs one allocator on one pattern with procqty workers {{{2
+ *   res[0]=secs  res[1..3]=malloc p50,p99,p99.9  res[4..6]=free p50,p99,p99.9  res[7]=failures
+ *   Returns: 0=success  -1=failure
+ */
+static int BenchRun(
+  int            ialloc,
+  int            ipat,
+  int            procqty,
+  unsigned long  ops,
+  int            window,
+  size_t         size,
+  BenchShare    *share,
+  double        *res)
+{
+int                 iproc;
+int                 ibkt;
+int                 metric;
+int                 ret= 0;
+unsigned long       tend= 0;
+unsigned long       fail= 0;
+char                arenafile[64];
+pid_t               pid[BENCHMAXPROCS];
+uslat_t            *lat;
+pthread_mutexattr_t attr;
+
+
+memset(share,0,sizeof(BenchShare));
+benchalloc= ialloc;
+switch(ialloc) {
+case BENCH_US:
+    snprintf(arenafile,sizeof(arenafile),"/dev/shm/usbench.%d",(int) getpid());
+    unlink(arenafile);
+    usconfig(CONF_INITSIZE,size);
+    bencharena= usinit(arenafile);
+    if(!bencharena) {
+        perror("(usbench) usinit");
+        return -1;
+        }
+    benchbase= bencharena->base;
+    break;
+
+case BENCH_NAIVE:
+    naive= (NaiveHeap *) mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,(off_t) 0);
+    if(naive == MAP_FAILED) {
+        perror("(usbench) mmap");
+        return -1;
+        }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr,PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&naive->lock,&attr);
+    pthread_mutexattr_destroy(&attr);
+    naive->size= (usoffset) size;
+    naive->top = (sizeof(NaiveHeap) + 15)&~(usoffset) 15;
+    benchbase  = (usbase *) naive;
+    break;
+    }
+
+for(iproc= 0; iproc < procqty; ++iproc) {
+    pid[iproc]= fork();
+    if(pid[iproc] == 0) {
+        BenchWorker(ipat,iproc,procqty,ops,window,share);
+        _exit(0);
+        }
+    if(pid[iproc] < 0) {
+        perror("(usbench) fork");
+        procqty= iproc;
+        ret    = -1;
+        break;
+        }
+    }
+while(!ret && __atomic_load_n(&share->ready,__ATOMIC_ACQUIRE) < procqty) sched_yield();
+share->t0= usclock();
+__atomic_store_n(&share->go,1,__ATOMIC_RELEASE);
+for(iproc= 0; iproc < procqty; ++iproc) waitpid(pid[iproc],NULL,0);
+
+/* merge the workers' histograms into the first */
+lat= &share->lat[0];
+for(iproc= 0; iproc < procqty; ++iproc) {
+    if(share->tend[iproc] > tend) tend= share->tend[iproc];
+    fail+= share->fail[iproc];
+    for(metric= 0; iproc && metric < US_LATQTY; ++metric) {
+        for(ibkt= 0; ibkt < USLATBUCKETS; ++ibkt) lat->count[metric][ibkt]+= share->lat[iproc].count[metric][ibkt];
+        }
+    }
+res[0]= (tend > share->t0)? (double) (tend - share->t0)/1e9 : 1e-9;
+res[1]= (double) uslatpercentile(lat,US_LATMALLOC,50.);
+res[2]= (double) uslatpercentile(lat,US_LATMALLOC,99.);
+res[3]= (double) uslatpercentile(lat,US_LATMALLOC,99.9);
+res[4]= (double) uslatpercentile(lat,US_LATFREE,50.);
+res[5]= (double) uslatpercentile(lat,US_LATFREE,99.);
+res[6]= (double) uslatpercentile(lat,US_LATFREE,99.9);
+res[7]= (double) fail;
+
+switch(ialloc) {
+case BENCH_US:
+    usfreearena(bencharena);
+    unlink(arenafile);
+    bencharena= NULL;
+    break;
+
+case BENCH_NAIVE:
+    munmap(naive,size);
+    naive= NULL;
+    break;
+    }
+
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* BenchWorker: this function is one worker's part of a run {{{2
+ *   ops allocations plus frees, each timed into share->lat[iproc].
+ */
+static void BenchWorker(
+  int            ipat,
+  int            iproc,
+  int            procqty,
+  unsigned long  ops,
+  int            window,
+  BenchShare    *share)
+{
+int            islot;
+unsigned long  done= 0;
+unsigned long  t;
+unsigned long  fail= 0;
+double         u;
+void         **live;
+void          *ptr;
+uslat_t       *lat = &share->lat[iproc];
+BenchRing     *ring= &share->ring[iproc/2];
+
+
+benchrand= ((unsigned long) (iproc+1) << 32) ^ 0x9e3779b97f4a7c15UL;
+live     = (void **) calloc((size_t) window,sizeof(void *));
+if(!live) _exit(1);
+if(ipat == BENCH_PRODCONS && iproc == procqty-1 && procqty%2) ipat= BENCH_UNIFORM; /* the odd one out */
+
+__atomic_add_fetch(&share->ready,1,__ATOMIC_RELEASE);
+while(!__atomic_load_n(&share->go,__ATOMIC_ACQUIRE)) sched_yield();
+
+switch(ipat) {
+case BENCH_FIXED:    /* allocations replace the oldest */
+case BENCH_UNIFORM:  /* allocations replace one at random */
+case BENCH_POWERLAW: /* low slots are replaced far more often than high ones */
+    for(islot= 0; done < ops; ) {
+        if(ipat == BENCH_UNIFORM) islot= (int) (BenchRand()%(unsigned long) window);
+        else if(ipat == BENCH_POWERLAW) {
+            u    = (double) (BenchRand() >> 11)/9007199254740992.;
+            islot= (int) ((double) window*u*u*u);
+            }
+        else islot= (islot + 1)%window;
+        if(live[islot]) {
+            t= usclock();
+            BenchFree(live[islot]);
+            ++lat->count[US_LATFREE][uslatbucket(usclock() - t)];
+            live[islot]= NULL;
+            ++done;
+            }
+        t  = usclock();
+        ptr= BenchAlloc(BenchSize(ipat));
+        ++lat->count[US_LATMALLOC][uslatbucket(usclock() - t)];
+        ++done;
+        if(ptr) *(unsigned long *) ptr= done; /* touch it */
+        else ++fail;
+        live[islot]= ptr;
+        }
+    for(islot= 0; islot < window; ++islot) {
+        if(live[islot]) BenchFree(live[islot]);
+        }
+    break;
+
+case BENCH_PRODCONS:
+    if(iproc%2 == 0) { /* producer */
+        for(; done < ops/2; ++done) {
+            while(__atomic_load_n(&ring->head,__ATOMIC_RELAXED) - __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE) >= BENCHPCRING) sched_yield();
+            t  = usclock();
+            ptr= BenchAlloc(BenchSize(BENCH_UNIFORM));
+            ++lat->count[US_LATMALLOC][uslatbucket(usclock() - t)];
+            if(ptr) *(unsigned long *) ptr= done;
+            else ++fail;
+            ring->off[ring->head%BENCHPCRING]= ptr? (usoffset) ((usbase *) ptr - benchbase) : 0;
+            __atomic_store_n(&ring->head,ring->head+1,__ATOMIC_RELEASE);
+            }
+        }
+    else {             /* consumer */
+        for(; done < ops/2; ++done) {
+            while(__atomic_load_n(&ring->head,__ATOMIC_ACQUIRE) == __atomic_load_n(&ring->tail,__ATOMIC_RELAXED)) sched_yield();
+            ptr= ring->off[ring->tail%BENCHPCRING]? (void *) (benchbase + ring->off[ring->tail%BENCHPCRING]) : NULL;
+            __atomic_store_n(&ring->tail,ring->tail+1,__ATOMIC_RELEASE);
+            if(ptr) {
+                t= usclock();
+                BenchFree(ptr);
+                ++lat->count[US_LATFREE][uslatbucket(usclock() - t)];
+                }
+            }
+        }
+    break;
+    }
+
+share->tend[iproc]= usclock();
+share->fail[iproc]= fail;
+free(live);
+}
+
+/* =====================================================================
+ * Support Routines: {{{1
+ */
+
+/* BenchAlloc: this function allocates with the allocator being run {{{2 */
+static void *BenchAlloc(size_t size)
+{
+switch(benchalloc) {
+case BENCH_US:    return usmalloc(size,bencharena);
+case BENCH_GLIBC: return malloc(size);
+case BENCH_NAIVE: return NaiveAlloc(size);
+    }
+
+return NULL;
+}
+
+/* --------------------------------------------------------------------- */
+/* BenchFree: this function frees with the allocator being run {{{2 */
+static void BenchFree(void *ptr)
+{
+switch(benchalloc) {
+case BENCH_US:    usfree(ptr,bencharena); break;
+case BENCH_GLIBC: free(ptr);              break;
+case BENCH_NAIVE: NaiveFree(ptr);         break;
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* BenchSize: this function returns the size of a pattern's next allocation {{{2 */
+static size_t BenchSize(int ipat)
+{
+double u;
+double sz;
+
+
+switch(ipat) {
+case BENCH_FIXED:
+    return 64;
+
+case BENCH_POWERLAW: /* Pareto: 16/u^(1/1.2) */
+    u = ((double) (BenchRand() >> 11) + 1.)/9007199254740993.;
+    sz= 16./pow(u,1./1.2);
+    return (sz < 262144.)? (size_t) sz : (size_t) 262144;
+
+default:
+    return 16 + (size_t) (BenchRand()%4081);
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* BenchRand: this function returns this worker's next random number (xorshift64) {{{2 */
+static unsigned long BenchRand(void)
+{
+benchrand^= benchrand << 13;
+benchrand^= benchrand >> 7;
+benchrand^= benchrand << 17;
+
+return benchrand;
+}
+
+/* --------------------------------------------------------------------- */
+/* BenchList: this function turns a comma-separated list of names into a bitmask {{{2
+ *   Returns: the bitmask, or -1 for an unknown name
+ */
+static int BenchList(
+  char  *list,
+  char **name,
+  int    qty)
+{
+int    i;
+int    mask= 0;
+size_t len;
+
+
+while(*list) {
+    len= strcspn(list,",");
+    for(i= 0; i < qty && (strlen(name[i]) != len || strncmp(name[i],list,len)); ++i) ;
+    if(i >= qty) return -1;
+    mask|= 1 << i;
+    list+= len;
+    if(*list == ',') ++list;
+    }
+
+return mask;
+}
+
+/* --------------------------------------------------------------------- */
+/* NaiveAlloc: this function is the naive allocator's malloc() {{{2
+ *   Blocks are a power of two in size, including an 8 byte header holding
+ *   the power.  A block comes from its power's free list, else from the
+ *   bump pointer; blocks are never split nor merged.
+ */
+static void *NaiveAlloc(size_t size)
+{
+int       cls;
+usoffset  blk= 0;
+
+
+for(cls= 4; cls < NAIVECLASSES && ((usoffset) 1 << cls) < size + 8; ++cls) ;
+if(cls >= NAIVECLASSES) return NULL;
+
+pthread_mutex_lock(&naive->lock);
+if(naive->freelist[cls]) {
+    blk                 = naive->freelist[cls];
+    naive->freelist[cls]= *(usoffset *) ((usbase *) naive + blk + 8);
+    }
+else if(naive->top + ((usoffset) 1 << cls) <= naive->size) {
+    blk        = naive->top;
+    naive->top+= (usoffset) 1 << cls;
+    }
+pthread_mutex_unlock(&naive->lock);
+if(!blk) return NULL;
+
+*(usoffset *) ((usbase *) naive + blk)= (usoffset) cls;
+
+return (usbase *) naive + blk + 8;
+}
+
+/* --------------------------------------------------------------------- */
+/* NaiveFree: this function is the naive allocator's free() {{{2 */
+static void NaiveFree(void *ptr)
+{
+usoffset blk= (usoffset) ((usbase *) ptr - (usbase *) naive) - 8;
+int      cls= (int) *(usoffset *) ((usbase *) naive + blk);
+
+
+pthread_mutex_lock(&naive->lock);
+*(usoffset *) ((usbase *) naive + blk + 8)= naive->freelist[cls];
+naive->freelist[cls]                      = blk;
+pthread_mutex_unlock(&naive->lock);
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
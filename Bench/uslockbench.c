@@ -0,0 +1,418 @@
+/* uslockbench.c: this program measures how the locks scale with contention
+ *   Usage: uslockbench [-p contenders,...] [-m modes] [-k primitives] [-l locktypes]
+ *                      [-c ns,...] [-r ratio,...] [-d msecs] [-t label] [-o csvfile]
+ *     -p list  : qtys of contending processes or threads (default: 1,2,4,8)
+ *     -m list  : proc, thread: contend from processes and/or threads of
+ *                one process (default: proc,thread)
+ *     -k list  : primitives (default: set,cset,arena)
+ *                  set   : ussetlock()/usunsetlock() on a usnewlock() lock
+ *                  cset  : uscsetlock(lock,1), retried until acquired
+ *                  arena : usarenalock()/usarenaunlock()
+ *     -l list  : lock types, as CONF_LOCKTYPE (default: sem,pi)
+ *     -c list  : critical section lengths, in ns of busy work (default: 0,1000)
+ *     -r list  : time spent between a release and the next acquisition
+ *                request, as a multiple of the critical section (default: 1)
+ *     -d msecs : duration of each run (default: 200)
+ *     -t label : label for the CSV rows (ex. the library version)
+ *     -o file  : append the results to file (header written if new)
+ *
+ *   Reported per run: acquisitions per second (all contenders together);
+ *   the p50/p99 time to acquire; the p50/p99 handoff latency (from one
+ *   contender's release to the acquisition by another that was waiting
+ *   for it); and the fairness of the acquisitions among the contenders:
+ *   Jain's index ((sum x)^2/(n sum x^2); 1 is perfectly fair, 1/n is one
+ *   contender getting everything) and the fewest/most ratio.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "arena.h"
+#include "ulocks.h"
+
+/* ------------------------------------------------------------------------
+ * Definitions: {{{2
+ */
+#define LOCKMAXCONTENDERS 64      /* max qty of contenders                      */
+#define LOCK_SET           0      /* primitives                                 */
+#define LOCK_CSET          1
+#define LOCK_ARENA         2
+#define LOCK_PRIMITIVES    3
+#define LOCK_PROC          0      /* modes                                      */
+#define LOCK_THREAD        1
+#define LOCK_MODES         2
+#define LOCKWAIT           0      /* uslat_t rows used: time to acquire          */
+#define LOCKHANDOFF        1      /*                    release-to-acquire time  */
+
+/* ------------------------------------------------------------------------
+ * Typedefs: {{{2
+ */
+typedef struct LockShare_str  LockShare;
+typedef struct LockWorker_str LockWorker;
+
+/* ------------------------------------------------------------------------
+ * Local Data Structures: {{{2
+ */
+struct LockShare_str {                  /* LockShare: shared by the contenders of a run  */
+    int           ready;                /* qty of contenders ready to go                 */
+    int           go;                   /* start!                                        */
+    int           stop;                 /* stop!                                         */
+    unsigned long released __attribute__((aligned(USCACHELINE))); /* usclock() at the last release */
+    unsigned long count[LOCKMAXCONTENDERS][8]; /* acquisitions, per contender (a cache line each) */
+    uslat_t       lat[LOCKMAXCONTENDERS]; /* per contender: LOCKWAIT and LOCKHANDOFF times */
+    };
+struct LockWorker_str {                 /* LockWorker: what a contender is to do         */
+    int           icon;                 /* contender number                              */
+    int           prim;                 /* LOCK_SET etc                                  */
+    unsigned long csns;                 /* critical section length                       */
+    unsigned long outns;                /* time between release and next request         */
+    usptr_t      *arena;
+    ulock_t       lock;
+    LockShare    *share;
+    };
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static char *primname[LOCK_PRIMITIVES]= {"set","cset","arena"};
+static char *modename[LOCK_MODES]     = {"proc","thread"};
+static char *typname[2]               = {"sem","pi"};
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+int main( int, char **);                                              /* uslockbench.c */
+static int LockRun(int,int,int,int,unsigned long,double,unsigned long,LockShare *,double *); /* uslockbench.c */
+static void *LockWorkerRun(void *);                                   /* uslockbench.c */
+static void LockSpin(unsigned long);                                  /* uslockbench.c */
+static int LockList(char *,char **,int);                              /* uslockbench.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* main: it all starts here! {{{2 */
+int main(
+  int    argc,
+  char **argv)
+{
+int            iarg;
+int            itype;
+int            imode;
+int            iprim;
+int            conqty;
+int            types   = 3;
+int            modes   = 3;
+int            prims   = (1 << LOCK_PRIMITIVES) - 1;
+unsigned long  msecs   = 200;
+unsigned long  csns;
+double         ratio;
+double         res[8];
+char          *cons    = "1,2,4,8";
+char          *css     = "0,1000";
+char          *ratios  = "1";
+char          *label   = "";
+char          *csvfile = NULL;
+char          *pc;
+char          *pcs;
+char          *pr;
+FILE          *csv     = NULL;
+LockShare     *share;
+
+
+for(iarg= 1; iarg < argc; ++iarg) {
+    if     (!strcmp(argv[iarg],"-p") && iarg+1 < argc) cons   = argv[++iarg];
+    else if(!strcmp(argv[iarg],"-m") && iarg+1 < argc) modes  = LockList(argv[++iarg],modename,LOCK_MODES);
+    else if(!strcmp(argv[iarg],"-k") && iarg+1 < argc) prims  = LockList(argv[++iarg],primname,LOCK_PRIMITIVES);
+    else if(!strcmp(argv[iarg],"-l") && iarg+1 < argc) types  = LockList(argv[++iarg],typname,2);
+    else if(!strcmp(argv[iarg],"-c") && iarg+1 < argc) css    = argv[++iarg];
+    else if(!strcmp(argv[iarg],"-r") && iarg+1 < argc) ratios = argv[++iarg];
+    else if(!strcmp(argv[iarg],"-d") && iarg+1 < argc) msecs  = strtoul(argv[++iarg],NULL,0);
+    else if(!strcmp(argv[iarg],"-t") && iarg+1 < argc) label  = argv[++iarg];
+    else if(!strcmp(argv[iarg],"-o") && iarg+1 < argc) csvfile= argv[++iarg];
+    else {
+        types= -1;
+        break;
+        }
+    }
+if(types <= 0 || modes <= 0 || prims <= 0 || !msecs) {
+    fprintf(stderr,"usage: uslockbench [-p contenders,...] [-m proc,thread] [-k set,cset,arena] [-l sem,pi] [-c ns,...] [-r ratio,...] [-d msecs] [-t label] [-o csvfile]\n");
+    return 1;
+    }
+
+if(csvfile) {
+    csv= fopen(csvfile,"a");
+    if(!csv) {
+        perror(csvfile);
+        return 1;
+        }
+    if(ftell(csv) == 0) fprintf(csv,"label,primitive,locktype,mode,contenders,cs_ns,ratio,secs,acq_per_sec,wait_p50_ns,wait_p99_ns,handoff_p50_ns,handoff_p99_ns,jain,min_max\n");
+    }
+share= (LockShare *) mmap(NULL,sizeof(LockShare),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,(off_t) 0);
+if(share == MAP_FAILED) {
+    perror("(uslockbench) mmap");
+    return 1;
+    }
+
+printf("%-5s %-4s %-6s %4s %7s %5s %12s %9s %9s %9s %9s %6s %7s\n",
+  "prim","type","mode","n","cs-ns","ratio","acq/sec","w-p50","w-p99","h-p50","h-p99","jain","min/max");
+for(pcs= css; pcs && *pcs; pcs= strchr(pcs,',')? strchr(pcs,',')+1 : NULL) {
+    csns= strtoul(pcs,NULL,0);
+    for(pr= ratios; pr && *pr; pr= strchr(pr,',')? strchr(pr,',')+1 : NULL) {
+        ratio= atof(pr);
+        for(pc= cons; pc && *pc; pc= strchr(pc,',')? strchr(pc,',')+1 : NULL) {
+            conqty= atoi(pc);
+            if(conqty < 1 || conqty > LOCKMAXCONTENDERS) continue;
+            for(iprim= 0; iprim < LOCK_PRIMITIVES; ++iprim) {
+                if(!(prims & (1 << iprim))) continue;
+                for(itype= 0; itype < 2; ++itype) {
+                    if(!(types & (1 << itype))) continue;
+                    for(imode= 0; imode < LOCK_MODES; ++imode) {
+                        if(!(modes & (1 << imode))) continue;
+                        if(LockRun(iprim,itype,imode,conqty,csns,ratio,msecs,share,res)) continue;
+                        printf("%-5s %-4s %-6s %4d %7lu %5.2g %12.0f %9.0f %9.0f %9.0f %9.0f %6.3f %7.3f\n",
+                          primname[iprim],typname[itype],modename[imode],conqty,csns,ratio,
+                          res[1],res[2],res[3],res[4],res[5],res[6],res[7]);
+                        fflush(stdout);
+                        if(csv) {
+                            fprintf(csv,"%s,%s,%s,%s,%d,%lu,%g,%.6f,%.0f,%.0f,%.0f,%.0f,%.0f,%.4f,%.4f\n",
+                              label,primname[iprim],typname[itype],modename[imode],conqty,csns,ratio,
+                              res[0],res[1],res[2],res[3],res[4],res[5],res[6],res[7]);
+                            fflush(csv);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+if(csv) fclose(csv);
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* LockRun: this function runs conqty contenders on one primitive and lock type {{{2
+ *   res[0]=secs  res[1]=acquisitions/sec  res[2..3]=wait p50,p99
+ *   res[4..5]=handoff p50,p99  res[6]=Jain's index  res[7]=fewest/most
+ *   Returns: 0=success  -1=failure
+ */
+static int LockRun(
+  int            iprim,
+  int            itype,
+  int            imode,
+  int            conqty,
+  unsigned long  csns,
+  double         ratio,
+  unsigned long  msecs,
+  LockShare     *share,
+  double        *res)
+{
+int              icon;
+int              ibkt;
+int              row;
+int              ret  = 0;
+unsigned long    t0;
+unsigned long    t1;
+unsigned long    n;
+unsigned long    most = 0;
+unsigned long    fewest= ~0UL;
+double           sum  = 0.;
+double           sumsq= 0.;
+char             arenafile[64];
+pid_t            pid[LOCKMAXCONTENDERS];
+pthread_t        tid[LOCKMAXCONTENDERS];
+LockWorker       work[LOCKMAXCONTENDERS];
+usptr_t         *arena;
+ulock_t          lock;
+struct timespec  nap;
+
+
+memset(share,0,sizeof(LockShare));
+snprintf(arenafile,sizeof(arenafile),"/dev/shm/uslockbench.%d",(int) getpid());
+unlink(arenafile);
+usconfig(CONF_INITSIZE,(size_t) 1 << 20);
+usconfig(CONF_LOCKTYPE,itype? US_LOCKPI : US_LOCKSEM);
+arena= usinit(arenafile);
+if(!arena) {
+    perror("(uslockbench) usinit");
+    return -1;
+    }
+lock= usnewlock(arena);
+if(!lock) {
+    perror("(uslockbench) usnewlock");
+    usfreearena(arena);
+    unlink(arenafile);
+    return -1;
+    }
+
+for(icon= 0; icon < conqty; ++icon) {
+    work[icon].icon = icon;
+    work[icon].prim = iprim;
+    work[icon].csns = csns;
+    work[icon].outns= (unsigned long) (ratio*(double) csns);
+    work[icon].arena= arena;
+    work[icon].lock = lock;
+    work[icon].share= share;
+    if(imode == LOCK_PROC) {
+        pid[icon]= fork();
+        if(pid[icon] == 0) {
+            LockWorkerRun(&work[icon]);
+            _exit(0);
+            }
+        if(pid[icon] < 0) ret= -1;
+        }
+    else if(pthread_create(&tid[icon],NULL,LockWorkerRun,&work[icon])) {
+        tid[icon]= 0;
+        ret      = -1;
+        }
+    if(ret) {
+        perror("(uslockbench) fork/pthread_create");
+        conqty= icon;
+        break;
+        }
+    }
+
+while(__atomic_load_n(&share->ready,__ATOMIC_ACQUIRE) < conqty) sched_yield();
+t0= usclock();
+__atomic_store_n(&share->go,1,__ATOMIC_RELEASE);
+nap.tv_sec = (time_t) (msecs/1000);
+nap.tv_nsec= (long) (msecs%1000)*1000000L;
+nanosleep(&nap,NULL);
+__atomic_store_n(&share->stop,1,__ATOMIC_RELEASE);
+t1= usclock();
+for(icon= 0; icon < conqty; ++icon) {
+    if(imode == LOCK_PROC) waitpid(pid[icon],NULL,0);
+    else                   pthread_join(tid[icon],NULL);
+    }
+
+/* fairness, and merge the contenders' histograms into the first */
+for(icon= 0; icon < conqty; ++icon) {
+    n     = share->count[icon][0];
+    sum  += (double) n;
+    sumsq+= (double) n*(double) n;
+    if(n > most)   most  = n;
+    if(n < fewest) fewest= n;
+    for(row= LOCKWAIT; icon && row <= LOCKHANDOFF; ++row) {
+        for(ibkt= 0; ibkt < USLATBUCKETS; ++ibkt) share->lat[0].count[row][ibkt]+= share->lat[icon].count[row][ibkt];
+        }
+    }
+res[0]= (double) (t1 - t0)/1e9;
+res[1]= sum/res[0];
+res[2]= (double) uslatpercentile(&share->lat[0],LOCKWAIT,50.);
+res[3]= (double) uslatpercentile(&share->lat[0],LOCKWAIT,99.);
+res[4]= (double) uslatpercentile(&share->lat[0],LOCKHANDOFF,50.);
+res[5]= (double) uslatpercentile(&share->lat[0],LOCKHANDOFF,99.);
+res[6]= (sumsq > 0.)? sum*sum/((double) conqty*sumsq) : 0.;
+res[7]= most? (double) fewest/(double) most : 0.;
+
+usfreelock(lock,arena);
+usfreearena(arena);
+unlink(arenafile);
+
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* LockWorkerRun: this function is one contender {{{2
+ *   Until told to stop: request the lock, hold it for csns, release it,
+ *   and wait outns.  The holder notes the time of its release, so the
+ *   next holder can tell how long the lock took to reach it.
+ */
+static void *LockWorkerRun(void *arg)
+{
+LockWorker    *w    = (LockWorker *) arg;
+LockShare     *share= w->share;
+uslat_t       *lat  = &share->lat[w->icon];
+unsigned long  treq;
+unsigned long  tacq;
+unsigned long  rel;
+unsigned long  n    = 0;
+
+
+__atomic_add_fetch(&share->ready,1,__ATOMIC_RELEASE);
+while(!__atomic_load_n(&share->go,__ATOMIC_ACQUIRE)) sched_yield();
+
+while(!__atomic_load_n(&share->stop,__ATOMIC_RELAXED)) {
+    treq= usclock();
+    switch(w->prim) {
+    case LOCK_SET:   ussetlock(w->lock);                  break;
+    case LOCK_CSET:  while(uscsetlock(w->lock,1) != 1) ;  break;
+    case LOCK_ARENA: usarenalock(w->arena);               break;
+        }
+    tacq= usclock();
+    rel = __atomic_load_n(&share->released,__ATOMIC_RELAXED);
+    ++lat->count[LOCKWAIT][uslatbucket(tacq - treq)];
+    if(rel > treq) ++lat->count[LOCKHANDOFF][uslatbucket(tacq - rel)]; /* it was released while we waited */
+    ++n;
+
+    LockSpin(w->csns);
+    __atomic_store_n(&share->released,usclock(),__ATOMIC_RELAXED);
+    switch(w->prim) {
+    case LOCK_SET:
+    case LOCK_CSET:  usunsetlock(w->lock);                break;
+    case LOCK_ARENA: usarenaunlock(w->arena);             break;
+        }
+    LockSpin(w->outns);
+    }
+share->count[w->icon][0]= n;
+
+return NULL;
+}
+
+/* =====================================================================
+ * Support Routines: {{{1
+ */
+
+/* LockSpin: this function busy-works for ns nanoseconds {{{2 */
+static void LockSpin(unsigned long ns)
+{
+unsigned long t0;
+
+
+if(!ns) return;
+for(t0= usclock(); usclock() - t0 < ns; ) ;
+}
+
+/* --------------------------------------------------------------------- */
+/* LockList: this function turns a comma-separated list of names into a bitmask {{{2
+ *   Returns: the bitmask, or -1 for an unknown name
+ */
+static int LockList(
+  char  *list,
+  char **name,
+  int    qty)
+{
+int    i;
+int    mask= 0;
+size_t len;
+
+
+while(*list) {
+    len= strcspn(list,",");
+    for(i= 0; i < qty && (strlen(name[i]) != len || strncmp(name[i],list,len)); ++i) ;
+    if(i >= qty) return -1;
+    mask|= 1 << i;
+    list+= len;
+    if(*list == ',') ++list;
+    }
+
+return mask;
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
@@ -0,0 +1,387 @@
+/* usstress.c: this program stresses usmalloc()/usfree() from the threads of one process
+ *   Usage: usstress [-n threads] [-i iterations] [-l locktypes] [-v]
+ *     -n qty   : qty of threads (default: 4)
+ *     -i qty   : usmalloc()s, usrealloc()s and usfree()s per thread (default: 200000)
+ *     -l list  : lock types, as CONF_LOCKTYPE (default: sem,pi)
+ *     -v       : one more thread runs usverifystep() while the others work
+ *
+ *   Each thread keeps a table of live allocations of random sizes, each
+ *   filled with a pattern of its own; a pattern found changed, a failed
+ *   allocation, or a usverify() error afterwards (or along the way, with
+ *   -v) fails the run.  Two workloads are run with each lock type,
+ *   each on an arena of its own:
+ *     mixed : every thread allocates one-size and multi-size chunks (now
+ *             and then a big one)
+ *     split : the even threads allocate one-size chunks only (split off
+ *             bigger one-size chunks under just USLK_SMALL), the odd ones
+ *             multi-size chunks only (freed under just USLK_BIG), so the
+ *             slivers land next to the multi-size chunks being freed
+ *   The arena locks must exclude the other threads of the process just as
+ *   they do other processes.  Each arena is first handed requests too big
+ *   for a chunk, which must fail with ENOMEM.
+ *   Returns: 0=all runs passed  1=a run failed
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Definitions: {{{2
+ */
+#define STRESSMAXTHREADS  64      /* max qty of threads                         */
+#define STRESSLIVE       256      /* live allocations per thread                */
+#define STRESSARENA (256L<<20)    /* arena size                                 */
+#define STRESSMIXED        0      /* workload: all sizes in every thread        */
+#define STRESSSPLIT        1      /* workload: one-size and multi-size threads  */
+
+/* ------------------------------------------------------------------------
+ * Typedefs: {{{2
+ */
+typedef struct StressWorker_str StressWorker;
+typedef struct StressVerify_str StressVerify;
+
+/* ------------------------------------------------------------------------
+ * Local Data Structures: {{{2
+ */
+struct StressWorker_str {               /* StressWorker: one thread's work               */
+    int            ithread;             /* thread number                                 */
+    int            workload;            /* STRESSMIXED or STRESSSPLIT                    */
+    long           iters;               /* qty of operations to do                       */
+    usptr_t       *arena;
+    unsigned char *ptr[STRESSLIVE];     /* live allocations                              */
+    size_t         size[STRESSLIVE];    /* their sizes                                   */
+    long           errors;              /* qty of failures seen                          */
+    };
+struct StressVerify_str {               /* StressVerify: the -v thread's work            */
+    usptr_t       *arena;
+    volatile int   stop;                /* the workers are done                          */
+    unsigned long  steps;               /* qty of usverifystep() calls                   */
+    long           errors;              /* qty of errors they found                      */
+    };
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static char *typname[2] = {"sem","pi"};
+static char *workname[2]= {"mixed","split"};
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+int main( int, char **);                                              /* usstress.c */
+static int StressRun(int,int,int,long,int);                           /* usstress.c */
+static void *StressWorkerRun(void *);                                 /* usstress.c */
+static void *StressVerifyRun(void *);                                 /* usstress.c */
+static long StressHuge(usptr_t *);                                    /* usstress.c */
+static size_t StressSize(StressWorker *,int);                         /* usstress.c */
+static int StressCheck(StressWorker *,int);                           /* usstress.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* main: it all starts here! {{{2 */
+int main(
+  int    argc,
+  char **argv)
+{
+int   iarg;
+int   itype;
+int   workload;
+int   nthread= 4;
+int   types  = 3;
+int   failed = 0;
+int   verify = 0;
+long  iters  = 200000;
+char *pt;
+
+
+for(iarg= 1; iarg < argc; ++iarg) {
+    if     (!strcmp(argv[iarg],"-n") && iarg+1 < argc) nthread= atoi(argv[++iarg]);
+    else if(!strcmp(argv[iarg],"-i") && iarg+1 < argc) iters  = atol(argv[++iarg]);
+    else if(!strcmp(argv[iarg],"-v"))                  verify = 1;
+    else if(!strcmp(argv[iarg],"-l") && iarg+1 < argc) {
+        for(types= 0, pt= argv[++iarg]; pt && *pt; pt= strchr(pt,',')? strchr(pt,',')+1 : NULL) {
+            if     (!strncmp(pt,"sem",3)) types|= 1 << US_LOCKSEM;
+            else if(!strncmp(pt,"pi",2))  types|= 1 << US_LOCKPI;
+            }
+        }
+    else {
+        types= 0;
+        break;
+        }
+    }
+if(!types || nthread < 1 || nthread > STRESSMAXTHREADS || iters < 1) {
+    fprintf(stderr,"usage: usstress [-n threads] [-i iterations] [-l sem,pi] [-v]\n");
+    return 1;
+    }
+
+for(itype= 0; itype < 2; ++itype) {
+    if(!(types & (1 << itype))) continue;
+    for(workload= STRESSMIXED; workload <= STRESSSPLIT; ++workload) {
+        failed|= StressRun(itype,workload,nthread,iters,verify);
+        }
+    }
+
+return failed;
+}
+
+/* --------------------------------------------------------------------- */
+/* StressRun: this function runs nthread threads of a workload against a new arena of lock type itype {{{2
+ *   verify: one more thread calls usverifystep() until the others are done
+ *   Returns: 0=passed  1=failed
+ */
+static int StressRun(
+  int  itype,
+  int  workload,
+  int  nthread,
+  long iters,
+  int  verify)
+{
+int              ithread;
+int              islot;
+long             errors= 0;
+char             filename[64];
+usptr_t         *arena;
+pthread_t        tid[STRESSMAXTHREADS];
+pthread_t        vtid;
+StressWorker    *worker;
+StressVerify     vwork;
+struct usverify  vrpt;
+
+
+worker= (StressWorker *) calloc((size_t) nthread,sizeof(StressWorker));
+if(!worker) {
+    perror("(usstress) calloc");
+    return 1;
+    }
+sprintf(filename,"/tmp/usstress.%d",(int) getpid());
+unlink(filename);
+usconfig(CONF_INITSIZE,(size_t) STRESSARENA);
+usconfig(CONF_LOCKTYPE,itype);
+arena= usinit(filename);
+if(!arena) {
+    free(worker);
+    return 1;
+    }
+
+errors+= StressHuge(arena);
+memset(&vwork,0,sizeof(StressVerify));
+vwork.arena= arena;
+if(verify && pthread_create(&vtid,NULL,StressVerifyRun,&vwork)) {
+    perror("(usstress) pthread_create");
+    verify= 0;
+    ++errors;
+    }
+for(ithread= 0; ithread < nthread; ++ithread) {
+    worker[ithread].ithread = ithread;
+    worker[ithread].workload= workload;
+    worker[ithread].iters   = iters;
+    worker[ithread].arena   = arena;
+    if(pthread_create(&tid[ithread],NULL,StressWorkerRun,&worker[ithread])) {
+        perror("(usstress) pthread_create");
+        nthread= ithread;
+        ++errors;
+        break;
+        }
+    }
+for(ithread= 0; ithread < nthread; ++ithread) {
+    pthread_join(tid[ithread],NULL);
+    errors+= worker[ithread].errors;
+    }
+if(verify) {
+    vwork.stop= 1;
+    pthread_join(vtid,NULL);
+    errors+= vwork.errors;
+    printf("%-4s %-5s usverifystep() calls=%lu errors=%ld\n",typname[itype],workname[workload],vwork.steps,vwork.errors);
+    }
+
+/* the heap must still be sound, and empty once the survivors are freed */
+if(usverify(arena,1,&vrpt) < 0 || vrpt.errors) {
+    fprintf(stderr,"(usstress) usverify: %lu errors: %s\n",vrpt.errors,vrpt.msg);
+    ++errors;
+    }
+for(ithread= 0; ithread < nthread; ++ithread) {
+    for(islot= 0; islot < STRESSLIVE; ++islot) {
+        if(worker[ithread].ptr[islot]) usfree(worker[ithread].ptr[islot],arena);
+        }
+    }
+if(usverify(arena,1,&vrpt) < 0 || vrpt.errors) {
+    fprintf(stderr,"(usstress) usverify after freeing: %lu errors: %s\n",vrpt.errors,vrpt.msg);
+    ++errors;
+    }
+
+printf("%-4s %-5s threads=%d iterations=%ld chunks=%lu errors=%ld %s\n",
+  typname[itype],workname[workload],nthread,iters,vrpt.chunks,errors,errors? "FAILED" : "ok");
+usfreearena(arena);
+unlink(filename);
+free(worker);
+
+return errors? 1 : 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* StressWorkerRun: this function is a thread's allocation loop {{{2 */
+static void *StressWorkerRun(void *arg)
+{
+StressWorker  *w    = (StressWorker *) arg;
+unsigned int   seed = 1 + (unsigned) w->ithread;
+long           iter;
+int            islot;
+int            r;
+size_t         size;
+unsigned char *p;
+
+
+for(iter= 0; iter < w->iters; ++iter) {
+    r    = rand_r(&seed);
+    islot= r % STRESSLIVE;
+    if(w->ptr[islot] && StressCheck(w,islot)) ++w->errors;
+    r   = rand_r(&seed);
+    size= StressSize(w,r);
+    switch(r % 3) {
+    case 0: /* free */
+        if(w->ptr[islot]) usfree(w->ptr[islot],w->arena);
+        w->ptr[islot]= NULL;
+        break;
+    case 1: /* realloc (or malloc) */
+        p= (unsigned char *) usrealloc(w->ptr[islot],size,w->arena);
+        if(!p) {
+            ++w->errors;
+            break;
+            }
+        w->ptr[islot] = p;
+        w->size[islot]= size;
+        memset(p,(w->ithread*STRESSLIVE + islot)&0xff,size);
+        break;
+    default: /* free and malloc */
+        if(w->ptr[islot]) usfree(w->ptr[islot],w->arena);
+        p= (unsigned char *) usmalloc(size,w->arena);
+        w->ptr[islot]= p;
+        if(!p) {
+            ++w->errors;
+            break;
+            }
+        w->size[islot]= size;
+        memset(p,(w->ithread*STRESSLIVE + islot)&0xff,size);
+        break;
+        }
+    }
+if(w->errors) fprintf(stderr,"(usstress) thread %d: %ld errors\n",w->ithread,w->errors);
+
+return NULL;
+}
+
+/* --------------------------------------------------------------------- */
+/* StressVerifyRun: this function checks the heap, a step at a time, while the workers run {{{2 */
+static void *StressVerifyRun(void *arg)
+{
+StressVerify    *v= (StressVerify *) arg;
+struct usverify  vrpt;
+
+
+while(!v->stop) {
+    if(usverifystep(v->arena,64,&vrpt) != 0) {
+        fprintf(stderr,"(usstress) usverifystep: %s\n",vrpt.msg);
+        ++v->errors;
+        }
+    ++v->steps;
+    }
+
+return NULL;
+}
+
+/* --------------------------------------------------------------------- */
+/* StressHuge: this function checks that requests too big for a chunk fail {{{2
+ *   A size near SIZE_MAX must not wrap around, with the overhead added,
+ *   into a small chunk, nor must uscalloc() then clear SIZE_MAX bytes of
+ *   it (here, of a fastbin chunk).
+ *   Returns: qty of failures
+ */
+static long StressHuge(usptr_t *arena)
+{
+long  errors= 0;
+void *p;
+void *q;
+
+
+errno= 0;
+if(usmalloc((size_t) -8,arena) || errno != ENOMEM) {
+    fprintf(stderr,"(usstress) usmalloc((size_t) -8) didn't fail with ENOMEM\n");
+    ++errors;
+    }
+errno= 0;
+if(usmemalign(64,(size_t) -8,arena) || errno != ENOMEM) {
+    fprintf(stderr,"(usstress) usmemalign(64,(size_t) -8) didn't fail with ENOMEM\n");
+    ++errors;
+    }
+
+p= usmalloc(8,arena);
+q= usmalloc(8,arena);
+usfree(p,arena);
+errno= 0;
+if(uscalloc((size_t) -1,1,arena) || errno != ENOMEM) {
+    fprintf(stderr,"(usstress) uscalloc((size_t) -1,1) didn't fail with ENOMEM\n");
+    ++errors;
+    }
+errno= 0;
+if(usrecalloc(q,(size_t) -1,1,arena) || errno != ENOMEM) {
+    fprintf(stderr,"(usstress) usrecalloc(q,(size_t) -1,1) didn't fail with ENOMEM\n");
+    ++errors;
+    }
+usfree(q,arena);
+
+return errors;
+}
+
+/* --------------------------------------------------------------------- */
+/* StressSize: this function picks the size of a thread's next allocation {{{2
+ *   r: a random number
+ */
+static size_t StressSize(
+  StressWorker *w,
+  int           r)
+{
+if(w->workload == STRESSSPLIT) { /* one-size (<= 400 bytes) or multi-size (>= 600 bytes) */
+    return (w->ithread & 1)? (size_t) (600 + r % 4000) : (size_t) (1 + r % 400);
+    }
+
+return (r % 100 < 60)? (size_t) (1 + r % 500) : (r % 100 < 99)? (size_t) (1 + r % 16384) : (size_t) (1 + r % 1048576);
+}
+
+/* --------------------------------------------------------------------- */
+/* StressCheck: this function checks that allocation islot still holds its pattern {{{2
+ *   Returns: 0=intact  1=changed
+ */
+static int StressCheck(
+  StressWorker *w,
+  int           islot)
+{
+unsigned char  pat= (w->ithread*STRESSLIVE + islot)&0xff;
+unsigned char *p  = w->ptr[islot];
+size_t         i;
+
+
+for(i= 0; i < w->size[islot]; i+= 61) {
+    if(p[i] != pat) return 1;
+    }
+
+return p[w->size[islot]-1] != pat;
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
@@ -22,6 +22,8 @@
 # include <sys/stat.h>
 # include <sys/types.h>
 # include <errno.h>
+# include <pthread.h>
+# include <stddef.h>
 
 /* ------------------------------------------------------------------------
  * Typedefs: {{{1
@@ -30,7 +32,25 @@ typedef struct USArena_str      USArena;       /* cec preferred format    */
 typedef struct USArena_str      usptr_t;       /* forced by compatibility */
 typedef struct USArenaShare_str USArenaShare;
 typedef struct USFreeBin_str    USFreeBin;
+typedef struct USLockLine_str   USLockLine;
+typedef struct USWaiters_str    USWaiters;
+typedef struct USHistCtl_str    USHistCtl;
+typedef struct USHistRec_str    USHistRec;
+typedef struct USHist_str       ushist_t;
+typedef struct USStats_str      USStats;
+typedef struct USLatCtl_str     USLatCtl;
+typedef struct USLat_str        uslat_t;
+typedef struct USTags_str       USTags;
+typedef struct USVerifyCtl_str  USVerifyCtl;
+typedef struct USTopCtl_str     USTopCtl;
+typedef struct USFastCtl_str    USFastCtl;
+typedef struct USRemoteCtl_str  USRemoteCtl;
+typedef struct USProfCtl_str    USProfCtl;
+typedef struct USProfRec_str    USProfRec;
+typedef struct USTraceHdr_str   USTraceHdr;
+typedef struct USTraceRec_str   USTraceRec;
 typedef unsigned long           usoffset;
+typedef void                  (*uscorrupt_t)(struct USArena_str *,void *,const char *); /* corruption handler */
 typedef unsigned char           usbase;
 
 #if defined(__gnu_linux__) && !defined(_PTRDIFF_T_DEFINED)
@@ -52,32 +72,134 @@ typedef int ptrdiff_t;
 # define CONF_INITUSERS    2  /* CONF_INITUSERS,maxusers      -- qty semaphores & locks (default=8) --               */
 # define CONF_GETSIZE      3  /* CONF_GETSIZE                 -- returns arena size in bytes        --               */
 # define CONF_GETUSERS     4  /* CONF_GETUSERS                -- returns qty users                  --               */
-# define CONF_LOCKTYPE     5  /* CONF_LOCKTYPE,locktype       --                                    -- not supported */
+# define CONF_LOCKTYPE     5  /* CONF_LOCKTYPE,locktype       -- US_LOCKSEM (default) or US_LOCKPI  --               */
 # define CONF_ARENATYPE    6  /* CONF_ARENATYPE,US_SHAREDONLY -- no memory map file                 --               */
 # define CONF_CHMOD        7  /* CONF_CHMOD,permission        -- for arena&lock files               --               */
 # define CONF_ATTACHADDR   8  /* CONF_ATTACHADDR,address      --                                    --               */
 # define CONF_AUTOGROW     9  /* CONF_AUTOGROW,int            --                                    -- not supported */
 # define CONF_AUTORESV     10 /* CONF_AUTORESV,int            --                                    -- not supported */
-# define CONF_HISTON       11 /* CONF_HISTON,usptr_t*         -- enables semaphore history logging  -- not supported */
-# define CONF_HISTOFF      12 /* CONF_HISTOFF,usptr_t*        -- disables semaphore history logging -- not supported */
-# define CONF_HISTSIZE     13 /* CONF_HISTSIZE,int            -- maxqty of history records          -- not supported */
-# define CONF_HISTFETCH    14 /* CONF_HISTFETCH,usptr_t*      --                                    -- not supported */
-# define CONF_HISTRESET    15 /* CONF_HISTRESET,usptr_t*      --                                    -- not supported */
+# define CONF_HISTON       11 /* CONF_HISTON,usptr_t*         -- enables semaphore history logging  --               */
+# define CONF_HISTOFF      12 /* CONF_HISTOFF,usptr_t*        -- disables semaphore history logging --               */
+# define CONF_HISTSIZE     13 /* CONF_HISTSIZE,int            -- maxqty of history records          --               */
+# define CONF_HISTFETCH    14 /* CONF_HISTFETCH,usptr_t*,ushist_t* -- snapshot of history records   --               */
+# define CONF_HISTRESET    15 /* CONF_HISTRESET,usptr_t*      -- discards history records           --               */
 # define CONF_STHREADIOOFF 16 /* CONF_STHREADIOOFF            --                                    -- not supported */
 # define CONF_STHREADIOON  17 /* CONF_STHREADIOON             --                                    -- not supported */
+# define CONF_LATON        18 /* CONF_LATON,usptr_t*          -- enables latency histograms         --               */
+# define CONF_LATOFF       19 /* CONF_LATOFF,usptr_t*         -- disables latency histograms        --               */
+# define CONF_LATFETCH     20 /* CONF_LATFETCH,usptr_t*,uslat_t* -- merged latency histograms      --               */
+# define CONF_LATRESET     21 /* CONF_LATRESET,usptr_t*       -- zeroes latency histograms          --               */
+# define CONF_CHECKLEVEL   22 /* CONF_CHECKLEVEL,level        -- integrity checks of a new arena    --               */
+# define CONF_CHECKSET     23 /* CONF_CHECKSET,usptr_t*,level -- integrity checks of an arena       --               */
+# define CONF_CORRUPTFN    24 /* CONF_CORRUPTFN,uscorrupt_t   -- this process' corruption handler   --               */
+# define CONF_PROFON       25 /* CONF_PROFON,usptr_t*,rate    -- enables the heap profiler          --               */
+# define CONF_PROFOFF      26 /* CONF_PROFOFF,usptr_t*        -- disables the heap profiler         --               */
+# define CONF_PROFSIZE     27 /* CONF_PROFSIZE,int            -- maxqty of live heap samples        --               */
+# define CONF_PROFDUMP     28 /* CONF_PROFDUMP,usptr_t*,file,merged -- writes a pprof heap profile  --               */
+# define CONF_TRACEON      29 /* CONF_TRACEON,usptr_t*,file   -- records this process' allocations  --               */
+# define CONF_TRACEOFF     30 /* CONF_TRACEOFF                -- stops recording, writes the rest   --               */
+# define CONF_TRACEFLUSH   31 /* CONF_TRACEFLUSH              -- writes the recorded allocations    --               */
+# define CONF_MINALIGN     32 /* CONF_MINALIGN,align          -- usmalloc() alignment of new arenas --               */
+# define CONF_TRIMSIZE     33 /* CONF_TRIMSIZE,usptr_t*,bytes -- free bytes kept resident per chunk --               */
+# define CONF_FASTMAX      34 /* CONF_FASTMAX,usptr_t*,bytes  -- largest request freed to fastbins  --               */
+# define CONF_REMOTEFREE   35 /* CONF_REMOTEFREE,usptr_t*,on  -- usfree() queues chunks, lock-free  --               */
 
-# define USMAXFREEBIN     156 /* free chunks are in bins [0,155]                                                     */
-# define MINCHUNKSIZE	   16 /* free chunk overhead == 16 bytes                                                     */
+# define US_LOCKSEM         0 /* CONF_LOCKTYPE: SysV semaphores (default)                                              */
+# define US_LOCKPI          1 /* CONF_LOCKTYPE: process-shared priority-inheritance robust mutexes                     */
+
+# define US_CHECKOFF        0 /* CONF_CHECKLEVEL: no integrity checks                                                  */
+# define US_CHECKCHEAP      1 /* CONF_CHECKLEVEL: chunk headers' check bytes (default)                                 */
+# define US_CHECKFULL       2 /* CONF_CHECKLEVEL: also boundary tags and free chunks' bin links                        */
+# ifndef USCHECK
+#  define USCHECK  US_CHECKFULL /* highest check level compiled in (see Src/Makefile)                                  */
+# endif
+
+# define USHISTSIZE      1024 /* default qty of lock history records (CONF_HISTSIZE)                                  */
+# define US_HISTACQUIRE     1 /* USHistRec event: lock acquired (waitns: time spent waiting)                           */
+# define US_HISTRELEASE     2 /* USHistRec event: lock released                                                        */
+# define US_HISTWAIT        3 /* USHistRec event: lock busy, process about to wait                                     */
+# define US_LATMALLOC       0 /* uslat_t metric: usmalloc() call time                                                  */
+# define US_LATFREE         1 /* uslat_t metric: usfree() call time                                                    */
+# define US_LATREALLOC      2 /* uslat_t metric: usrealloc() call time                                                 */
+# define US_LATCALLOC       3 /* uslat_t metric: uscalloc() call time                                                  */
+# define US_LATRECALLOC     4 /* uslat_t metric: usrecalloc() call time                                                */
+# define US_LATLOCKWAIT     5 /* uslat_t metric: time spent waiting for an arena lock (0 if uncontended)               */
+# define US_LATFIND         6 /* uslat_t metric: time in FindChunk() (bin search and split)                            */
+# define US_LATINSERT       7 /* uslat_t metric: time in InsertFreeChunk()                                             */
+# define US_LATQTY          8 /* qty of uslat_t metrics                                                                */
+# define USLATBUCKETS     192 /* qty of log buckets: four per power of two nanoseconds                                 */
+# define USLATMERGE      4096 /* a process merges its latency counts into the arena every USLATMERGE records           */
+# define USMAXTAGS        256 /* qty of chunk tags (see ustag()); tag 0 means untagged                                 */
+# define USTAGNAMELEN      24 /* max length of a tag name, including its terminating null                             */
+# define US_TAGLOCK         1 /* tag pre-interned for usnewlock()'s locks, named "lock"                                */
+# define USVERIFYMSG       96 /* size of struct usverify's msg: what was wrong with its badchunk                        */
+# define USPROFRATE    524288 /* default mean qty of bytes allocated between heap profile samples (CONF_PROFON)        */
+# define USPROFSIZE      8192 /* default qty of heap profile samples that can be live at once (CONF_PROFSIZE)          */
+# define USPROFDEPTH       32 /* max qty of stack frames kept per heap profile sample                                  */
+# define USPROFPROBE       32 /* max qty of slots a heap profile sample is looked for in                               */
+# define USTRACESIZE    65536 /* qty of records in a process' allocation trace ring; half a ring is written at a time  */
+# define USTRACEMAGIC 0x55535452 /* USTraceHdr.magic: "USTR"                                                           */
+# define US_TRACEMALLOC     1 /* USTraceRec op: usmalloc() (and uscalloc()) allocated ichunk                           */
+# define US_TRACEFREE       2 /* USTraceRec op: usfree() freed ichunk                                                  */
+# define US_TRACEREALLOC    3 /* USTraceRec op: usrealloc() (or usrecalloc()) moved old to ichunk                      */
+# define USVERIFYTHREADS   64 /* max qty of usverify() threads                                                         */
+# define USCACHELINE       64 /* cache line size: keeps counters written by different lock holders apart             */
+# define USSHAREMAGIC 0x55534152 /* USArenaShare.magic: "USAR"                                                         */
+# define USSHAREVERSION     2 /* USArenaShare.version: raised whenever USArenaShare's layout changes (see usadd())   */
+# define USMAXWAITERS       8 /* max qty of processes awaiting notification of a lock's release                        */
+
+# define USTRIMSIZE   1048576 /* default CONF_TRIMSIZE: pages of free chunks past their first 1MB are released       */
+# define USTOPCOMMIT   262144 /* the top chunk's memory is committed this many bytes at a time (see TopCommit())     */
+# define USZEROSTREAM 4194304 /* uscalloc() clears chunks this big and up with non-temporal stores (see ZeroFill())  */
+# define USFASTMAX        128 /* default CONF_FASTMAX: frees of requests up to 128 bytes don't merge (see usfree())  */
+# define USFASTBYTES    65536 /* the fastbins are consolidated rather than hold more than this many bytes            */
+# define USMAXFASTBIN      64 /* fastbins [0,63], one per one-size bin                                               */
+# define USMINALIGN         8 /* default alignment of usmalloc()'s memory (CONF_MINALIGN may raise it to 16)         */
+# define USBINSHIFT         3 /* multi-size bins split each power of two of chunk sizes 1<<USBINSHIFT ways           */
+# define USSUBBINS (1<<USBINSHIFT) /* multi-size bins per power of two                                               */
+# define USMAXFREEBIN (64+38*USSUBBINS) /* bins: 64 one-size, then 38 powers of two to 2^47 bytes                    */
+# define USBINMAPQTY ((USMAXFREEBIN+63)/64) /* words in the bitmap of non-empty bins                                 */
+# define MINCHUNKSIZE	   32 /* free chunk overhead == 32 bytes (size:nxt:prv:...:size)                             */
 # define MAXCHUNKSIZE	  sizeof(unsigned long)
 
+/* hidden arena semaphores: these follow the maxusers user semaphores.
+ * Lock ordering: USLK_BIG must be acquired before USLK_SMALL.
+ */
+# define USLK_BIG           0 /* semaphore#maxusers  : multi-size bins [USMAXONESIZE+1,USMAXFREEBIN-1], info           */
+# define USLK_SMALL         1 /* semaphore#maxusers+1: one-size bins [0,USMAXONESIZE]                                  */
+# define USLK_QTY           2 /* qty of hidden arena semaphores                                                        */
+
 # ifdef SEMVMX
 #  define US_SEMUNUSED	  SEMVMX
 # else
 #  define US_SEMUNUSED	  (((ushort) ~0)>>1)
 # endif
 
+/* chunk header word: tag(8 bits) | check(8 bits) | prvfree(1 bit) | size (a multiple of 8) | status(3 bits)
+ * Only free chunks end with a trailing size word; the prvfree bit tells whether the
+ * chunk just before this one is free (and so whether that word is there).  Free chunks
+ * are untagged.  The check byte is a hash of the chunk's offset and size (see uscheckbyte()).
+ * The status and prvfree bits are flipped with atomic operations: a chunk's owner may
+ * change its own bits without a lock while a lock holder changes its prvfree bit.
+ */
+# define USTAGSHIFT                   56
+# define USTAGMASK                    (((usoffset) 0xff) << USTAGSHIFT)
+# define USCHECKSHIFT                 48
+# define USCHECKMASK                  (((usoffset) 0xff) << USCHECKSHIFT)
+# define USPRVFREE                    ((usoffset) 1 << (USCHECKSHIFT - 1))
+# define USSIZEMASK                   ((USPRVFREE - 1)&(~(usoffset) 0x7))
+# if USCHECK >= US_CHECKCHEAP
+#  define uscheckbyte(ichunk,sz)      (((((usoffset) (ichunk) ^ ((usoffset) (sz) << 21))*0x9e3779b97f4a7c15UL) >> 56) << USCHECKSHIFT)
+# else
+#  define uscheckbyte(ichunk,sz)      ((usoffset) 0)
+# endif
+
 # ifdef USINTERNAL
-#  define getsizebgn(ichunk)          (((usoffset *)(usarena->base+ichunk   ))[ 0]&(~0x1))
+#  define ushdr(ichunk)               (((usoffset *)(usarena->base+ichunk   ))[ 0])
+#  define ushdrset(ichunk,bits)       ((void) __atomic_fetch_or(&ushdr(ichunk),(usoffset) (bits),__ATOMIC_RELAXED))
+#  define ushdrclr(ichunk,bits)       ((void) __atomic_fetch_and(&ushdr(ichunk),~(usoffset) (bits),__ATOMIC_RELAXED))
+
+#  define getsizebgn(ichunk)          (((usoffset *)(usarena->base+ichunk   ))[ 0]&USSIZEMASK)
 #  define getsizeend(ichunk,sz)       ((sz)? ((usoffset *)(usarena->base+ichunk+sz))[-1] : 0)
 #  define getnxtchunk(ichunk)         (((usoffset *)(usarena->base+ichunk   ))[ 1])
 #  define getprvchunk(ichunk)         (((usoffset *)(usarena->base+ichunk   ))[ 2])
@@ -85,26 +207,90 @@ typedef int ptrdiff_t;
 
 #  define setnxtchunk(ichunk,nxt)     (((usoffset *)(usarena->base+ichunk   ))[ 1]= nxt)
 #  define setprvchunk(ichunk,prv)     (((usoffset *)(usarena->base+ichunk   ))[ 2]= prv)
-#  define setsize(ichunk,sz)          (((usoffset *)(usarena->base+ichunk   ))[ 0]= sz,\
-									  ((usoffset *)(usarena->base+ichunk+sz))[-1]= sz)
-#  define setfree(ichunk)             (((usoffset *)(usarena->base+ichunk   ))[ 0]|=  0x1)
-#  define setinuse(ichunk)            (((usoffset *)(usarena->base+ichunk   ))[ 0]&= ~0x1)
+
+/* setsize() resizes a chunk in place (it keeps the prvfree bit and leaves the chunk inuse
+ * and untagged); initsize() starts a chunk at an offset that held none, prvfree clear.
+ * setfree() and setinuse() must follow once the size is final: they write the trailing
+ * size and the next chunk's prvfree bit.
+ */
+#  define setsize(ichunk,sz)          (ushdr(ichunk)= (sz)|uscheckbyte(ichunk,sz)|(ushdr(ichunk)&USPRVFREE))
+#  define initsize(ichunk,sz)         (ushdr(ichunk)= (sz)|uscheckbyte(ichunk,sz))
+#  define setfree(ichunk)             (ushdrset(ichunk,0x1),\
+                                      ((usoffset *)(usarena->base+ichunk+getsizebgn(ichunk)))[-1]= getsizebgn(ichunk),\
+                                      setprvfree(ichunk+getsizebgn(ichunk)))
+#  define setinuse(ichunk)            (ushdrclr(ichunk,0x1),clrprvfree(ichunk+getsizebgn(ichunk)))
+
+#  define isprvfree(ichunk)           ((ushdr(ichunk)&USPRVFREE) != 0)
+#  define setprvfree(ichunk)          ((ichunk) < usarena->memsize? ushdrset(ichunk,USPRVFREE) : (void) 0)
+#  define clrprvfree(ichunk)          ((ichunk) < usarena->memsize? ushdrclr(ichunk,USPRVFREE) : (void) 0)
+
+#  define gettag(ichunk)              ((int) ((((usoffset *)(usarena->base+ichunk))[0]) >> USTAGSHIFT))
+#  define settag(ichunk,tag)          (ushdrclr(ichunk,USTAGMASK),ushdrset(ichunk,(usoffset) (tag) << USTAGSHIFT))
 
 #  define isfree(ichunk)              (((((usoffset *)(usarena->base+ichunk   ))[0])&1) == 1)
 #  define isinuse(ichunk)             (((((usoffset *)(usarena->base+ichunk   ))[0])&1) == 0)
 
+/* inuse chunks sampled by the heap profiler (see usprof.c) have bit 1 of their header set */
+#  define issampled(ichunk)           ((((usoffset *)(usarena->base+ichunk   ))[0])&0x2)
+#  define setsampled(ichunk)          ushdrset(ichunk,0x2)
+#  define clrsampled(ichunk)          ushdrclr(ichunk,0x2)
+
+/* freed chunks parked in a fastbin (see usfree()) stay inuse, with bit 2 of their header set;
+ * those queued for the next lock holder to free (CONF_REMOTEFREE) have bits 1 and 2 set.
+ * Neither is sampled any longer.
+ */
+#  define isfast(ichunk)              (((((usoffset *)(usarena->base+ichunk   ))[0])&0x6) == 0x4)
+#  define setfast(ichunk)             ushdrset(ichunk,0x4)
+#  define clrfast(ichunk)             ushdrclr(ichunk,0x4)
+#  define isqueued(ichunk)            (((((usoffset *)(usarena->base+ichunk   ))[0])&0x6) == 0x6)
+#  define setqueued(ichunk)           ushdrset(ichunk,0x6)
+#  define clrqueued(ichunk)           ushdrclr(ichunk,0x6)
+
 /* for inuse chunks (free chunks have additional overhead) */
 #  define ptr2chunk(ptr)              ( (((usbase *)ptr) - sizeof(usoffset)) - usarena->base)
 #  define chunk2ptr(ichunk)           ((void *)((usarena->base + ichunk + sizeof(usoffset))))
 
 /* arena_bin_offset: should be the offset in USArenaShare to the bin array */
 # define arena_bin_offset             ((unsigned)(((unsigned char *)&arenashare.bin)  - ((unsigned char *)&arenashare)))
+# define arena_check_offset           ((unsigned) offsetof(USArenaShare,check))
+# define arena_trim_offset            ((unsigned) offsetof(USArenaShare,trim))
 # define arena_info_offset            ((unsigned)(((unsigned char *)&arenashare.info) - ((unsigned char *)&arenashare)))
+# define arena_lock_offset            ((unsigned)(((unsigned char *)&arenashare.lock) - ((unsigned char *)&arenashare)))
+# define arena_hist_offset            ((unsigned) offsetof(USArenaShare,hist))
+# define arena_prof_offset            ((unsigned) offsetof(USArenaShare,prof))
+# define arena_verify_offset          ((unsigned) offsetof(USArenaShare,verify))
+# define arena_top_offset             ((unsigned) offsetof(USArenaShare,top))
+# define arena_fast_offset            ((unsigned) offsetof(USArenaShare,fast))
+# define arena_remote_offset          ((unsigned) offsetof(USArenaShare,remote))
+# define arena_tags_offset            ((unsigned) offsetof(USArenaShare,tags))
+# define arena_lat_offset             ((unsigned) offsetof(USArenaShare,lat))
+# define arena_stats_offset           ((unsigned) offsetof(USArenaShare,stats))
+# define arena_binqty_offset          ((unsigned) offsetof(USArenaShare,binqty))
+# define arena_binmap_offset          ((unsigned) offsetof(USArenaShare,binmap))
+# define arena_waiters_offset         ((unsigned)(((unsigned char *)&arenashare.waiters) - ((unsigned char *)&arenashare)))
 
 #  define usabs(x,y)                  ((x>=y)? (x-y) : (y-x))
 #  define USMAXONESIZE	63
+#  define isonesize(sz)               ((sz) <= (usoffset) 8*(USMAXONESIZE+1)) /* chunk belongs in a one-size bin */
+#  define usbinheld(ilk)              (*uslockheld() & (1<<(ilk))) /* held by this thread? */
+#  define uscheck(level)              (USCHECK >= (level) && *usarena->check >= (level)) /* check at this level? */
+#  define getcheckbyte(ichunk)        (((usoffset *)(usarena->base+ichunk   ))[ 0]&USCHECKMASK)
+
+/* uslatbgn/uslatend: time an operation for the latency histograms.  When the
+ * histograms are off, uslatbgn() yields 0 and uslatend() does nothing.
+ */
+#  ifdef USLATENCY
+#   define uslatbgn(arena)            ((arena)->lat->on? usclock() : 0UL)
+#   define uslatend(arena,metric,t0)  ((t0)? uslatrec(arena,metric,usclock() - (t0)) : (void) 0)
+#  else
+#   define uslatbgn(arena)            0UL
+#   define uslatend(arena,metric,t0)  ((void) (t0))
+#  endif
 # endif
 
+/* ushistevent: records a lock event if lock history recording is on */
+# define ushistevent(hist,event,lockid,waitns)  ((hist)->on? ushistrec(hist,event,lockid,waitns) : (void) 0)
+
 /* ------------------------------------------------------------------------
  * Local Data Structures: {{{1
  */
@@ -112,6 +298,120 @@ struct USFreeBin_str {                /* USFreeBin:                     {{{2
     usoffset hd;                      /* head of same-bin-size linked list                 */
     usoffset tl;                      /* tail of same-bin-size linked list                 */
     };
+struct USLockLine_str {               /* USLockLine: an arena mutex     {{{2               */
+    pthread_mutex_t mutex;            /* US_LOCKPI: one of the USLK_* arena locks          */
+    } __attribute__((aligned(USCACHELINE)));
+struct USWaiters_str {                /* USWaiters:                     {{{2               */
+    int      qty;                     /* qty of registered waiters (a hint for releasers)  */
+    pid_t    pid[USMAXWAITERS];       /* processes to notify when the lock is released     */
+    };
+struct USHistCtl_str {                /* USHistCtl: lock history ring   {{{2               */
+    int           on;                 /* recording lock events?                            */
+    unsigned      size;               /* qty of records in the ring                        */
+    usoffset      ring;               /* offset of the USHistRec ring from the arena start */
+    unsigned long idx;                /* qty of records ever written                       */
+    };
+struct USHistRec_str {                /* USHistRec: one lock event      {{{2               */
+    unsigned long seq;                /* 1+record number; 0 while being written            */
+    unsigned long time;               /* CLOCK_MONOTONIC, in nanoseconds                   */
+    unsigned long waitns;             /* US_HISTACQUIRE: nanoseconds spent waiting         */
+    usoffset      lockid;             /* ulock_t: its arena offset; 1+USLK_*: arena locks  */
+    pid_t         pid;                /* process id                                        */
+    pid_t         tid;                /* thread id                                         */
+    int           event;              /* US_HISTACQUIRE, US_HISTRELEASE, US_HISTWAIT       */
+    };
+struct USHist_str {                   /* ushist_t: CONF_HISTFETCH snapshot {{{2            */
+    USHistRec    *rec;                /* malloc'd records, oldest first (caller frees)     */
+    unsigned long qty;                /* qty of records in rec                             */
+    unsigned long lost;               /* qty of records overwritten before the snapshot    */
+    };
+struct USStats_str {                  /* USStats: allocator counters    {{{2               */
+    long          inuse;              /* bytes allocated less bytes freed, by this lock    */
+    unsigned long peak;               /* highest arena-wide inuse seen by this lock        */
+    unsigned long nmalloc;            /* qty of successful allocations                     */
+    unsigned long nfree;              /* qty of frees                                      */
+    unsigned long nfail;              /* qty of failed allocations                         */
+    unsigned long nlock;              /* qty of lock acquisitions                          */
+    unsigned long ncontend;           /* qty of lock acquisitions that had to wait         */
+    } __attribute__((aligned(USCACHELINE)));
+struct usmallinfo {                   /* usmallinfo: see usmallinfo()   {{{2               */
+    size_t        arena;              /* bytes of allocatable memory in the arena          */
+    size_t        inuse;              /* bytes in inuse chunks (including their overhead)  */
+    size_t        free;               /* bytes in free chunks                              */
+    size_t        top;                /* bytes in the top chunk (included in free)         */
+    size_t        fast;               /* bytes in the fastbins (included in free)          */
+    size_t        peak;               /* high-water mark of inuse                          */
+    unsigned long nmalloc;            /* qty of successful allocations                     */
+    unsigned long nfree;              /* qty of frees                                      */
+    unsigned long nfail;              /* qty of failed allocations                         */
+    unsigned long nlock;              /* qty of arena lock acquisitions                    */
+    unsigned long ncontend;           /* qty of arena lock acquisitions that had to wait   */
+    unsigned long binqty[USMAXFREEBIN]; /* qty of free chunks in each bin                  */
+    };
+struct USLatCtl_str {                 /* USLatCtl: latency histograms   {{{2               */
+    int           on;                 /* recording latencies?                              */
+    usoffset      count;              /* offset of the merged uslat_t from the arena start */
+    };
+struct USLat_str {                    /* uslat_t: latency histograms    {{{2               */
+    unsigned long count[US_LATQTY][USLATBUCKETS]; /* qty of samples per metric and bucket  */
+    };
+struct USTags_str {                   /* USTags: interned chunk tags    {{{2               */
+    unsigned      qty;                /* qty of tags in use (tag 0 included)               */
+    char          name[USMAXTAGS][USTAGNAMELEN]; /* tag names                              */
+    long          bytes[USMAXTAGS] __attribute__((aligned(USCACHELINE))); /* bytes in chunks with each tag */
+    };
+struct USProfCtl_str {                /* USProfCtl: heap profiler       {{{2               */
+    int           on;                 /* sampling allocations?                             */
+    unsigned long rate;               /* mean qty of bytes allocated between samples       */
+    unsigned      size;               /* qty of USProfRec slots in the table               */
+    usoffset      table;              /* offset of the USProfRec table from the arena start */
+    unsigned long dropped;            /* qty of samples that found no free slot            */
+    };
+struct USTraceHdr_str {               /* USTraceHdr: trace file block   {{{2               */
+    unsigned int  magic;              /* USTRACEMAGIC                                      */
+    pid_t         pid;                /* process that recorded the block                   */
+    unsigned long qty;                /* qty of USTraceRecs following                      */
+    };
+struct USTraceRec_str {               /* USTraceRec: one traced call    {{{2               */
+    unsigned long time;               /* CLOCK_MONOTONIC, in nanoseconds                   */
+    unsigned long size : 56;          /* bytes requested                                   */
+    unsigned long op   :  8;          /* US_TRACEMALLOC, US_TRACEFREE, US_TRACEREALLOC     */
+    usoffset      ichunk;             /* chunk allocated or freed                          */
+    usoffset      old;                /* US_TRACEREALLOC: chunk reallocated (and freed)    */
+    };
+struct USProfRec_str {                /* USProfRec: one live sample     {{{2               */
+    usoffset      ichunk;             /* sampled chunk (0: never used, USPROFDEAD, USPROFBUSY) */
+    size_t        size;               /* bytes requested                                   */
+    pid_t         pid;                /* allocating process                                */
+    int           depth;              /* qty of frames in pc                               */
+    void         *pc[USPROFDEPTH];    /* allocating stack, innermost first                 */
+    };
+struct USVerifyCtl_str {              /* USVerifyCtl: usverifystep() state {{{2            */
+    usoffset      cursor;             /* next chunk to check; MergeFreeChunk() keeps it on a chunk */
+    unsigned long pass;               /* qty of completed passes over the heap             */
+    };
+struct USTopCtl_str {                 /* USTopCtl: the top chunk        {{{2               */
+    usoffset      chunk;              /* free chunk ending the heap, kept out of the bins (0: none) */
+    usoffset      commit;             /* its memory below this offset has been committed   */
+    usoffset      zero;               /* its memory from here on reads zero (but its trailing size) */
+    };
+struct USFastCtl_str {                /* USFastCtl: fastbins (USLK_SMALL) {{{2             */
+    size_t        max;                /* largest request whose chunk is parked (0: none)   */
+    size_t        bytes;              /* bytes in the fastbins' chunks                     */
+    usoffset      hd[USMAXFASTBIN];   /* heads of the fastbins' singly linked lists        */
+    } __attribute__((aligned(USCACHELINE)));
+struct USRemoteCtl_str {              /* USRemoteCtl: remote frees      {{{2               */
+    int           on;                 /* usfree() queues chunks rather than lock (CONF_REMOTEFREE) */
+    usoffset      hd;                 /* queued chunks, linked through their nxt words     */
+    } __attribute__((aligned(USCACHELINE)));
+struct usverify {                     /* usverify: see usverify()       {{{2               */
+    unsigned long chunks;             /* qty of chunks checked                             */
+    unsigned long freechunks;         /* qty of those that were free                       */
+    unsigned long errors;             /* qty of errors found                               */
+    usoffset      badchunk;           /* lowest chunk found to be bad (0: none)            */
+    char          msg[USVERIFYMSG];   /* what was wrong with badchunk                      */
+    unsigned long pass;               /* usverifystep(): qty of completed passes           */
+    };
 struct USArena_str {                  /* USArena: (usptr_t)             {{{2               */
     char           *filename;         /* name of shared memory file                        */
     unsigned long   permission;       /* usual unix process permission for shared mem file */
@@ -124,15 +424,64 @@ struct USArena_str {                  /* USArena: (usptr_t)             {{{2
     unsigned long   maxusers;         /* (USArenaShare) controls qty semaphores            */
     usoffset        info;             /* (USArenaShare) usinfo storage                     */
     USFreeBin      *bin;              /* (USArenaShare) free chunk bins                    */
+    int             locktype;         /* (USArenaShare) US_LOCKSEM or US_LOCKPI            */
+    int            *check;            /* (USArenaShare) integrity check level              */
+    size_t         *trim;             /* (USArenaShare) CONF_TRIMSIZE                      */
+    USLockLine     *lock;             /* (USArenaShare) US_LOCKPI arena locks              */
+    USWaiters      *waiters;          /* (USArenaShare) usarenaasynclock() waiters         */
+    USHistCtl      *hist;             /* (USArenaShare) lock history                       */
+    USStats        *stats;            /* (USArenaShare) counters, one set per USLK_* lock  */
+    USLatCtl       *lat;              /* (USArenaShare) latency histograms                 */
+    USTags         *tags;             /* (USArenaShare) chunk tags                         */
+    USVerifyCtl    *verify;           /* (USArenaShare) usverifystep() cursor              */
+    USTopCtl       *top;              /* (USArenaShare) top chunk                          */
+    USFastCtl      *fast;             /* (USArenaShare) fastbins                           */
+    USRemoteCtl    *remote;           /* (USArenaShare) chunks queued by usfree()          */
+    USProfCtl      *prof;             /* (USArenaShare) heap profiler                      */
+    unsigned long  *binqty;           /* (USArenaShare) qty of free chunks per bin         */
+    unsigned long  *binmap;           /* (USArenaShare) bitmap of the non-empty bins       */
+    unsigned        histsize;         /* CONF_HISTSIZE                                     */
+    int             checklevel;       /* CONF_CHECKLEVEL                                   */
+    unsigned        profsize;         /* CONF_PROFSIZE                                     */
+    unsigned        minalign;         /* CONF_MINALIGN                                     */
+    unsigned        align;            /* (USArenaShare) alignment of usmalloc()'s memory   */
+    int             trace;            /* CONF_TRACEON: recording this process' allocations */
     };
 struct USArenaShare_str {             /* USArenaShare                    {{{2              */
-    void          *memattach;         /* optional where-to-attach mempool                  */
+    /* read-mostly: the geometry usinit() fixes, and the settings usconfig() seldom changes */
+    void          *memattach;         /* optional where-to-attach mempool (must be first)  */
+    unsigned int   magic;             /* USSHAREMAGIC                                      */
+    unsigned int   version;           /* USSHAREVERSION                                    */
+    unsigned int   sharesize;         /* sizeof(USArenaShare)                              */
+    unsigned int   nbin;              /* USMAXFREEBIN                                      */
     key_t          key;               /* IPC key                                           */
-	int            usedlocks;         /* qty of locks currently in use                     */
+    int            locktype;          /* US_LOCKSEM or US_LOCKPI                           */
     size_t         memsize;           /* total size of shared memory                       */
     unsigned long  maxusers;          /* current qty of semaphores                         */
-	usoffset       info;              /* usgetinfo() and usputinfo() modify this           */
-    USFreeBin      bin[USMAXFREEBIN]; /* free chunk bins                                   */
+    unsigned       align;             /* alignment of usmalloc()'s memory: 8 or 16         */
+    int            check;             /* US_CHECKOFF, US_CHECKCHEAP, or US_CHECKFULL       */
+    size_t         trim;              /* free chunks' pages past their first trim bytes are released */
+    /* the lock words and their waiters, a cache line apiece */
+    USLockLine     lock[USLK_QTY];    /* US_LOCKPI: arena locks (see USLK_*)               */
+    USWaiters      waiters __attribute__((aligned(USCACHELINE))); /* processes awaiting the release of the arena lock */
+    /* usputinfo()'s line, away from the allocators' */
+    usoffset       info __attribute__((aligned(USCACHELINE))); /* usgetinfo() and usputinfo() modify this */
+    /* instrumentation switches, read on every call while off */
+    USHistCtl      hist __attribute__((aligned(USCACHELINE))); /* lock history (CONF_HISTON etc) */
+    USLatCtl       lat;               /* latency histograms (CONF_LATON etc)               */
+    USProfCtl      prof;              /* heap profiler (CONF_PROFON etc)                   */
+    /* bins: the one-size bins (USLK_SMALL) fill whole lines, so the multi-size bins (USLK_BIG) start one */
+    USFreeBin      bin[USMAXFREEBIN] __attribute__((aligned(USCACHELINE))); /* free chunk bins */
+    unsigned long  binpad[USCACHELINE/sizeof(unsigned long)-1] __attribute__((aligned(USCACHELINE))); /* ends a line with binmap[0] */
+    unsigned long  binmap[USBINMAPQTY]; /* bit ibin%64 of [ibin/64] set: bin[ibin] isn't empty; [0] is USLK_SMALL's */
+    unsigned long  binqty[USMAXFREEBIN] __attribute__((aligned(USCACHELINE))); /* free chunks per bin */
+    USTopCtl       top __attribute__((aligned(USCACHELINE))); /* top chunk (USLK_BIG) */
+    USVerifyCtl    verify;            /* usverifystep() cursor (USLK_BIG)                  */
+    USFastCtl      fast;              /* fastbins: freed small chunks, not yet merged      */
+    USRemoteCtl    remote;            /* freed chunks queued for the next lock holder      */
+    /* counters, a line per lock */
+    USStats        stats[USLK_QTY];   /* counters, each updated under its own USLK_* lock  */
+    USTags         tags;              /* chunk tags (ustag(), usmemdesc())                 */
     };
 
 /* ------------------------------------------------------------------------
@@ -144,19 +493,69 @@ int usadd(usptr_t *);                                    /* usarena.c  */
 int usarenalockinit(usptr_t *);                          /* usarena.c  */
 int usarenalock(usptr_t *);                              /* usarena.c  */
 int usarenaunlock(usptr_t *);                            /* usarena.c  */
+int usbinlock(usptr_t *,int);                            /* usarena.c  */
+int usbinunlock(usptr_t *,int);                          /* usarena.c  */
+unsigned *uslockheld(void);                              /* usarena.c  */
+int usarenaasynclock(usptr_t *);                         /* usarena.c  */
 void usfreearena(usptr_t *);                             /* usarena.c  */
 void *uscalloc( size_t, size_t, usptr_t *);              /* usmalloc.c */
 void usfree( void *, usptr_t *);                         /* usmalloc.c */
 void *usmalloc( size_t, usptr_t *);                      /* usmalloc.c */
+void *usmemalign(size_t,size_t,usptr_t *);               /* usmalloc.c */
+int usposix_memalign(void **,size_t,size_t,usptr_t *);   /* usmalloc.c */
+void *usaligned_alloc(size_t,size_t,usptr_t *);          /* usmalloc.c */
 void *usrealloc( void *, size_t, usptr_t *);             /* usmalloc.c */
 void *usrecalloc( void *,  size_t,  size_t,  usptr_t *); /* usmalloc.c */
 int ushashsize(usoffset);                                /* usmalloc.c */
+usoffset usbinminsize(int);                              /* usmalloc.c */
+int usmallinfo(usptr_t *,struct usmallinfo *);           /* usmalloc.c */
 void usmemuse( USArena *, int);                          /* usmalloc.c */
 char *usmemdesc( void *, char *);                        /* usmalloc.c */
 void usmemdescfree(void *);                              /* usmalloc.c */
+int ustag(usptr_t *,const char *);                       /* usmalloc.c */
+const char *ustagname(usptr_t *,int);                    /* usmalloc.c */
+int ussettag(usptr_t *,void *,int);                      /* usmalloc.c */
+int usgettag(usptr_t *,void *);                          /* usmalloc.c */
+uscorrupt_t uscorruptfn(uscorrupt_t);                    /* usmalloc.c */
+long ustrim(usptr_t *,size_t);                           /* usmalloc.c */
+void uscorrupt(void *,const char *,...);                 /* usmalloc.c */
 void usputinfo(usptr_t *,void *);                        /* usinfo.c   */
 void *usgetinfo(usptr_t *);                              /* usinfo.c   */
 int uscasinfo(usptr_t *,void *,void *);                  /* usinfo.c   */
+unsigned long usclock(void);                             /* ushist.c   */
+void ushistrec(USHistCtl *,int,usoffset,unsigned long);  /* ushist.c   */
+int ushiston(usptr_t *);                                 /* ushist.c   */
+int ushistoff(usptr_t *);                                /* ushist.c   */
+long ushistfetch(usptr_t *,ushist_t *);                  /* ushist.c   */
+int ushistreset(usptr_t *);                              /* ushist.c   */
+int uslatbucket(unsigned long);                          /* uslat.c    */
+int uslatfetch(usptr_t *,uslat_t *);                     /* uslat.c    */
+int uslatmerge(usptr_t *);                               /* uslat.c    */
+unsigned long uslatns(int);                              /* uslat.c    */
+int uslatoff(usptr_t *);                                 /* uslat.c    */
+int uslaton(usptr_t *);                                  /* uslat.c    */
+unsigned long uslatpercentile(uslat_t *,int,double);     /* uslat.c    */
+void uslatfree(usptr_t *);                               /* uslat.c    */
+void uslatrec(usptr_t *,int,unsigned long);              /* uslat.c    */
+int uslatreset(usptr_t *);                               /* uslat.c    */
+int usverify(usptr_t *,int,struct usverify *);          /* usverify.c */
+int usverifystep(usptr_t *,unsigned long,struct usverify *); /* usverify.c */
+int usprofdump(usptr_t *,const char *,int);              /* usprof.c   */
+void usproffree(usptr_t *,usoffset);                     /* usprof.c   */
+int usprofoff(usptr_t *);                                /* usprof.c   */
+int usprofon(usptr_t *,unsigned long);                   /* usprof.c   */
+void usprofsample(usptr_t *,usoffset,size_t);            /* usprof.c   */
+int ustraceflush(void);                                  /* ustrace.c  */
+int ustraceoff(void);                                    /* ustrace.c  */
+int ustraceon(usptr_t *,const char *);                   /* ustrace.c  */
+void ustracerec(int,usoffset,usoffset,size_t);           /* ustrace.c  */
+int uspimutexinit(pthread_mutex_t *);                    /* ulocks.c   */
+int uspimutexlock(pthread_mutex_t *,int);                /* ulocks.c   */
+int uslockfd(void);                                      /* ulocks.c   */
+int uslockdrain(void);                                   /* ulocks.c   */
+int uswaitadd(USWaiters *);                              /* ulocks.c   */
+void uswaitdel(USWaiters *);                             /* ulocks.c   */
+void uswake(USWaiters *);                                /* ulocks.c   */
 #endif	/*  __USARENA_H__ */
 
 /* ---------------------------------------------------------------------
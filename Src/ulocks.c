@@ -12,21 +12,85 @@
  */
 #define XSEM_H
 #include <stdio.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "arena.h"
 #include "ulocks.h"
+#include "usprobe.h"
 
 /* ------------------------------------------------------------------------
  * Definitions: {{{2
  */
 #define EAGAINMAX   10
+#ifndef SEMOPM
+# define SEMOPM     32 /* max qty of operations per semop() (old Linux default) */
+#endif
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static int   lockfd    = -1; /* this process' lock-release notification socket */
+static pid_t lockfdpid = 0;  /* the process that lockfd was bound for          */
+static int   wakefd    = -1; /* socket used to send notifications              */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+static socklen_t lockfdaddr(struct sockaddr_un *,pid_t); /* ulocks.c */
+static int lockcmp(const void *,const void *);           /* ulocks.c */
 
 /* =====================================================================
  * Functions: {{{1
  */
 
+/* --------------------------------------------------------------------- */
+/* uspimutexinit: this function initializes a process-shared, robust, {{{2
+ * priority-inheritance mutex (the US_LOCKPI lock type).  The mutex must
+ * live in the arena.  Returns 0 on success, an errno value otherwise.
+ */
+int uspimutexinit(pthread_mutex_t *mutex)
+{
+int                 ret;
+pthread_mutexattr_t attr;
+
+
+ret= pthread_mutexattr_init(&attr);
+if(ret) return ret;
+ret=          pthread_mutexattr_setpshared(&attr,PTHREAD_PROCESS_SHARED);
+if(!ret) ret= pthread_mutexattr_setprotocol(&attr,PTHREAD_PRIO_INHERIT);
+if(!ret) ret= pthread_mutexattr_setrobust(&attr,PTHREAD_MUTEX_ROBUST);
+if(!ret) ret= pthread_mutex_init(mutex,&attr);
+pthread_mutexattr_destroy(&attr);
+
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* uspimutexlock: this function locks a US_LOCKPI mutex {{{2
+ *   nowait=0: blocks until the mutex is acquired
+ *   nowait=1: doesn't block; returns EBUSY if somebody else holds it
+ * If the previous owner died while holding the mutex, the mutex is made
+ * consistent and the lock is acquired (akin to SEM_UNDO for semaphores).
+ * Returns 0 when the lock was acquired, an errno value otherwise.
+ */
+int uspimutexlock(
+  pthread_mutex_t *mutex,
+  int              nowait)
+{
+int ret;
+
+
+ret= nowait? pthread_mutex_trylock(mutex) : pthread_mutex_lock(mutex);
+if(ret == EOWNERDEAD) ret= pthread_mutex_consistent(mutex);
+
+return ret;
+}
+
 /* --------------------------------------------------------------------- */
 /* usnewlock: this function allocates a lock from the usarena and {{{2
- * initializes it.  Locks are semaphore based.
+ * initializes it.  Locks are semaphore based, or with CONF_LOCKTYPE
+ * US_LOCKPI, priority-inheritance mutex based.
  */
 ulock_t usnewlock(usptr_t *usarena)
 {
@@ -47,8 +111,30 @@ if(!usarena) {
     return NULL;
     }
 
+if(usarena->locktype == US_LOCKPI) { /* mutex lives in the lock itself; no semaphore needed */
+    lock= (ulock_t) usmalloc(sizeof(USLock),usarena);
+    if(!lock) {
+        errno= ENOMEM;
+        return NULL;
+        }
+    ussettag(usarena,lock,US_TAGLOCK);
+    lock->lock     = 0;
+    lock->semid    = usarena->semid;
+    lock->maxusers = usarena->maxusers;
+    lock->locktype = US_LOCKPI;
+    lock->arenaoff = ((usbase *) lock) - usarena->mempool;
+    memset(&lock->waiters,0,sizeof(USWaiters));
+    ret            = uspimutexinit(&lock->mutex);
+    if(ret) {
+        usfree(lock,usarena);
+        errno= ret;
+        return NULL;
+        }
+    return lock;
+    }
+
 /* find an unused semaphore.  set its value to zero */
-semun.array = (ushort *) calloc((size_t) usarena->maxusers+1,sizeof(ushort));
+semun.array = (ushort *) calloc((size_t) usarena->maxusers+USLK_QTY,sizeof(ushort));
 ret         = semctl(usarena->semid,0,GETALL,semun);
 if(ret < 0) {
     if(semun.array) free(semun.array);
@@ -57,15 +143,18 @@ if(ret < 0) {
 for(iarray= 0; iarray < usarena->maxusers; ++iarray) {
     if(semun.array[iarray] == US_SEMUNUSED) {
         lock= (ulock_t) usmalloc(sizeof(USLock),usarena);
-        usmemdesc(lock,"lock");
         if(!lock) {
             errno= ENOMEM;
             break;
             }
+        ussettag(usarena,lock,US_TAGLOCK);
         free(semun.array);
         lock->lock     = iarray;
         lock->semid    = usarena->semid;
         lock->maxusers = usarena->maxusers;
+        lock->locktype = US_LOCKSEM;
+        lock->arenaoff = ((usbase *) lock) - usarena->mempool;
+        memset(&lock->waiters,0,sizeof(USWaiters));
         semun.val      = 0;
         ret            = semctl(usarena->semid,lock->lock,SETVAL,semun);
         if(ret < 0) {
@@ -114,6 +203,11 @@ if(!lock) {
 if(!usarena) {
     return;
     }
+if(lock->locktype == US_LOCKPI) {
+    pthread_mutex_destroy(&lock->mutex);
+    usfree(lock,usarena);
+    return;
+    }
 if(lock->lock < 0 || usarena->maxusers < lock->lock) {
     return;
     }
@@ -131,30 +225,184 @@ usfree(lock,usarena);
 /* ussetlock: this function atomically tests&sets a semaphore lock {{{2 */
 int ussetlock(ulock_t lock)
 {
-int           eagaincnt= 0;
-int           ret;
-struct sembuf sops;
+int            eagaincnt= 0;
+int            ret;
+unsigned long  waitns   = 0;
+USHistCtl     *hist;
+struct sembuf  sops[2];
 
 
 /* sanity checks */
 if(!lock) {
     return -1;
     }
+hist= uslockhist(lock);
+if(lock->locktype == US_LOCKPI) {
+    ret= uspimutexlock(&lock->mutex,1);
+    if(ret == EBUSY) { /* contended */
+        uslockevent(hist,US_HISTWAIT,lock->arenaoff,0UL);
+        if(hist->on) waitns= usclock();
+        ret= uspimutexlock(&lock->mutex,0);
+        if(waitns) waitns= usclock() - waitns;
+        }
+    if(ret) return -1;
+    uslockevent(hist,US_HISTACQUIRE,lock->arenaoff,waitns);
+    return 0;
+    }
 if(lock->lock < 0 || lock->maxusers < lock->lock) {
     return -1;
     }
 
-sops.sem_flg= SEM_UNDO;   /* blocking and will leave semaphore available if process dies */
-sops.sem_num= lock->lock; /* select semaphore by number                                  */
-sops.sem_op = 0;          /* block until semaphore goes to zero                          */
-do {                      /* ignore interrupts                                           */
-    errno = 0;
-    ret   = semop(lock->semid,&sops,1);
-    if(errno == EAGAIN && ++eagaincnt > EAGAINMAX) break;
-    } while(ret == -1 && (errno == EINTR || errno == EAGAIN));
+sops[0].sem_flg= SEM_UNDO|IPC_NOWAIT; /* first, see if the semaphore is free (no waiting)            */
+sops[0].sem_num= lock->lock;          /* select semaphore by number                                  */
+sops[0].sem_op = 0;                   /* semaphore is zero...                                        */
+sops[1].sem_flg= SEM_UNDO|IPC_NOWAIT;
+sops[1].sem_num= lock->lock;
+sops[1].sem_op = 1;                   /* ...and then atomically take it                              */
+ret            = semop(lock->semid,sops,2);
+if(ret == -1 && errno == EAGAIN) {    /* contended: block; leave semaphore available if process dies */
+    uslockevent(hist,US_HISTWAIT,lock->arenaoff,0UL);
+    if(hist->on) waitns= usclock();
+    sops[0].sem_flg= sops[1].sem_flg= SEM_UNDO;
+    do {                              /* ignore interrupts                                           */
+        errno = 0;
+        ret   = semop(lock->semid,sops,2);
+        if(errno == EAGAIN && ++eagaincnt > EAGAINMAX) break;
+        } while(ret == -1 && (errno == EINTR || errno == EAGAIN));
+    if(waitns) waitns= usclock() - waitns;
+    }
+if(ret == 0) uslockevent(hist,US_HISTACQUIRE,lock->arenaoff,waitns);
+
 
+return ret? -1 : 0;
+}
 
-return 0;
+/* --------------------------------------------------------------------- */
+/* ussetlocks: this function sets all of the given locks, or none {{{2
+ *   Locks of the same (semaphore) arena are taken with a single atomic
+ *   semop(), so the process never holds just some of them.  Otherwise
+ *   (US_LOCKPI locks, locks from several arenas, or more locks than one
+ *   semop() may handle) the locks are set one at a time in a canonical
+ *   order, so that callers can't deadlock with each other.  Duplicate
+ *   locks are set once.
+ *   Returns 0 on success, -1 on failure (and then no lock is held).
+ */
+int ussetlocks(
+  ulock_t  locks[],
+  unsigned n)
+{
+int           eagaincnt = 0;
+int           ret       = 0;
+unsigned      i;
+unsigned      qty;
+ulock_t       stklocks[SEMOPM/2];
+ulock_t      *sorted;
+struct sembuf sops[SEMOPM];
+
+
+/* sanity checks */
+if(!locks) {
+    return -1;
+    }
+if(n == 0) {
+    return 0;
+    }
+for(i= 0; i < n; ++i) if(!locks[i]) return -1;
+
+/* sort into canonical order, dropping duplicates */
+sorted= (n <= SEMOPM/2)? stklocks : (ulock_t *) malloc(n*sizeof(ulock_t));
+if(!sorted) {
+    return -1;
+    }
+memcpy(sorted,locks,n*sizeof(ulock_t));
+qsort(sorted,n,sizeof(ulock_t),lockcmp);
+for(i= qty= 1; i < n; ++i) if(lockcmp(&sorted[i],&sorted[qty-1])) sorted[qty++]= sorted[i];
+
+/* all semaphores of one arena: one atomic semop() */
+if(sorted[qty-1]->locktype == US_LOCKSEM && sorted[0]->semid == sorted[qty-1]->semid && 2*qty <= SEMOPM) {
+    for(i= 0; i < qty; ++i) {
+        sops[2*i  ].sem_num= sops[2*i+1].sem_num= sorted[i]->lock;
+        sops[2*i  ].sem_flg= sops[2*i+1].sem_flg= SEM_UNDO;
+        sops[2*i  ].sem_op = 0;
+        sops[2*i+1].sem_op = 1;
+        }
+    do { /* ignore interrupts */
+        errno = 0;
+        ret   = semop(sorted[0]->semid,sops,2*qty);
+        if(errno == EAGAIN && ++eagaincnt > EAGAINMAX) break;
+        } while(ret == -1 && (errno == EINTR || errno == EAGAIN));
+    ret= ret? -1 : 0;
+    if(ret == 0) for(i= 0; i < qty; ++i) uslockevent(uslockhist(sorted[i]),US_HISTACQUIRE,sorted[i]->arenaoff,0UL);
+    }
+else { /* one at a time, in canonical order */
+    for(i= 0; i < qty; ++i) if(ussetlock(sorted[i])) break;
+    if(i < qty) {
+        while(i-- > 0) usunsetlock(sorted[i]);
+        ret= -1;
+        }
+    }
+
+if(sorted != stklocks) free(sorted);
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* usunsetlocks: this function releases all of the given locks {{{2
+ *   Returns 0 on success, -1 if any lock couldn't be released.
+ */
+int usunsetlocks(
+  ulock_t  locks[],
+  unsigned n)
+{
+int      ret= 0;
+unsigned i;
+unsigned j;
+
+
+if(!locks) {
+    return -1;
+    }
+for(i= n; i-- > 0; ) {
+    for(j= i+1; j < n; ++j) if(locks[j] == locks[i]) break; /* release duplicates once */
+    if(j < n) continue;
+    if(usunsetlock(locks[i])) ret= -1;
+    }
+
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* usasetlock: this function attempts to set a lock without blocking {{{2
+ *   Returns:  1=lock acquired
+ *             0=lock not acquired; the process has been registered as a waiter,
+ *               and uslockfd() will become readable once the lock is released.
+ *               Then do a uslockdrain() and try usasetlock() again.
+ *            -1=failure (errno=EBUSY: too many waiters to be notified)
+ */
+int usasetlock(ulock_t lock)
+{
+int ret;
+int full;
+
+
+/* sanity checks */
+if(!lock) {
+    return -1;
+    }
+if(uslockfd() < 0) {
+    return -1;
+    }
+
+/* register first, then try: a release between the two can't be missed */
+full= uswaitadd(&lock->waiters);
+ret = uscsetlock(lock,1);
+if(ret == 1) uswaitdel(&lock->waiters);
+else if(full) {
+    errno= EBUSY;
+    ret  = -1;
+    }
+
+return ret;
 }
 
 /* --------------------------------------------------------------------- */
@@ -165,15 +413,22 @@ int uscsetlock(
   ulock_t  lock, 
   unsigned spins) /* spins=0: blocks until lock acquired  =1: no blocking */
 {
-int           eagaincnt= 0;
 int           ret;
-struct sembuf sops;
+struct sembuf sops[2];
 
 
 /* sanity checks */
 if(!lock) {
     return -1;
     }
+if(spins == 0) { /* block until the lock is acquired */
+    return ussetlock(lock)? 0 : 1;
+    }
+if(lock->locktype == US_LOCKPI) {
+    ret= uspimutexlock(&lock->mutex,1);
+    if(ret == 0) uslockevent(uslockhist(lock),US_HISTACQUIRE,lock->arenaoff,0UL);
+    return ret? 0 : 1;
+    }
 if(lock->semid < 0) {
     return -1;
     }
@@ -181,22 +436,17 @@ if(lock->lock < 0 || lock->maxusers < lock->lock) {
     return -1;
     }
 
-sops.sem_num = lock->lock; /* select semaphore by number       */
-sops.sem_op  = 0;          /* test if semaphore may go to zero */
-if(spins > 0) {
-    sops.sem_flg = SEM_UNDO|IPC_NOWAIT;
-    ret          = semop(lock->semid,&sops,(unsigned)1);
-    }
+sops[0].sem_num = lock->lock; /* select semaphore by number       */
+sops[0].sem_op  = 0;          /* test if semaphore may go to zero */
+sops[1].sem_num = lock->lock;
+sops[1].sem_op  = 1;          /* and if so, take it               */
+sops[0].sem_flg = sops[1].sem_flg = SEM_UNDO|IPC_NOWAIT;
+ret             = semop(lock->semid,sops,(unsigned)2);
+if(ret < 0) ret= 0;
 else {
-    errno= 0;
-    do { /* block until semaphore reaches zero.  Ignore interrupts. */
-        sops.sem_flg = SEM_UNDO;
-        ret          = semop(lock->semid,&sops,(unsigned)1);
-        if(errno == EAGAIN && ++eagaincnt > EAGAINMAX) break;
-        } while(ret == -1 && (errno == EINTR || errno == EAGAIN));
+    ret= 1;
+    uslockevent(uslockhist(lock),US_HISTACQUIRE,lock->arenaoff,0UL);
     }
-if(ret < 0 && errno == EAGAIN) ret= 0;
-else                           ret= 1;
 
 return ret;
 }
@@ -214,7 +464,12 @@ return ret;
 }
 
 /* --------------------------------------------------------------------- */
-/* ustestlock: this function returns the instantaneous value of a lock {{{2 */
+/* ustestlock: this function returns the instantaneous value of a lock {{{2
+ *   A US_LOCKPI lock is tested by trying it: if it can be had, it's
+ *   released at once (so another process' uscsetlock() may, for that
+ *   moment, find it busy).  A lock whose owner died is made consistent
+ *   by the try, and reported free.
+ */
 int ustestlock(ulock_t lock)
 {
 int ret;
@@ -224,6 +479,13 @@ int ret;
 if(!lock) {
     return -1;
     }
+if(lock->locktype == US_LOCKPI) {
+    ret= uspimutexlock(&lock->mutex,1);
+    if(ret == EBUSY) return 1;
+    if(ret)          return -1;
+    pthread_mutex_unlock(&lock->mutex);
+    return 0;
+    }
 if(lock->lock < 0 || lock->maxusers < lock->lock) {
     return -1;
     }
@@ -234,7 +496,9 @@ return ret;
 }
 
 /* --------------------------------------------------------------------- */
-/* usunsetlock: this function releases a lock (ie. sets it to zero) {{{2 */
+/* usunsetlock: this function releases a lock (ie. sets it to zero) {{{2
+ *   A US_LOCKPI lock may only be released by the process that holds it.
+ */
 int usunsetlock(ulock_t lock)
 {
 int ret= -1;
@@ -252,6 +516,12 @@ union semun {
 if(!lock) {
     return -1;
     }
+uslockevent(uslockhist(lock),US_HISTRELEASE,lock->arenaoff,0UL);
+if(lock->locktype == US_LOCKPI) {
+    ret= pthread_mutex_unlock(&lock->mutex)? -1 : 0;
+    uswake(&lock->waiters);
+    return ret;
+    }
 if(lock->lock < 0 || lock->maxusers < lock->lock) {
     return -1;
     }
@@ -261,11 +531,168 @@ if(lock->lock < 0 || lock->maxusers < lock->lock) {
  */
 semun.val = 0;
 ret       = semctl(lock->semid,lock->lock,SETVAL,semun);
+uswake(&lock->waiters);
 
 
 return ret;
 }
 
+/* --------------------------------------------------------------------- */
+/* uslockfd: this function returns a file descriptor that becomes readable {{{2
+ * when a lock this process is waiting on (see usasetlock() and
+ * usarenaasynclock()) gets released.  It may be handed to poll(),
+ * select(), epoll, etc.  It is an abstract unix datagram socket
+ * named after the process id, so any process can notify it.
+ *   Returns: the file descriptor, or -1 on failure
+ */
+int uslockfd(void)
+{
+pid_t              pid;
+socklen_t          len;
+struct sockaddr_un addr;
+
+
+pid= getpid();
+if(lockfd >= 0 && lockfdpid == pid) return lockfd;
+
+/* a forked child inherits its parent's socket, which is bound to the parent's pid */
+if(lockfd >= 0) close(lockfd);
+lockfd= socket(AF_UNIX,SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0);
+if(lockfd < 0) {
+    return -1;
+    }
+len= lockfdaddr(&addr,pid);
+if(bind(lockfd,(struct sockaddr *) &addr,len) < 0) {
+    close(lockfd);
+    lockfd= -1;
+    return -1;
+    }
+lockfdpid= pid;
+
+return lockfd;
+}
+
+/* --------------------------------------------------------------------- */
+/* uslockdrain: this function consumes all pending release notifications {{{2
+ *   Returns: qty of notifications consumed
+ */
+int uslockdrain(void)
+{
+int  qty= 0;
+char buf[16];
+
+
+if(lockfd < 0 || lockfdpid != getpid()) return 0;
+while(recv(lockfd,buf,sizeof(buf),MSG_DONTWAIT) >= 0) ++qty;
+
+return qty;
+}
+
+/* --------------------------------------------------------------------- */
+/* uswaitadd: this function registers the process as a waiter {{{2
+ *   Returns: 0=registered  1=no room (the waiter table is full)
+ */
+int uswaitadd(USWaiters *waiters)
+{
+int   i;
+pid_t pid;
+
+
+pid= getpid();
+for(i= 0; i < USMAXWAITERS; ++i) if(waiters->pid[i] == pid) return 0;
+for(i= 0; i < USMAXWAITERS; ++i) {
+    if(waiters->pid[i] == 0 && __sync_bool_compare_and_swap(&waiters->pid[i],0,pid)) {
+        __sync_fetch_and_add(&waiters->qty,1); /* full barrier before the caller's try-lock */
+        return 0;
+        }
+    }
+
+return 1;
+}
+
+/* --------------------------------------------------------------------- */
+/* uswaitdel: this function removes the process from the waiters {{{2 */
+void uswaitdel(USWaiters *waiters)
+{
+int   i;
+pid_t pid;
+
+
+pid= getpid();
+for(i= 0; i < USMAXWAITERS; ++i) {
+    if(waiters->pid[i] == pid && __sync_bool_compare_and_swap(&waiters->pid[i],pid,0)) {
+        __sync_fetch_and_sub(&waiters->qty,1);
+        }
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* uswake: this function notifies (and deregisters) all waiters {{{2
+ *   Called after a lock has been released.  Costs one load when nobody waits.
+ */
+void uswake(USWaiters *waiters)
+{
+int                i;
+pid_t              pid;
+socklen_t          len;
+struct sockaddr_un addr;
+
+
+__sync_synchronize(); /* order the release before the waiter check */
+if(!waiters->qty) return;
+
+if(wakefd < 0) wakefd= socket(AF_UNIX,SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0);
+for(i= 0; i < USMAXWAITERS; ++i) {
+    pid= waiters->pid[i];
+    if(pid && __sync_bool_compare_and_swap(&waiters->pid[i],pid,0)) {
+        __sync_fetch_and_sub(&waiters->qty,1);
+        if(wakefd >= 0) { /* a waiter that has gone away just won't get it */
+            len= lockfdaddr(&addr,pid);
+            (void) sendto(wakefd,"",1,MSG_DONTWAIT,(struct sockaddr *) &addr,len);
+            }
+        }
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* lockcmp: this function orders locks for ussetlocks() {{{2
+ *   by lock type, then semaphore set and number (US_LOCKSEM), then address
+ */
+static int lockcmp(
+  const void *l1,
+  const void *l2)
+{
+ulock_t lock1= *((ulock_t *) l1);
+ulock_t lock2= *((ulock_t *) l2);
+
+
+if(lock1->locktype != lock2->locktype) return (lock1->locktype < lock2->locktype)? -1 : 1;
+if(lock1->locktype == US_LOCKSEM) {
+    if(lock1->semid != lock2->semid) return (lock1->semid < lock2->semid)? -1 : 1;
+    if(lock1->lock  != lock2->lock)  return (lock1->lock  < lock2->lock)?  -1 : 1;
+    return 0;
+    }
+if(lock1 != lock2) return (lock1 < lock2)? -1 : 1;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* lockfdaddr: this function sets up the abstract socket address for a pid {{{2 */
+static socklen_t lockfdaddr(
+  struct sockaddr_un *addr,
+  pid_t               pid)
+{
+int len;
+
+
+memset(addr,0,sizeof(struct sockaddr_un));
+addr->sun_family= AF_UNIX;
+len             = snprintf(addr->sun_path+1,sizeof(addr->sun_path)-1,"usarena.lockfd.%ld",(long) pid);
+
+return (socklen_t) (offsetof(struct sockaddr_un,sun_path) + 1 + len);
+}
+
 /* =====================================================================
  * Modelines: {{{1
  * vim: sw=4 sts=4 et fdm=marker ts=4
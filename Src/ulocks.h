@@ -9,6 +9,7 @@
 # endif
 # include <sys/sem.h>
 # include <errno.h>
+# include <pthread.h>
 
 /* ---------------------------------------------------------------------
  * Enumerations: {{{1
@@ -31,17 +32,30 @@ typedef unsigned short     ushort;
  * Structures: {{{1
  */
 struct USLock_str {
-	unsigned lock;
-	unsigned semid;
-	unsigned maxusers;
+	unsigned        lock;     /* semaphore number (US_LOCKSEM)              */
+	unsigned        semid;
+	unsigned        maxusers;
+	int             locktype; /* US_LOCKSEM or US_LOCKPI                    */
+	pthread_mutex_t mutex;    /* priority-inheritance mutex (US_LOCKPI)     */
+	USWaiters       waiters;  /* usasetlock() processes awaiting release    */
+	usoffset        arenaoff; /* offset of this lock from the arena start   */
 	};
 
+/* ---------------------------------------------------------------------
+ * Definitions: {{{1
+ */
+/* uslockhist: the history ring control of the arena holding the lock */
+# define uslockhist(lock)  ((USHistCtl *) (((usbase *) (lock)) - (lock)->arenaoff + offsetof(USArenaShare,hist)))
+
 /* ---------------------------------------------------------------------
  * Prototypes: {{{1
  */
 ulock_t usnewlock(usptr_t *);         /* ulocks.c */
 void usfreelock( ulock_t, usptr_t *); /* ulocks.c */
 int ussetlock(ulock_t);               /* ulocks.c */
+int usasetlock(ulock_t);              /* ulocks.c */
+int ussetlocks(ulock_t *,unsigned);   /* ulocks.c */
+int usunsetlocks(ulock_t *,unsigned); /* ulocks.c */
 int uscsetlock( ulock_t, unsigned);   /* ulocks.c */
 int uswsetlock(ulock_t,unsigned);     /* ulocks.c */
 int ustestlock(ulock_t);              /* ulocks.c */
@@ -15,6 +15,7 @@
  */
 #define USINTERNAL
 #include "arena.h"
+#include "usprobe.h"
 
 /* ---------------------------------------------------------------------
  * Definitions: {{{2
@@ -39,6 +40,7 @@
  * Data: {{{2
  */
 USArena *usarena= NULL;
+static __thread unsigned lockheld= 0; /* bitmask of USLK_* locks held by this thread */
 
 /* ------------------------------------------------------------------------
  * Prototypes: {{{2
@@ -68,6 +70,8 @@ if(!usarena) { /* initialize and allocate default usarena configuration */
     usarena->permission = S_IRUSR|S_IWUSR|S_IXUSR; /* by default, only the user will have read+write+exe permission */
     usarena->mempool    = NULL;
     usarena->memattach  = NULL;
+    usarena->checklevel = US_CHECKCHEAP;
+    usarena->minalign   = USMINALIGN;
     }
 
 /* sanity check */
@@ -107,7 +111,12 @@ case CONF_GETUSERS:     /* CONF_GETUSERS                -- returns qty users
     ret= (ptrdiff_t) usarena->maxusers;
     break;
 
-case CONF_LOCKTYPE:     /* CONF_LOCKTYPE,locktype       --                                    -- not supported */
+case CONF_LOCKTYPE:     /* CONF_LOCKTYPE,locktype       -- US_LOCKSEM (default) or US_LOCKPI  --               */
+    ret= usarena->locktype;
+    va_start(args,cmd);
+    usarena->locktype= va_arg(args,int);
+    va_end(args);
+    if(usarena->locktype != US_LOCKPI) usarena->locktype= US_LOCKSEM;
     break;
 
 case CONF_ARENATYPE:    /* CONF_ARENATYPE,US_SHAREDONLY -- no memory map file                 --               */
@@ -133,19 +142,213 @@ case CONF_AUTOGROW:     /* CONF_AUTOGROW,int            --
 case CONF_AUTORESV:     /* CONF_AUTORESV,int            --                                    -- not supported */
     break;
 
-case CONF_HISTON:       /* CONF_HISTON,usptr_t*         -- enables semaphore history logging  -- not supported */
+case CONF_HISTON:       /* CONF_HISTON,usptr_t*         -- enables semaphore history logging  --               */
+    va_start(args,cmd);
+    ret= ushiston(va_arg(args,usptr_t *));
+    va_end(args);
     break;
 
-case CONF_HISTOFF:      /* CONF_HISTOFF,usptr_t*        -- disables semaphore history logging -- not supported */
+case CONF_HISTOFF:      /* CONF_HISTOFF,usptr_t*        -- disables semaphore history logging --               */
+    va_start(args,cmd);
+    ret= ushistoff(va_arg(args,usptr_t *));
+    va_end(args);
     break;
 
-case CONF_HISTSIZE:     /* CONF_HISTSIZE,int            -- maxqty of history records          -- not supported */
+case CONF_HISTSIZE:     /* CONF_HISTSIZE,int            -- maxqty of history records          --               */
+    ret= usarena->histsize? usarena->histsize : USHISTSIZE;
+    va_start(args,cmd);
+    usarena->histsize= va_arg(args,int);
+    va_end(args);
     break;
 
-case CONF_HISTFETCH:    /* CONF_HISTFETCH,usptr_t*      --                                    -- not supported */
+case CONF_HISTFETCH:    /* CONF_HISTFETCH,usptr_t*,ushist_t* -- snapshot of history records   --               */
+    {
+    usptr_t *histarena;
+    va_start(args,cmd);
+    histarena= va_arg(args,usptr_t *);
+    ret      = ushistfetch(histarena,va_arg(args,ushist_t *));
+    va_end(args);
+    }
     break;
 
-case CONF_HISTRESET:    /* CONF_HISTRESET,usptr_t*      --                                    -- not supported */
+case CONF_HISTRESET:    /* CONF_HISTRESET,usptr_t*      -- discards history records           --               */
+    va_start(args,cmd);
+    ret= ushistreset(va_arg(args,usptr_t *));
+    va_end(args);
+    break;
+
+case CONF_LATON:        /* CONF_LATON,usptr_t*          -- enables latency histograms         --               */
+    va_start(args,cmd);
+    ret= uslaton(va_arg(args,usptr_t *));
+    va_end(args);
+    break;
+
+case CONF_LATOFF:       /* CONF_LATOFF,usptr_t*         -- disables latency histograms        --               */
+    va_start(args,cmd);
+    ret= uslatoff(va_arg(args,usptr_t *));
+    va_end(args);
+    break;
+
+case CONF_LATFETCH:     /* CONF_LATFETCH,usptr_t*,uslat_t* -- merged latency histograms      --               */
+    {
+    usptr_t *latarena;
+    va_start(args,cmd);
+    latarena= va_arg(args,usptr_t *);
+    ret     = uslatfetch(latarena,va_arg(args,uslat_t *));
+    va_end(args);
+    }
+    break;
+
+case CONF_CHECKLEVEL:   /* CONF_CHECKLEVEL,level        -- integrity checks of a new arena    --               */
+    ret= usarena->checklevel;
+    va_start(args,cmd);
+    usarena->checklevel= va_arg(args,int);
+    va_end(args);
+    if(usarena->checklevel < US_CHECKOFF) usarena->checklevel= US_CHECKOFF;
+    if(usarena->checklevel > USCHECK)     usarena->checklevel= USCHECK;
+    break;
+
+case CONF_CHECKSET:     /* CONF_CHECKSET,usptr_t*,level -- integrity checks of an arena       --               */
+    {
+    int      level;
+    usptr_t *checkarena;
+    va_start(args,cmd);
+    checkarena= va_arg(args,usptr_t *);
+    level     = va_arg(args,int);
+    va_end(args);
+    if(checkarena && checkarena->check) {
+        if(level < US_CHECKOFF) level= US_CHECKOFF;
+        if(level > USCHECK)     level= USCHECK;
+        ret                = *checkarena->check;
+        *checkarena->check = level; /* for every process using the arena */
+        }
+    }
+    break;
+
+case CONF_CORRUPTFN:    /* CONF_CORRUPTFN,uscorrupt_t   -- this process' corruption handler   --               */
+    va_start(args,cmd);
+    ret= (ptrdiff_t) uscorruptfn(va_arg(args,uscorrupt_t));
+    va_end(args);
+    break;
+
+case CONF_PROFON:       /* CONF_PROFON,usptr_t*,rate    -- enables the heap profiler          --               */
+    {
+    usptr_t *profarena;
+    va_start(args,cmd);
+    profarena= va_arg(args,usptr_t *);
+    ret      = usprofon(profarena,va_arg(args,unsigned long));
+    va_end(args);
+    }
+    break;
+
+case CONF_PROFOFF:      /* CONF_PROFOFF,usptr_t*        -- disables the heap profiler         --               */
+    va_start(args,cmd);
+    ret= usprofoff(va_arg(args,usptr_t *));
+    va_end(args);
+    break;
+
+case CONF_PROFSIZE:     /* CONF_PROFSIZE,int            -- maxqty of live heap samples        --               */
+    ret= usarena->profsize? usarena->profsize : USPROFSIZE;
+    va_start(args,cmd);
+    usarena->profsize= va_arg(args,int);
+    va_end(args);
+    break;
+
+case CONF_PROFDUMP:     /* CONF_PROFDUMP,usptr_t*,file,merged -- writes a pprof heap profile  --               */
+    {
+    usptr_t    *profarena;
+    const char *proffile;
+    va_start(args,cmd);
+    profarena= va_arg(args,usptr_t *);
+    proffile = va_arg(args,const char *);
+    ret      = usprofdump(profarena,proffile,va_arg(args,int));
+    va_end(args);
+    }
+    break;
+
+case CONF_TRACEON:      /* CONF_TRACEON,usptr_t*,file   -- records this process' allocations  --               */
+    {
+    usptr_t *tracearena;
+    va_start(args,cmd);
+    tracearena= va_arg(args,usptr_t *);
+    ret       = ustraceon(tracearena,va_arg(args,const char *));
+    va_end(args);
+    }
+    break;
+
+case CONF_TRACEOFF:     /* CONF_TRACEOFF                -- stops recording, writes the rest   --               */
+    ret= ustraceoff();
+    break;
+
+case CONF_TRACEFLUSH:   /* CONF_TRACEFLUSH              -- writes the recorded allocations    --               */
+    ret= ustraceflush();
+    break;
+
+case CONF_MINALIGN:     /* CONF_MINALIGN,align          -- usmalloc() alignment of new arenas --               */
+    ret= usarena->minalign? usarena->minalign : USMINALIGN;
+    va_start(args,cmd);
+    usarena->minalign= va_arg(args,int);
+    va_end(args);
+    if(usarena->minalign != 8 && usarena->minalign != 16) { /* chunk sizes are kept in multiples of it */
+        usarena->minalign= (unsigned) ret;
+        errno            = EINVAL;
+        ret              = -1;
+        }
+    break;
+
+case CONF_TRIMSIZE:     /* CONF_TRIMSIZE,usptr_t*,bytes -- free bytes kept resident per chunk --               */
+    {
+    size_t   trimsize;
+    usptr_t *trimarena;
+    va_start(args,cmd);
+    trimarena= va_arg(args,usptr_t *);
+    trimsize = va_arg(args,size_t);
+    va_end(args);
+    if(trimarena && trimarena->trim) {
+        ret              = (ptrdiff_t) *trimarena->trim;
+        *trimarena->trim = trimsize; /* for every process using the arena */
+        }
+    }
+    break;
+
+case CONF_FASTMAX:      /* CONF_FASTMAX,usptr_t*,bytes  -- largest request freed to fastbins  --               */
+    {
+    size_t   fastmax;
+    usptr_t *fastarena;
+    va_start(args,cmd);
+    fastarena= va_arg(args,usptr_t *);
+    fastmax  = va_arg(args,size_t);
+    va_end(args);
+    if(!fastarena || !fastarena->fast || fastmax > 8*USMAXFASTBIN - sizeof(usoffset)) { /* fastbins hold one-size chunks */
+        errno= EINVAL;
+        ret  = -1;
+        }
+    else {
+        ret                  = (ptrdiff_t) fastarena->fast->max;
+        fastarena->fast->max = fastmax; /* chunks already parked stay until consolidated */
+        }
+    }
+    break;
+
+case CONF_REMOTEFREE:   /* CONF_REMOTEFREE,usptr_t*,on  -- usfree() queues chunks, lock-free  --               */
+    {
+    int      on;
+    usptr_t *remotearena;
+    va_start(args,cmd);
+    remotearena= va_arg(args,usptr_t *);
+    on         = va_arg(args,int);
+    va_end(args);
+    if(remotearena && remotearena->remote) {
+        ret                     = remotearena->remote->on;
+        remotearena->remote->on = on? 1 : 0; /* chunks already queued are freed by the next lock holder */
+        }
+    }
+    break;
+
+case CONF_LATRESET:     /* CONF_LATRESET,usptr_t*       -- zeroes latency histograms          --               */
+    va_start(args,cmd);
+    ret= uslatreset(va_arg(args,usptr_t *));
+    va_end(args);
     break;
 
 case CONF_STHREADIOOFF: /* CONF_STHREADIOOFF            --                                    -- not supported */
@@ -186,6 +389,8 @@ if(!filename) {
 
 if(!usarena) { /* assume we're attempting to join a pre-existing arena */
     usarena= (USArena *) calloc((size_t) 1,sizeof(USArena));
+    usarena->checklevel= US_CHECKCHEAP;
+    usarena->minalign  = USMINALIGN;
     stralloc(usarena->filename,filename,"usinit arena filename");
     }
 
@@ -251,9 +456,9 @@ if(stat(usarena->filename,&filestat)) { /* usarena file does not exist. Create a
 
     /* semaphores: allocate and initialize
      *  I wish the name was "maxlocks" rather than "maxusers", but its there for
-     *  compatibility.  There will be maxusers+1 locks (semaphores) allocated
-     *  and initialized; the last one will be used by the usmalloc-uscalloc-usfree
-     *  routines.
+     *  compatibility.  There will be maxusers+USLK_QTY locks (semaphores) allocated
+     *  and initialized; the last USLK_QTY will be used by the usmalloc-uscalloc-usfree
+     *  routines (one for the multi-size bins, one for the one-size bins).
      */
     if(usarena->maxusers >= 0) {
         union semun {
@@ -267,20 +472,20 @@ if(stat(usarena->filename,&filestat)) { /* usarena file does not exist. Create a
         int iarray;
 
         /* attempt to create a new semaphore set */
-        usarena->semid= semget(usarena->key,usarena->maxusers+1,IPC_CREAT|IPC_EXCL|usarena->permission);
+        usarena->semid= semget(usarena->key,usarena->maxusers+USLK_QTY,IPC_CREAT|IPC_EXCL|usarena->permission);
         if(usarena->semid == -1) {
             /* semaphore set associated with key already exists, but the file didn't.
              * So, remove the semaphore set and then get a new one.  Creates a semaphore
              * set with "maxusers" semaphores.
              */
             perror("(usinit warning) semget() error!");
-            usarena->semid= semget(usarena->key,usarena->maxusers+1,IPC_CREAT|usarena->permission);
+            usarena->semid= semget(usarena->key,usarena->maxusers+USLK_QTY,IPC_CREAT|usarena->permission);
             if(usarena->semid == -1) {
                 userror(usarena,fd,4);
                 return NULL;
                 }
             if(semctl(usarena->semid,0,IPC_RMID,0) != -1) {
-                usarena->semid= semget(usarena->key,usarena->maxusers+1,IPC_CREAT|IPC_EXCL|usarena->permission);
+                usarena->semid= semget(usarena->key,usarena->maxusers+USLK_QTY,IPC_CREAT|IPC_EXCL|usarena->permission);
                 }
             if(usarena->semid == -1) {
                 userror(usarena,fd,4);
@@ -288,14 +493,14 @@ if(stat(usarena->filename,&filestat)) { /* usarena file does not exist. Create a
                 }
             }
 
-        /* set all semaphores to US_SEMUNUSED except for the last one */
-        semset.array= (ushort *) calloc((size_t) usarena->maxusers+1,sizeof(ushort));
+        /* set all semaphores to US_SEMUNUSED except for the last USLK_QTY ones */
+        semset.array= (ushort *) calloc((size_t) usarena->maxusers+USLK_QTY,sizeof(ushort));
         if(!semset.array) {
             userror(usarena,fd,5);
             return NULL;
             }
         for(iarray= 0; iarray < usarena->maxusers; ++iarray) semset.array[iarray]= US_SEMUNUSED;
-        semset.array[usarena->maxusers]= 0;
+        for(; iarray < (int) usarena->maxusers+USLK_QTY; ++iarray) semset.array[iarray]= 0;
 
         if(semctl(usarena->semid,0,SETALL,semset) == -1) {
             free(semset.array);
@@ -322,37 +527,78 @@ if(stat(usarena->filename,&filestat)) { /* usarena file does not exist. Create a
      *  First 8 bytes reserved to allow a chunk#0 to be "illegal"
      *  usarena begins with an ArenaShare, so the free-bin table has offset for key,memsize,maxusers
      */
-    memsize       = (sizeof(USArenaShare) + 7)&(~0x3);
-    usarena->bin  = (USFreeBin *) (usarena->mempool + arena_bin_offset);
-    usarena->base = usarena->mempool + memsize; /* beginning of allocatable memory */
-    usarena->info = 0;
+    memsize       = (sizeof(USArenaShare) + 7)&(~0x7);
+    usarena->bin     = (USFreeBin *) (usarena->mempool + arena_bin_offset);
+    usarena->lock    = (USLockLine *) (usarena->mempool + arena_lock_offset);
+    usarena->waiters = (USWaiters *) (usarena->mempool + arena_waiters_offset);
+    usarena->hist    = (USHistCtl *) (usarena->mempool + arena_hist_offset);
+    usarena->stats   = (USStats *) (usarena->mempool + arena_stats_offset);
+    usarena->lat     = (USLatCtl *) (usarena->mempool + arena_lat_offset);
+    usarena->tags    = (USTags *) (usarena->mempool + arena_tags_offset);
+    usarena->verify  = (USVerifyCtl *) (usarena->mempool + arena_verify_offset);
+    usarena->top     = (USTopCtl *) (usarena->mempool + arena_top_offset);
+    usarena->fast    = (USFastCtl *) (usarena->mempool + arena_fast_offset);
+    usarena->remote  = (USRemoteCtl *) (usarena->mempool + arena_remote_offset);
+    usarena->prof    = (USProfCtl *) (usarena->mempool + arena_prof_offset);
+    usarena->check   = (int *) (usarena->mempool + arena_check_offset);
+    usarena->trim    = (size_t *) (usarena->mempool + arena_trim_offset);
+    usarena->binqty  = (unsigned long *) (usarena->mempool + arena_binqty_offset);
+    usarena->binmap  = (unsigned long *) (usarena->mempool + arena_binmap_offset);
+    usarena->base    = usarena->mempool + memsize; /* beginning of allocatable memory */
+    usarena->info    = 0;
 
     /* initialize usarena USFreeBins  - first 8 bytes are wasted so ichunk=0 can be used as
-     * not-a-chunk.  Done by marking those 8 bytes as "inuse".
+     * not-a-chunk.  Done by marking those 8 bytes as "inuse".  The rest is the
+     * top chunk, which is kept out of the bins; the bins start out empty.
      */
     for(ibin= 0; ibin < USMAXFREEBIN; ++ibin) usarena->bin[ibin].hd= usarena->bin[ibin].tl= 0;
     zero                  = 0;
-    memsize               = usarena->memsize - memsize - (usoffset) 8;
-    ibin                  = ushashsize(memsize);
+    usarena->align        = (usarena->minalign == 16)? 16 : USMINALIGN;
+    memsize               = (usarena->memsize - memsize - (usoffset) 8)&~((usoffset) usarena->align - 1);
     ichunk                = 8;
-    usarena->bin[ibin].hd = usarena->bin[ibin].tl= ichunk;
     setnxtchunk(ichunk,zero);
     setprvchunk(ichunk,zero);
-    setsize(ichunk,memsize);
-    setfree(ichunk);
     usarena->memsize= memsize + (usoffset) 8;
+    initsize(ichunk,memsize);
+    setfree(ichunk);
 
     /* initialize USArenaShare */
+    memset(&arenashare,0,sizeof(USArenaShare));
     arenashare.memattach= usarena->mempool;
+    arenashare.magic    = USSHAREMAGIC;
+    arenashare.version  = USSHAREVERSION;
+    arenashare.sharesize= (unsigned) sizeof(USArenaShare);
+    arenashare.nbin     = USMAXFREEBIN;
     arenashare.key      = usarena->key;
     arenashare.memsize  = usarena->memsize;
     arenashare.maxusers = usarena->maxusers;
     arenashare.info     = 0;
+    arenashare.locktype = usarena->locktype;
+    arenashare.check    = usarena->checklevel;
+    arenashare.align    = usarena->align;
+    arenashare.trim     = USTRIMSIZE;
+    arenashare.fast.max = USFASTMAX;
     memcpy(arenashare.bin,usarena->bin,USMAXFREEBIN*sizeof(USFreeBin));
+    arenashare.top.chunk             = ichunk;
+    arenashare.top.commit            = ichunk; /* committed as it's carved (see TopChunk()) */
+    arenashare.top.zero              = ichunk + (usoffset) 8; /* a new file reads zero past the header */
+    arenashare.stats[USLK_BIG].inuse = 8; /* the reserved chunk#0 bytes */
+    arenashare.stats[USLK_BIG].peak  = 8;
+    arenashare.tags.qty              = US_TAGLOCK + 1;
+    strcpy(arenashare.tags.name[US_TAGLOCK],"lock");
+    arenashare.verify.cursor         = 8;
 
     /* copy USArenaShare to beginning of mmap'd memory pool */
     memcpy(usarena->mempool,&arenashare,sizeof(USArenaShare));
 
+    /* US_LOCKPI: the arena locks are mutexes that live in the shared USArenaShare,
+     * so they must be initialized in place
+     */
+    if(usarena->locktype == US_LOCKPI && usarenalockinit(usarena)) {
+        userror(usarena,fd,5);
+        return NULL;
+        }
+
     /* unlock the advisory lock */
     flock(fd,LOCK_UN);
     }
@@ -392,6 +638,8 @@ else if(progress < 0) {
 
 /* --------------------------------------------------------------------- */
 /* usadd: this function allows processes to "add" themselves as users of an usarena {{{2
+ *   The arena must have been made with this library's USArenaShare layout
+ *   (USSHAREVERSION); usadd() won't join any other.
  *   Returns: -1 failure
  *             0 success
  */
@@ -440,15 +688,43 @@ if(usarena->mempool == MAP_FAILED) {
     return -1;
     }
 
-/* copy bytes into USArenaShare and initialize usarena */
-memcpy(&arenashare,usarena->mempool,sizeof(USArenaShare));
+/* copy bytes into USArenaShare and initialize usarena, once its layout is known to be this library's */
+if(size >= sizeof(USArenaShare)) memcpy(&arenashare,usarena->mempool,sizeof(USArenaShare));
+if(size < sizeof(USArenaShare)                             ||
+   arenashare.magic     != USSHAREMAGIC                    ||
+   arenashare.version   != USSHAREVERSION                  ||
+   arenashare.sharesize != (unsigned) sizeof(USArenaShare) ||
+   arenashare.nbin      != USMAXFREEBIN) {
+    fprintf(stderr,"(usadd) %s: not an arena of layout version %d\n",usarena->filename,USSHAREVERSION);
+    munmap(usarena->mempool,size);
+    errno= EINVAL;
+    userror(usarena,fd,-3);
+    return -1;
+    }
 usarena->key      = arenashare.key;
 usarena->memsize  = arenashare.memsize;
 usarena->maxusers = arenashare.maxusers;
 usarena->info     = arenashare.info;
-memsize           = (sizeof(USArenaShare) + 7)&(~0x3);
+usarena->locktype = arenashare.locktype;
+usarena->align    = arenashare.align;
+memsize           = (sizeof(USArenaShare) + 7)&(~0x7);
 usarena->base     = usarena->mempool + memsize;
 usarena->bin      = (USFreeBin *) (usarena->mempool + arena_bin_offset);
+usarena->lock     = (USLockLine *) (usarena->mempool + arena_lock_offset);
+usarena->waiters  = (USWaiters *) (usarena->mempool + arena_waiters_offset);
+usarena->hist     = (USHistCtl *) (usarena->mempool + arena_hist_offset);
+usarena->stats    = (USStats *) (usarena->mempool + arena_stats_offset);
+usarena->lat      = (USLatCtl *) (usarena->mempool + arena_lat_offset);
+usarena->tags     = (USTags *) (usarena->mempool + arena_tags_offset);
+usarena->verify   = (USVerifyCtl *) (usarena->mempool + arena_verify_offset);
+usarena->top      = (USTopCtl *) (usarena->mempool + arena_top_offset);
+usarena->fast     = (USFastCtl *) (usarena->mempool + arena_fast_offset);
+usarena->remote   = (USRemoteCtl *) (usarena->mempool + arena_remote_offset);
+usarena->prof     = (USProfCtl *) (usarena->mempool + arena_prof_offset);
+usarena->check    = (int *) (usarena->mempool + arena_check_offset);
+usarena->trim     = (size_t *) (usarena->mempool + arena_trim_offset);
+usarena->binqty   = (unsigned long *) (usarena->mempool + arena_binqty_offset);
+usarena->binmap   = (unsigned long *) (usarena->mempool + arena_binmap_offset);
 
 /* semaphores: obtain access - do a semget() */
 if(usarena->maxusers > 0) {
@@ -466,11 +742,13 @@ return 0;
 }
 
 /* --------------------------------------------------------------------- */
-/* usarenalockinit: this function initializes the usarena semaphore {{{2
- * to zero (ie. unlocked but ready for business).
+/* usarenalockinit: this function initializes the usarena semaphores {{{2
+ * to zero (ie. unlocked but ready for business).  With US_LOCKPI, the
+ * arena mutexes are (re-)initialized instead.
  */
 int usarenalockinit(usptr_t *usarena)
 {
+int ilk;
 int ret= -1;
 union semun {
     int val;
@@ -482,58 +760,196 @@ union semun {
     } semun;
 
 
-if(usarena && usarena->semid != -1 && usarena->maxusers >= 0) {
+if(usarena && usarena->locktype == US_LOCKPI) {
+    for(ilk= 0; ilk < USLK_QTY; ++ilk) {
+        ret= uspimutexinit(&usarena->lock[ilk].mutex);
+        if(ret) break;
+        }
+    lockheld= 0;
+    }
+else if(usarena && usarena->semid != -1 && usarena->maxusers >= 0) {
     semun.val = 0;
-    ret       = semctl(usarena->semid,usarena->maxusers,SETVAL,semun);
+    for(ilk= 0; ilk < USLK_QTY; ++ilk) {
+        ret= semctl(usarena->semid,usarena->maxusers+ilk,SETVAL,semun);
+        if(ret < 0) break;
+        }
+    lockheld= 0;
     }
 
 return ret;
 }
 
+/* --------------------------------------------------------------------- */
+/* uslockheld: this function returns this thread's bitmask of held USLK_* locks {{{2
+ *   The mask is kept per thread: the semaphores and mutexes exclude the
+ *   other threads of this process, too, so what one of them holds says
+ *   nothing about another.  (usbinheld() reads it.)
+ */
+unsigned *uslockheld(void)
+{
+return &lockheld;
+}
+
 /* --------------------------------------------------------------------- */
 /* usarenalock: this function locks the USArenaShare portion of the usarena {{{2
+ *   (the info and the multi-size bins).  The one-size bins are guarded
+ *   separately; see usbinlock().
  *   No sanity checks taken to facilitate speed
  */
 int usarenalock(usptr_t *usarena)
 {
-int           eagaincnt = 0;
+return usbinlock(usarena,USLK_BIG);
+}
+
+/* --------------------------------------------------------------------- */
+/* usarenaunlock: this function unlocks the USArenaShare portion of the usarena {{{2 */
+int usarenaunlock(usptr_t *usarena)
+{
+return usbinunlock(usarena,USLK_BIG);
+}
+
+/* --------------------------------------------------------------------- */
+/* usarenaasynclock: this function attempts to lock the arena without blocking {{{2
+ *   Returns:  1=lock acquired
+ *             0=lock not acquired; the process has been registered as a waiter,
+ *               and uslockfd() will become readable once the lock is released.
+ *            -1=failure (errno=EBUSY: too many waiters to be notified)
+ */
+int usarenaasynclock(usptr_t *usarena)
+{
+int           full;
 int           ret;
-struct sembuf sops;
+struct sembuf sops[2];
 
 
-sops.sem_flg= SEM_UNDO;          /* blocking and will leave semaphore available if process dies */
-sops.sem_num= usarena->maxusers; /* select semaphore by number                                  */
-sops.sem_op = 0;                 /* block until semaphore goes to zero                          */
-do {
-    errno = 0;
-    ret   = semop(usarena->semid,&sops,1);
-    if(errno == EAGAIN && ++eagaincnt > EAGAINMAX) break;
-    } while(ret == -1 && (errno == EINTR || errno == EAGAIN));
+if(uslockfd() < 0) {
+    return -1;
+    }
 
+/* register first, then try: a release between the two can't be missed */
+full= uswaitadd(usarena->waiters);
+if(usarena->locktype == US_LOCKPI) {
+    ret= uspimutexlock(&usarena->lock[USLK_BIG].mutex,1)? 0 : 1;
+    }
+else {
+    sops[0].sem_flg= sops[1].sem_flg= SEM_UNDO|IPC_NOWAIT;
+    sops[0].sem_num= sops[1].sem_num= usarena->maxusers + USLK_BIG;
+    sops[0].sem_op = 0;
+    sops[1].sem_op = 1;
+    ret            = (semop(usarena->semid,sops,2) == 0)? 1 : 0;
+    }
+if(ret == 1) {
+    lockheld|= 1<<USLK_BIG;
+    ++usarena->stats[USLK_BIG].nlock;
+    uswaitdel(usarena->waiters);
+    uslockevent(usarena->hist,US_HISTACQUIRE,1+USLK_BIG,0UL);
+    }
+else if(full) {
+    errno= EBUSY;
+    ret  = -1;
+    }
 
 return ret;
 }
 
 /* --------------------------------------------------------------------- */
-/* usarenaunlock: this function unlocks the USArenaShare portion of the usarena {{{2 */
-int usarenaunlock(usptr_t *usarena)
+/* usbinlock: this function locks one of the hidden arena semaphores {{{2
+ *   ilk=USLK_BIG  : multi-size bins and the USArenaShare info
+ *   ilk=USLK_SMALL: one-size bins
+ * When both are needed, USLK_BIG must be acquired first.
+ * With US_LOCKPI, the corresponding arena mutex is used instead.
+ *   No sanity checks taken to facilitate speed
+ */
+int usbinlock(
+  usptr_t *usarena,
+  int      ilk)
 {
-int ret;
-union semun {
-    int              val;
-    struct semid_ds *buf;
-    ushort          *array;
-#ifdef __gnu_linux__
-    struct seminfo  *__buf;
+int           contended = 0;
+int           eagaincnt = 0;
+int           ret;
+unsigned long waitns    = 0;
+struct sembuf sops[2];
+
+
+if(usarena->locktype == US_LOCKPI) {
+    ret= uspimutexlock(&usarena->lock[ilk].mutex,1);
+    if(ret == EBUSY) { /* contended */
+        contended= 1;
+        uslockevent(usarena->hist,US_HISTWAIT,1+ilk,0UL);
+        if(usarena->hist->on || usarena->lat->on) waitns= usclock();
+        ret= uspimutexlock(&usarena->lock[ilk].mutex,0);
+        if(waitns) waitns= usclock() - waitns;
+        }
+    if(ret) return -1;
+    lockheld|= 1<<ilk;
+    ++usarena->stats[ilk].nlock;
+    usarena->stats[ilk].ncontend+= contended;
+    uslockevent(usarena->hist,US_HISTACQUIRE,1+ilk,waitns);
+#ifdef USLATENCY
+    if(usarena->lat->on) uslatrec(usarena,US_LATLOCKWAIT,waitns);
 #endif
-    } semun;
+    return 0;
+    }
+
+sops[0].sem_flg= SEM_UNDO|IPC_NOWAIT;     /* first, see if the semaphore is free (no waiting)            */
+sops[0].sem_num= usarena->maxusers + ilk; /* select semaphore by number                                  */
+sops[0].sem_op = 0;                       /* semaphore is zero...                                        */
+sops[1].sem_flg= SEM_UNDO|IPC_NOWAIT;
+sops[1].sem_num= usarena->maxusers + ilk;
+sops[1].sem_op = 1;                       /* ...and then atomically take it                              */
+ret            = semop(usarena->semid,sops,2);
+if(ret == -1 && errno == EAGAIN) {        /* contended: block; leave semaphore available if process dies */
+    contended= 1;
+    uslockevent(usarena->hist,US_HISTWAIT,1+ilk,0UL);
+    if(usarena->hist->on || usarena->lat->on) waitns= usclock();
+    sops[0].sem_flg= sops[1].sem_flg= SEM_UNDO;
+    do {
+        errno = 0;
+        ret   = semop(usarena->semid,sops,2);
+        if(errno == EAGAIN && ++eagaincnt > EAGAINMAX) break;
+        } while(ret == -1 && (errno == EINTR || errno == EAGAIN));
+    if(waitns) waitns= usclock() - waitns;
+    }
+if(ret == 0) {
+    lockheld|= 1<<ilk;
+    ++usarena->stats[ilk].nlock;
+    usarena->stats[ilk].ncontend+= contended;
+    uslockevent(usarena->hist,US_HISTACQUIRE,1+ilk,waitns);
+#ifdef USLATENCY
+    if(usarena->lat->on) uslatrec(usarena,US_LATLOCKWAIT,waitns);
+#endif
+    }
+
+
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* usbinunlock: this function unlocks one of the hidden arena semaphores {{{2 */
+int usbinunlock(
+  usptr_t *usarena,
+  int      ilk)
+{
+int           ret;
+struct sembuf sops;
 
 
-/* set semaphore to zero.  This call will not block even if
+/* give the semaphore back.  This call will not block even if
  * the semaphore already is zero.
  */
-semun.val = 0;
-ret       = semctl(usarena->semid,usarena->maxusers,SETVAL,semun);
+lockheld&= ~(1<<ilk);
+uslockevent(usarena->hist,US_HISTRELEASE,1+ilk,0UL);
+if(usarena->locktype == US_LOCKPI) {
+    ret= pthread_mutex_unlock(&usarena->lock[ilk].mutex)? -1 : 0;
+    }
+else {
+    sops.sem_flg= SEM_UNDO|IPC_NOWAIT;
+    sops.sem_num= usarena->maxusers + ilk;
+    sops.sem_op = -1;
+    ret         = semop(usarena->semid,&sops,1);
+    if(ret == -1 && errno == EAGAIN) ret= 0;
+    }
+if(ilk == USLK_BIG) uswake(usarena->waiters);
 
 
 return ret;
@@ -549,6 +965,8 @@ int ret= -1;
 
 
 if(usarena) {
+    uslatfree(usarena);
+    if(usarena->trace) ustraceoff();
     if(usarena->mempool && usarena->memsize > 0) {
         ret= munmap(usarena->mempool,usarena->memsize);
         }
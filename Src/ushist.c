@@ -0,0 +1,223 @@
+/* ushist.c: this program records lock (semaphore) history in the arena
+ *   The history is a fixed-size ring of USHistRec records kept in the
+ *   arena, so every process attached to the arena writes into the same
+ *   ring and any process can fetch it.  Writers reserve a record with
+ *   one atomic increment; no lock is taken.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <time.h>
+#include <sys/syscall.h>
+#define USINTERNAL
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static pid_t          histpid = 0; /* cached getpid()                        */
+static __thread pid_t histtid = 0; /* cached gettid()                        */
+static int            histfork= 0; /* pthread_atfork() handler registered?   */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+static void histforked(void); /* ushist.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* usclock: this function returns CLOCK_MONOTONIC time in nanoseconds {{{2 */
+unsigned long usclock(void)
+{
+struct timespec ts;
+
+
+clock_gettime(CLOCK_MONOTONIC,&ts);
+
+return (unsigned long) ts.tv_sec*1000000000UL + (unsigned long) ts.tv_nsec;
+}
+
+/* --------------------------------------------------------------------- */
+/* ushistrec: this function records a lock event in the history ring {{{2
+ *   Use the ushistevent() macro, which only calls this when recording is on.
+ *   The record's seq is zeroed while it is being written, so that a
+ *   concurrent ushistfetch() can tell a torn record from a complete one.
+ */
+void ushistrec(
+  USHistCtl     *hist,
+  int            event,
+  usoffset       lockid,
+  unsigned long  waitns)
+{
+unsigned long  idx;
+usbase        *mempool;
+USHistRec     *rec;
+
+
+if(!hist->ring || !hist->size) return;
+if(!histpid) {
+    if(!histfork) {
+        pthread_atfork(NULL,NULL,histforked);
+        histfork= 1;
+        }
+    histpid= getpid();
+    }
+if(!histtid) histtid= (pid_t) syscall(SYS_gettid);
+
+mempool = ((usbase *) hist) - arena_hist_offset;
+idx     = __sync_fetch_and_add(&hist->idx,1);
+rec     = ((USHistRec *) (mempool + hist->ring)) + idx%hist->size;
+
+__atomic_store_n(&rec->seq,0,__ATOMIC_RELEASE);
+rec->time  = usclock();
+rec->waitns= waitns;
+rec->lockid= lockid;
+rec->pid   = histpid;
+rec->tid   = histtid;
+rec->event = event;
+__atomic_store_n(&rec->seq,idx+1,__ATOMIC_RELEASE);
+}
+
+/* --------------------------------------------------------------------- */
+/* ushiston: this function turns lock history recording on (CONF_HISTON) {{{2
+ *   The ring is allocated from the arena the first time; its size
+ *   is taken from CONF_HISTSIZE (default: USHISTSIZE records).
+ *   Returns: 0=success  -1=failure
+ */
+int ushiston(usptr_t *arena)
+{
+unsigned  size;
+USHistRec *ring;
+
+
+if(!arena || !arena->hist) {
+    return -1;
+    }
+
+if(!arena->hist->ring) {
+    size= arena->histsize? arena->histsize : USHISTSIZE;
+    ring= (USHistRec *) uscalloc((size_t) size,sizeof(USHistRec),arena);
+    if(!ring) {
+        return -1;
+        }
+    usarenalock(arena);
+    if(!arena->hist->ring) { /* somebody else may have beaten us to it */
+        arena->hist->size= size;
+        arena->hist->idx = 0;
+        arena->hist->ring= ((usbase *) ring) - arena->mempool;
+        ring             = NULL;
+        }
+    usarenaunlock(arena);
+    if(ring) usfree(ring,arena);
+    }
+arena->hist->on= 1;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* ushistoff: this function turns lock history recording off (CONF_HISTOFF) {{{2
+ *   The records are kept; see ushistfetch().
+ */
+int ushistoff(usptr_t *arena)
+{
+if(!arena || !arena->hist) {
+    return -1;
+    }
+arena->hist->on= 0;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* ushistfetch: this function copies out a snapshot of the history (CONF_HISTFETCH) {{{2
+ *   The records are returned oldest first in snapshot->rec, which the
+ *   caller should free().  Records being written during the copy are left
+ *   out.  Recording need not be stopped.
+ *   Returns: qty of records, or -1 on failure
+ */
+long ushistfetch(
+  usptr_t  *arena,
+  ushist_t *snapshot)
+{
+unsigned long  bgn;
+unsigned long  end;
+unsigned long  idx;
+unsigned long  seq;
+USHistRec     *ring;
+
+
+if(!arena || !arena->hist || !snapshot) {
+    return -1;
+    }
+snapshot->rec = NULL;
+snapshot->qty = 0;
+snapshot->lost= 0;
+if(!arena->hist->ring || !arena->hist->size) {
+    return 0;
+    }
+
+ring= (USHistRec *) (arena->mempool + arena->hist->ring);
+end = __atomic_load_n(&arena->hist->idx,__ATOMIC_ACQUIRE);
+bgn = (end > arena->hist->size)? end - arena->hist->size : 0;
+snapshot->rec= (USHistRec *) malloc((size_t) (end-bgn+1)*sizeof(USHistRec));
+if(!snapshot->rec) {
+    return -1;
+    }
+
+for(idx= bgn; idx < end; ++idx) {
+    USHistRec *rec= &ring[idx%arena->hist->size];
+    seq= __atomic_load_n(&rec->seq,__ATOMIC_ACQUIRE);
+    if(seq != idx+1) { /* still being written, or already overwritten */
+        ++snapshot->lost;
+        continue;
+        }
+    snapshot->rec[snapshot->qty]= *rec;
+    if(__atomic_load_n(&rec->seq,__ATOMIC_ACQUIRE) != seq) ++snapshot->lost;
+    else                                                   ++snapshot->qty;
+    }
+snapshot->lost+= bgn;
+
+return (long) snapshot->qty;
+}
+
+/* --------------------------------------------------------------------- */
+/* ushistreset: this function discards all history records (CONF_HISTRESET) {{{2 */
+int ushistreset(usptr_t *arena)
+{
+if(!arena || !arena->hist) {
+    return -1;
+    }
+
+if(arena->hist->ring) {
+    usarenalock(arena);
+    arena->hist->idx= 0;
+    memset(arena->mempool + arena->hist->ring,0,(size_t) arena->hist->size*sizeof(USHistRec));
+    usarenaunlock(arena);
+    }
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* histforked: this function forgets the cached process and thread ids in a forked child {{{2 */
+static void histforked(void)
+{
+histpid= 0;
+histtid= 0;
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
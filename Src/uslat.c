@@ -0,0 +1,316 @@
+/* uslat.c: this program keeps latency histograms for the allocator
+ *   Each metric (see US_LAT* in arena.h) has USLATBUCKETS log buckets,
+ *   four per power of two nanoseconds.  A process counts into its own
+ *   histograms, so recording costs no shared cache lines; every USLATMERGE
+ *   records, on uslatmerge(), and at exit the counts are added into the
+ *   arena's merged histograms, which any process may fetch.
+ *
+ *   Compiled in when USLATENCY is defined (see Src/Makefile); recording
+ *   is switched on and off at run time with CONF_LATON and CONF_LATOFF.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#define USINTERNAL
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static usptr_t       *latarena= NULL;              /* arena the local counts belong to       */
+static unsigned long  latqty  = 0;                 /* qty of records since the last merge    */
+static pthread_once_t latonce = PTHREAD_ONCE_INIT; /* atexit()/pthread_atfork() registration */
+static uslat_t        latlocal;                    /* this process' unmerged counts          */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+static void latexit(void);      /* uslat.c */
+static void latforked(void);    /* uslat.c */
+static int latmerge(usptr_t *); /* uslat.c */
+static void latsetup(void);     /* uslat.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* uslatbucket: this function maps nanoseconds to a histogram bucket {{{2
+ *   Buckets [0,3] hold 0-3ns; thereafter each power of two is split into
+ *   four buckets, so a bucket's width is at most 25% of its values.
+ */
+int uslatbucket(unsigned long ns)
+{
+int msb;
+int ibkt;
+
+
+if(ns < 4) return (int) ns;
+
+msb = 63 - __builtin_clzl(ns);
+ibkt= (msb-1)*4 + (int) ((ns >> (msb-2))&3);
+
+return (ibkt < USLATBUCKETS)? ibkt : USLATBUCKETS-1;
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatns: this function returns the smallest nanosecond value in bucket ibkt {{{2 */
+unsigned long uslatns(int ibkt)
+{
+if(ibkt < 4) return (unsigned long) ibkt;
+
+return (unsigned long) (4 + ibkt%4) << (ibkt/4 - 1);
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatrec: this function counts one latency sample for a metric {{{2
+ *   Use the uslatbgn()/uslatend() macros, which only call this when
+ *   recording is on.  Any of a process' threads may call it: the counts
+ *   are added atomically, and the switch to another arena is one atomic
+ *   swap (samples other threads record meanwhile may go to either arena).
+ */
+void uslatrec(
+  usptr_t       *arena,
+  int            metric,
+  unsigned long  ns)
+{
+usptr_t *prvarena;
+
+
+if(metric < 0 || metric >= US_LATQTY) return;
+
+pthread_once(&latonce,latsetup);
+if(__atomic_load_n(&latarena,__ATOMIC_ACQUIRE) != arena) { /* counts are for one arena at a time */
+    prvarena= __atomic_exchange_n(&latarena,arena,__ATOMIC_ACQ_REL);
+    if(prvarena && prvarena != arena) latmerge(prvarena);
+    }
+
+__atomic_fetch_add(&latlocal.count[metric][uslatbucket(ns)],1UL,__ATOMIC_RELAXED);
+if(__atomic_add_fetch(&latqty,1UL,__ATOMIC_RELAXED) >= USLATMERGE) uslatmerge(arena);
+}
+
+/* --------------------------------------------------------------------- */
+/* uslaton: this function turns latency recording on (CONF_LATON) {{{2
+ *   The merged histograms are allocated from the arena the first time.
+ *   Recording is turned on for every process using the arena.
+ *   Returns: 0=success  -1=failure (errno=ENOSYS: not compiled in)
+ */
+int uslaton(usptr_t *arena)
+{
+#ifdef USLATENCY
+uslat_t *count;
+
+
+if(!arena || !arena->lat) {
+    return -1;
+    }
+
+if(!arena->lat->count) {
+    count= (uslat_t *) uscalloc((size_t) 1,sizeof(uslat_t),arena);
+    if(!count) {
+        return -1;
+        }
+    usarenalock(arena);
+    if(!arena->lat->count) { /* somebody else may have beaten us to it */
+        arena->lat->count= ((usbase *) count) - arena->mempool;
+        count            = NULL;
+        }
+    usarenaunlock(arena);
+    if(count) usfree(count,arena);
+    }
+arena->lat->on= 1;
+
+return 0;
+#else
+errno= ENOSYS;
+return -1;
+#endif
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatoff: this function turns latency recording off (CONF_LATOFF) {{{2
+ *   The counts are kept; see uslatfetch().
+ */
+int uslatoff(usptr_t *arena)
+{
+if(!arena || !arena->lat) {
+    return -1;
+    }
+arena->lat->on= 0;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatmerge: this function adds this process' counts into the arena's {{{2
+ *   merged histograms and zeroes them.  Counts from other arenas are merged
+ *   into their own arena.
+ *   Returns: 0=success  -1=failure
+ */
+int uslatmerge(usptr_t *arena)
+{
+if(!arena || !arena->lat) {
+    return -1;
+    }
+if(__atomic_load_n(&latarena,__ATOMIC_ACQUIRE) != arena) {
+    return 0;
+    }
+
+return latmerge(arena);
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatfetch: this function copies out the arena's merged histograms (CONF_LATFETCH) {{{2
+ *   This process' own counts are merged first; other processes' counts
+ *   appear once they merge (at most USLATMERGE records late, or at exit).
+ *   Returns: 0=success  -1=failure
+ */
+int uslatfetch(
+  usptr_t *arena,
+  uslat_t *lat)
+{
+if(!arena || !arena->lat || !lat) {
+    return -1;
+    }
+
+uslatmerge(arena);
+if(arena->lat->count) memcpy(lat,arena->mempool + arena->lat->count,sizeof(uslat_t));
+else                  memset(lat,0,sizeof(uslat_t));
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatreset: this function zeroes the arena's merged histograms (CONF_LATRESET) {{{2 */
+int uslatreset(usptr_t *arena)
+{
+if(!arena || !arena->lat) {
+    return -1;
+    }
+
+if(__atomic_load_n(&latarena,__ATOMIC_ACQUIRE) == arena) {
+    memset(&latlocal,0,sizeof(uslat_t));
+    latqty= 0;
+    }
+if(arena->lat->count) {
+    memset(arena->mempool + arena->lat->count,0,sizeof(uslat_t));
+    }
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatpercentile: this function returns a metric's pct percentile, in nanoseconds {{{2
+ *   The value returned is the upper end of the bucket holding the
+ *   percentile (HDR-style "highest equivalent value"); 0 if no samples.
+ */
+unsigned long uslatpercentile(
+  uslat_t *lat,
+  int      metric,
+  double   pct)
+{
+int           ibkt;
+unsigned long qty  = 0;
+unsigned long want;
+unsigned long seen = 0;
+
+
+if(!lat || metric < 0 || metric >= US_LATQTY) return 0;
+
+for(ibkt= 0; ibkt < USLATBUCKETS; ++ibkt) qty+= lat->count[metric][ibkt];
+if(!qty) return 0;
+
+if(pct < 0.)   pct= 0.;
+if(pct > 100.) pct= 100.;
+want= (unsigned long) (pct*(double) qty/100. + 0.5);
+if(want < 1) want= 1;
+for(ibkt= 0; ibkt < USLATBUCKETS; ++ibkt) {
+    seen+= lat->count[metric][ibkt];
+    if(seen >= want) break;
+    }
+if(ibkt >= USLATBUCKETS-1) return uslatns(USLATBUCKETS-1);
+
+return uslatns(ibkt+1) - 1;
+}
+
+/* --------------------------------------------------------------------- */
+/* uslatfree: this function merges and forgets this process' counts for an arena {{{2
+ *   usfreearena() calls this before it unmaps the arena.
+ */
+void uslatfree(usptr_t *arena)
+{
+usptr_t *expect= arena;
+
+
+if(arena && __atomic_compare_exchange_n(&latarena,&expect,NULL,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)) {
+    latmerge(arena);
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* latexit: this function merges this process' remaining counts at exit {{{2 */
+static void latexit(void)
+{
+usptr_t *arena= __atomic_load_n(&latarena,__ATOMIC_ACQUIRE);
+
+
+if(arena) latmerge(arena);
+}
+
+/* --------------------------------------------------------------------- */
+/* latforked: this function forgets the parent's unmerged counts in a forked child {{{2 */
+static void latforked(void)
+{
+memset(&latlocal,0,sizeof(uslat_t));
+latqty= 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* latmerge: this function adds this process' counts into arena's merged histograms {{{2
+ *   and zeroes them (see uslatmerge()).
+ *   Returns: 0=success
+ */
+static int latmerge(usptr_t *arena)
+{
+int            ibkt;
+int            metric;
+unsigned long  qty;
+uslat_t       *merged;
+
+
+if(!arena->lat->count) {
+    return 0;
+    }
+
+merged= (uslat_t *) (arena->mempool + arena->lat->count);
+__atomic_store_n(&latqty,0UL,__ATOMIC_RELAXED);
+for(metric= 0; metric < US_LATQTY; ++metric) {
+    for(ibkt= 0; ibkt < USLATBUCKETS; ++ibkt) {
+        if(!latlocal.count[metric][ibkt]) continue;
+        qty= __atomic_exchange_n(&latlocal.count[metric][ibkt],0UL,__ATOMIC_RELAXED);
+        __atomic_fetch_add(&merged->count[metric][ibkt],qty,__ATOMIC_RELAXED);
+        }
+    }
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* latsetup: this function registers the exit and fork handlers, once per process {{{2 */
+static void latsetup(void)
+{
+atexit(latexit);
+pthread_atfork(NULL,NULL,latforked);
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
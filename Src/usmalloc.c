@@ -14,50 +14,25 @@
  */
 #include <string.h>
 #include <signal.h>
-#include <sys/wait.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 #define USINTERNAL
 #include "arena.h"
+#include "usprobe.h"
 
 /* ---------------------------------------------------------------------
  * Definitions: {{{2
  */
-void usmemdescfree(void *ptr);
-/* double_link: handles the generation of doubly linked lists.  Note that
- *   each structure is assumed to have members "nxt" and "prv".
- *   The new member becomes "tail" - ie. oldest is first in the linked list,
- *   the newest is last.
- */
-#define double_link(structure,head,tail,fail_msg) {                    \
-	structure *newstr;                                                 \
-	newstr= (structure *) malloc(sizeof(structure));                   \
-	if(!newstr) fprintf(stderr,(void *) newstr,"%s\n",fail_msg);       \
-    else {                                                             \
-        if(tail) (tail)->nxt= newstr;                                  \
-        else     head       = newstr;                                  \
-        newstr->prv= tail;                                             \
-        newstr->nxt= (structure *) NULL;                               \
-        tail       = newstr;                                           \
-        }                                                              \
-	}
-#define delete_double_link(structure,str,head,tail) {                  \
-	structure *old= str;                                               \
-	if(old->prv) old->prv->nxt= old->nxt;                              \
-	else         head         = old->nxt;                              \
-	if(old->nxt) old->nxt->prv= old->prv;                              \
-	else         tail         = old->prv;                              \
-	free((char *) old);                                                \
-	}
-/* stralloc: allocates new memory for and copies a string into the new mem */
-#define stralloc(ptr,string,fail_msg) {                                  \
-	ptr= (char *) calloc((size_t) strlen(string) + 1,sizeof(char));      \
-	if(!ptr) fprintf(stderr,"%s: <%s>\n",fail_msg,string);               \
-    else     strcpy(ptr,string);                                         \
-	}
 
 /* ---------------------------------------------------------------------
  * Data: {{{2
  */
 extern USArena *usarena;
+static uscorrupt_t corruptfn= NULL; /* this process' corruption handler (NULL: CorruptDefault()) */
+static __thread int tracehold= 0;   /* in usrealloc()/usrecalloc(), which trace themselves      */
+static __thread size_t dirtyqty= 0; /* leading bytes of this thread's last usmalloc()'d memory that may not read zero */
+static unsigned long pagesize = 0;  /* sysconf(_SC_PAGESIZE), for TrimChunk() and TopCommit()   */
 
 /* ---------------------------------------------------------------------
  * Prototypes: {{{2
@@ -66,60 +41,151 @@ static usoffset getnxtneighbor(usoffset);         /* usmalloc.c */
 static usoffset getprvneighbor(usoffset);         /* usmalloc.c */
 static usoffset resize(usoffset);                 /* usmalloc.c */
 static usoffset sizecheck(usoffset);              /* usmalloc.c */
+static void ClaimBin(int);                        /* usmalloc.c */
+static void CorruptDefault(usptr_t *,void *,const char *); /* usmalloc.c */
+static void CountMalloc(int,usoffset);            /* usmalloc.c */
+static void ReleaseBins(void);                    /* usmalloc.c */
+static int FreeNeedsSmall(usoffset);              /* usmalloc.c */
 static void ExtractChunk(usoffset);               /* usmalloc.c */
-static usoffset FindChunk(usoffset);              /* usmalloc.c */
+static usoffset FastChunk(usoffset);              /* usmalloc.c */
+static void FastMerge(void);                      /* usmalloc.c */
+static void FastPark(usoffset);                   /* usmalloc.c */
+static usoffset FindChunk(usoffset,int);          /* usmalloc.c */
 static void InsertFreeChunk(usoffset);            /* usmalloc.c */
 static void MergeFreeChunk(usoffset);             /* usmalloc.c */
+static int NextBin(int,int);                      /* usmalloc.c */
+static void RemoteDrain(void);                    /* usmalloc.c */
+static usoffset RemoteMark(usoffset);             /* usmalloc.c */
 static usoffset SplitChunk( usoffset,  usoffset); /* usmalloc.c */
+static usoffset TopChunk(usoffset);               /* usmalloc.c */
+static int TopCommit(usoffset);                   /* usmalloc.c */
+static usoffset TrimChunk(usoffset,usoffset,usoffset,usoffset); /* usmalloc.c */
+static void ZeroFill(void *,size_t);              /* usmalloc.c */
 
 /* =====================================================================
  * Functions: {{{1
  */
 
 /* --------------------------------------------------------------------- */
-/* uscalloc: this function emulates calloc() but using the arena memory pool {{{2 */
+/* uscalloc: this function emulates calloc() but using the arena memory pool {{{2
+ *   Memory carved from the untouched part of the top chunk already reads
+ *   zero (see TopChunk()), so only what lies below that is cleared.
+ */
 void *uscalloc(
   size_t   nelem, 
   size_t   elsize,
   usptr_t *arena) 
 {
-usoffset  totsize;
-void     *pchunk = NULL;
+size_t         totsize;
+size_t         usable;
+void          *pchunk = NULL;
+unsigned long  t0     = uslatbgn(arena);
 
 
 usarena = arena;
-totsize = nelem*elsize + 2*sizeof(usoffset); /* inuse overhead: size:status | user data | size:status */
-if(totsize != 0) {
-    pchunk = usmalloc(totsize,arena);
-    if(pchunk) memset(pchunk,0,(size_t) totsize);       /* initialize memory to all zeros                        */
+if(elsize && nelem > ((size_t) -1)/elsize) { /* nelem*elsize overflows */
+    errno= ENOMEM;
+    uslatend(arena,US_LATCALLOC,t0);
+    return NULL;
+    }
+totsize = nelem*elsize;                      /* usmalloc() adds the overhead */
+pchunk  = usmalloc(totsize,arena);
+if(pchunk) {                                 /* initialize memory to all zeros */
+    usable= (size_t) (getsizebgn(ptr2chunk(pchunk)) - sizeof(usoffset)); /* no more than the chunk holds,       */
+    if(usable > dirtyqty) usable= dirtyqty;                              /* and only what may not read zero yet */
+    ZeroFill(pchunk,totsize < usable? totsize : usable);
     }
+uslatend(arena,US_LATCALLOC,t0);
 
 return pchunk;
 }
 
 /* --------------------------------------------------------------------- */
-/* usfree: this function emulates free() but using the arena memory pool {{{2 */
+/* usfree: this function emulates free() but using the arena memory pool {{{2
+ *   Chunks of requests of up to CONF_FASTMAX bytes are parked in a fastbin,
+ *   unmerged and still marked inuse, under just the one-size bin lock; the
+ *   next usmalloc() of that size takes them straight back.  The fastbins
+ *   are consolidated (see FastMerge()) when they'd hold more than
+ *   USFASTBYTES, or when no free chunk can satisfy a request.
+ *
+ *   With CONF_REMOTEFREE on, no lock is taken at all: the chunk is pushed
+ *   onto the arena's queue of freed chunks with one compare-and-swap, and
+ *   the next usmalloc() that takes USLK_BIG frees the lot (RemoteDrain()).
+ *   A process that only frees, then, never waits on those that allocate.
+ */
 void usfree(
   void    *ptr,  
   usptr_t *arena)
 {
-usoffset ichunk;
+int           ilk;
+usoffset      ichunk;
+unsigned long t0= uslatbgn(arena);
 
 
 
 usarena= arena;
+usprobe1(free_entry,ptr);
+if(ptr && usarena->trace && !tracehold) ustracerec(US_TRACEFREE,ptr2chunk(ptr),0,0); /* before it can be reused */
 if(ptr) {
-    usarenalock(usarena);
-    ichunk= ptr2chunk(ptr); /* convert pointer to user memory into an ichunk */
-    sizecheck(ichunk);      /* check that the chunk hasn't been corrupted    */
-    if(isfree(ichunk)) {    /* can't free an already free chunk              */
+    ichunk= ptr2chunk(ptr);                         /* convert pointer to user memory into an ichunk */
+    if(usarena->remote->on) {                       /* queue it for the next lock holder             */
+        usoffset hdr= (sizecheck(ichunk) && !isfree(ichunk))? RemoteMark(ichunk) : 0x1;
+        if(hdr&0x4) {                               /* already fast or queued: freed twice           */
+            if(uscheck(US_CHECKCHEAP)) uscorrupt(ptr,"double free (chunk %lu is already queued or in a fastbin)",ichunk);
+            }
+        else if(!(hdr&0x1)) {                       /* this usfree() alone has marked it queued      */
+            usoffset hd= __atomic_load_n(&usarena->remote->hd,__ATOMIC_RELAXED);
+            if(gettag(ichunk)) {
+                __atomic_fetch_sub(&usarena->tags->bytes[gettag(ichunk)],(long) getsizebgn(ichunk),__ATOMIC_RELAXED);
+                settag(ichunk,0);
+                }
+            if(hdr&0x2) usproffree(usarena,ichunk);  /* it was sampled (the bit is now queued's)      */
+            do {
+                setnxtchunk(ichunk,hd);
+                } while(!__atomic_compare_exchange_n(&usarena->remote->hd,&hd,ichunk,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+            }
+        uslatend(arena,US_LATFREE,t0);
+        usprobe1(free_return,ptr);
         return;
         }
-    setfree(ichunk);        /* label memory as free                          */
-    MergeFreeChunk(ichunk); /* merge newly free'd chunk                      */
-    usarenaunlock(usarena);
+    ilk   = (getsizebgn(ichunk) - sizeof(usoffset) <= usarena->fast->max)? USLK_SMALL : USLK_BIG;
+    if(ilk == USLK_SMALL) {                         /* fastbins locked                               */
+        usbinlock(usarena,USLK_SMALL);
+        if(usarena->fast->bytes + getsizebgn(ichunk) > USFASTBYTES) { /* consolidate them first      */
+            ReleaseBins();
+            usarenalock(usarena);
+            ClaimBin(0);
+            FastMerge();
+            ilk= USLK_BIG;
+            }
+        }
+    else usarenalock(usarena);                      /* multi-size bins locked                        */
+    if(!sizecheck(ichunk) || isfree(ichunk) || isfast(ichunk) || isqueued(ichunk)) { /* can't free a corrupted or already free chunk */
+        ReleaseBins();
+        uslatend(arena,US_LATFREE,t0);
+        usprobe1(free_return,ptr);
+        return;
+        }
+    if(ilk == USLK_BIG && FreeNeedsSmall(ichunk)) ClaimBin(0); /* one-size bins locked (if needed)   */
+    usarena->stats[ilk].inuse-= (long) getsizebgn(ichunk);
+    ++usarena->stats[ilk].nfree;
+    if(gettag(ichunk)) {                            /* free chunks are untagged                      */
+        __atomic_fetch_sub(&usarena->tags->bytes[gettag(ichunk)],(long) getsizebgn(ichunk),__ATOMIC_RELAXED);
+        settag(ichunk,0);
+        }
+    if(issampled(ichunk)) {                         /* drop its heap profile sample                  */
+        usproffree(usarena,ichunk);
+        clrsampled(ichunk);
+        }
+    if(ilk == USLK_SMALL) FastPark(ichunk);         /* park it in its fastbin                        */
+    else {
+        setfree(ichunk);                            /* label memory as free                          */
+        MergeFreeChunk(ichunk);                     /* merge newly free'd chunk                      */
+        }
+    ReleaseBins();
     }
-
+uslatend(arena,US_LATFREE,t0);
+usprobe1(free_return,ptr);
 
 }
 
@@ -127,32 +193,183 @@ if(ptr) {
 /* usmalloc: this function emulates malloc() but using the arena memory pool {{{2
  *   inuse chunk:  size/status=inuse
  *                 ..user space..     <-pointer returned to user space
- *                 size
+ *   (only free chunks end with their size; see FreeNeedsSmall())
+ *
+ *   Small requests first try the fastbins and the one-size bins while
+ *   holding only the one-size bin lock, so they don't serialize with large
+ *   requests.
  */
 void *usmalloc(
   size_t   size, 
   usptr_t *arena)
 {
-usoffset  ichunk;
-void     *pchunk;
+usoffset       ichunk = 0;
+void          *pchunk = NULL;
+unsigned long  t0     = uslatbgn(arena);
+unsigned long  t1;
 
 
 
-size   += 2*sizeof(usoffset); /* inuse overhead: size:status | user data | size:status */
-usarena = arena;
+usprobe1(malloc_entry,size);
+usarena   = arena;
+if(size > USSIZEMASK - sizeof(usoffset) - usarena->align) { /* with its overhead, rounded up, it can't be a chunk */
+    errno= ENOMEM;
+    uslatend(arena,US_LATMALLOC,t0);
+    usprobe2(malloc_return,pchunk,size);
+    return NULL;
+    }
+size     += sizeof(usoffset); /* inuse overhead: size:status | user data */
+dirtyqty  = (size_t) -1;
+if(isonesize(resize((usoffset) size))) {
+    usbinlock(usarena,USLK_SMALL);
+    t1    = uslatbgn(usarena);
+    ichunk= FastChunk((usoffset) size);
+    if(!ichunk) ichunk= FindChunk((usoffset) size,USMAXONESIZE);
+    uslatend(usarena,US_LATFIND,t1);
+    if(ichunk) {
+        setinuse(ichunk);
+        CountMalloc(USLK_SMALL,ichunk);
+        pchunk= chunk2ptr(ichunk);
+        }
+    ReleaseBins();
+    }
+if(!ichunk) {
+    usarenalock(usarena);
+    t1    = uslatbgn(usarena);
+    ichunk= FindChunk((usoffset) size,USMAXFREEBIN-1);
+    uslatend(usarena,US_LATFIND,t1);
+    if(ichunk) {
+        setinuse(ichunk);
+        CountMalloc(USLK_BIG,ichunk);
+        pchunk= chunk2ptr(ichunk);
+        }
+    else ++usarena->stats[USLK_BIG].nfail;
+    ReleaseBins();
+    }
+if(ichunk && usarena->prof->on) usprofsample(usarena,ichunk,size - sizeof(usoffset));
+if(ichunk && usarena->trace && !tracehold) ustracerec(US_TRACEMALLOC,ichunk,0,size - sizeof(usoffset));
+uslatend(arena,US_LATMALLOC,t0);
+usprobe2(malloc_return,pchunk,size - sizeof(usoffset));
+
+return pchunk;
+}
+
+/* --------------------------------------------------------------------- */
+/* usmemalign: this function emulates memalign() but using the arena memory pool {{{2
+ *   align must be a power of two.  A chunk big enough to hold an aligned
+ *   chunk anywhere in it is taken from the bins; the leading slack (at
+ *   least MINCHUNKSIZE bytes, if any) and the trailing slack are freed
+ *   back into them.  Alignments no greater than the arena's (see
+ *   CONF_MINALIGN) are just usmalloc()'d.  The memory may be usrealloc()'d,
+ *   but the new memory has only the arena's alignment.
+ */
+void *usmemalign(
+  size_t   align,
+  size_t   size,
+  usptr_t *arena)
+{
+usoffset       achunk;
+usoffset       ichunk= 0;
+usoffset       isz;
+usoffset       lead;
+usoffset       needsz;
+void          *pchunk= NULL;
+unsigned long  t0;
+unsigned long  t1;
+
+
+if(!align || (align & (align-1))) {
+    errno= EINVAL;
+    return NULL;
+    }
+usarena= arena;
+if(align <= usarena->align) return usmalloc(size,arena);
+if(size > USSIZEMASK - align - 2*MINCHUNKSIZE) {
+    errno= ENOMEM;
+    return NULL;
+    }
+
+t0    = uslatbgn(arena);
+usprobe1(malloc_entry,size);
+needsz= resize((usoffset) size + sizeof(usoffset)); /* inuse overhead: size:status | user data */
 usarenalock(usarena);
-ichunk  = FindChunk((usoffset) size);
+t1    = uslatbgn(usarena);
+ichunk= FindChunk(needsz + align + MINCHUNKSIZE,USMAXFREEBIN-1);
+uslatend(usarena,US_LATFIND,t1);
 if(ichunk) {
-    setinuse(ichunk);
-    pchunk  = chunk2ptr(ichunk);
+    /* ichunk is inuse and out of the bins; find the first aligned user
+     * memory in it that leaves either no leading slack or enough to be a chunk
+     */
+    isz = getsizebgn(ichunk);
+    lead= (usoffset) ((align - ((unsigned long) chunk2ptr(ichunk) & (align-1))) & (align-1));
+    while(lead && lead < MINCHUNKSIZE) lead+= align;
+    achunk= ichunk + lead;
+    if(lead) { /* free the leading slack */
+        setsize(ichunk,lead);
+        initsize(achunk,isz - lead);
+        setfree(ichunk);
+        MergeFreeChunk(ichunk);
+        isz-= lead;
+        }
+    if(isz >= needsz + MINCHUNKSIZE) { /* free the trailing slack */
+        setsize(achunk,needsz);
+        initsize(achunk + needsz,isz - needsz);
+        setfree(achunk + needsz);
+        MergeFreeChunk(achunk + needsz);
+        }
+    ichunk= achunk;
+    CountMalloc(USLK_BIG,ichunk);
+    pchunk= chunk2ptr(ichunk);
     }
-else pchunk= NULL;
-usarenaunlock(usarena);
-
+else {
+    ++usarena->stats[USLK_BIG].nfail;
+    errno= ENOMEM;
+    }
+ReleaseBins();
+if(ichunk && usarena->prof->on) usprofsample(usarena,ichunk,size);
+if(ichunk && usarena->trace && !tracehold) ustracerec(US_TRACEMALLOC,ichunk,0,size);
+uslatend(arena,US_LATMALLOC,t0);
+usprobe2(malloc_return,pchunk,size);
 
 return pchunk;
 }
 
+/* --------------------------------------------------------------------- */
+/* usposix_memalign: this function emulates posix_memalign() but using the arena memory pool {{{2
+ *   align must be a power of two multiple of sizeof(void *).
+ *   Returns: 0=success  EINVAL=bad alignment  ENOMEM=no memory (*memptr is then unchanged)
+ */
+int usposix_memalign(
+  void   **memptr,
+  size_t   align,
+  size_t   size,
+  usptr_t *arena)
+{
+void *ptr;
+
+
+if(!memptr || align < sizeof(void *) || (align & (align-1))) {
+    return EINVAL;
+    }
+ptr= usmemalign(align,size,arena);
+if(!ptr) {
+    return ENOMEM;
+    }
+*memptr= ptr;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* usaligned_alloc: this function emulates aligned_alloc() but using the arena memory pool {{{2 */
+void *usaligned_alloc(
+  size_t   align,
+  size_t   size,
+  usptr_t *arena)
+{
+return usmemalign(align,size,arena);
+}
+
 /* --------------------------------------------------------------------- */
 /* usrealloc: this function emulates realloc() but using the arena memory pool {{{2 */
 void *usrealloc(
@@ -160,15 +377,17 @@ void *usrealloc(
   size_t   size, 
   usptr_t *arena)
 {
-usoffset  newchunk;         /* new chunk having new size */
-usoffset  oldchunk;         /* old chunk                 */
-usoffset  oldsize;          /* actual old chunk size     */
-usoffset  copyqty;
-void     *newptr = NULL;
+usoffset       newchunk;         /* new chunk having new size */
+usoffset       oldchunk;         /* old chunk                 */
+usoffset       oldsize;          /* actual old chunk size     */
+usoffset       copyqty;
+void          *newptr = NULL;
+unsigned long  t0     = uslatbgn(arena);
 
 
 
 usarena = arena;
+usprobe2(realloc_entry,ptr,size);
 
 if(!ptr) newptr= usmalloc(size,arena);             /* if ptr is null, treat like a plain malloc     */
 else if(size == 0L) {                              /* looks like an odd way to free a chunk         */
@@ -178,23 +397,29 @@ else if(size == 0L) {                              /* looks like an odd way to f
 else {                                             /* do a real re-alloc                            */
     oldchunk= ptr2chunk(ptr);                      /* convert ptr to chunk index                    */
     oldsize = sizecheck(oldchunk);                 /* get ichunk's current size, including overhead */
-    newptr= usmalloc(size,arena);
+    ++tracehold;
+    newptr  = oldsize? usmalloc(size,arena) : NULL;
     if(newptr) {
         newchunk = ptr2chunk(newptr);
-        copyqty  = oldsize - 2*sizeof(usoffset);   /* don't copy overhead bytes                     */
+        copyqty  = oldsize - sizeof(usoffset);     /* don't copy overhead bytes                     */
         if(size < copyqty) copyqty= size;
         memcpy(newptr,ptr,copyqty);
+        if(gettag(oldchunk)) ussettag(arena,newptr,gettag(oldchunk)); /* the tag follows the memory */
+        if(arena->trace) ustracerec(US_TRACEREALLOC,newchunk,oldchunk,size);
         usfree(ptr,arena);
         }
+    --tracehold;
     }
-
+uslatend(arena,US_LATREALLOC,t0);
+usprobe2(realloc_return,newptr,size);
 
 return newptr;
 }
 
 /* --------------------------------------------------------------------- */
 /* usrecalloc: this function merges usrealloc() and uscalloc(). {{{2
- * New bytes are initialized to zero (if the new size is > old size).
+ * New bytes are initialized to zero (if the new size is > old size),
+ * unless the new memory already reads zero (see uscalloc()).
  * Old bytes are copied to the beginning of the new memory.
  */
 void *usrecalloc(
@@ -203,38 +428,139 @@ void *usrecalloc(
   size_t   elsize,	/* size of an element                      */
   usptr_t *arena) 	/* arena                                   */
 {
-void     *newptr;
-usoffset  newchunk;
-usoffset  newsize;
-usoffset  oldchunk;
-usoffset  oldsize;
+void          *newptr = NULL;
+usoffset       newchunk;
+usoffset       newsize;
+usoffset       usable;
+usoffset       oldchunk;
+usoffset       oldsize;
+unsigned long  t0     = uslatbgn(arena);
 
 
+usarena= arena;
 if(nel == 0 || elsize == 0) { /* an odd way to free the memory */
     usfree(ptr,arena);
     }
+else if(nel > ((size_t) -1)/elsize) { /* nel*elsize overflows; ptr is left as it was */
+    errno= ENOMEM;
+    }
 else {
     oldchunk = ptr2chunk(ptr);
     oldsize  = sizecheck(oldchunk);
     newsize  = nel*elsize;
-    newptr   = usmalloc(newsize,arena);
+    ++tracehold;
+    newptr   = oldsize? usmalloc(newsize,arena) : NULL;
     if(newptr) {
         newchunk = ptr2chunk(newptr);
-        oldsize -= 2*sizeof(usoffset);
+        usable   = getsizebgn(newchunk) - sizeof(usoffset); /* no more than the chunk holds is cleared, */
+        if(usable > dirtyqty) usable= dirtyqty;            /* and only what may not read zero yet      */
+        oldsize -= sizeof(usoffset);
         if(newsize < oldsize) {
             memcpy(newptr,ptr,newsize);
             }
         else {
             memcpy(newptr,ptr,oldsize);
-            memset(newptr+oldsize,0,newsize-oldsize);
+            if(oldsize < usable) ZeroFill((char *) newptr + oldsize,(newsize < usable? newsize : usable) - oldsize);
             }
+        if(gettag(oldchunk)) ussettag(arena,newptr,gettag(oldchunk));
+        if(arena->trace) ustracerec(US_TRACEREALLOC,newchunk,oldchunk,newsize);
         usfree(ptr,arena); /* free up old pointer information */
         }
+    --tracehold;
     }
+uslatend(arena,US_LATRECALLOC,t0);
 
 return newptr;
 }
 
+/* --------------------------------------------------------------------- */
+/* usmallinfo: this function reports arena usage, like mallinfo() {{{2
+ *   The counters are kept up to date by usmalloc() and usfree(), so this
+ *   takes constant time and does not lock the arena.  Consequently a
+ *   report taken while other processes are allocating is only approximate.
+ *   Returns: 0=success  -1=failure
+ */
+int usmallinfo(
+  usptr_t           *arena,
+  struct usmallinfo *info)
+{
+int  ilk;
+long inuse= 0;
+
+
+if(!arena || !arena->stats || !info) {
+    return -1;
+    }
+
+memset(info,0,sizeof(struct usmallinfo));
+for(ilk= 0; ilk < USLK_QTY; ++ilk) {
+    USStats *stats= &arena->stats[ilk];
+    inuse         += __atomic_load_n(&stats->inuse,__ATOMIC_RELAXED);
+    info->nmalloc += stats->nmalloc;
+    info->nfree   += stats->nfree;
+    info->nfail   += stats->nfail;
+    info->nlock   += stats->nlock;
+    info->ncontend+= stats->ncontend;
+    if(stats->peak > info->peak) info->peak= stats->peak;
+    }
+if(inuse < 0)                          inuse= 0;
+if((usoffset) inuse > arena->memsize) inuse= (long) arena->memsize;
+info->arena= arena->memsize;
+info->inuse= (size_t) inuse;
+info->free = info->arena - info->inuse;
+if(arena->top && arena->base && arena->top->chunk && arena->top->chunk < arena->memsize) { /* may be changing under us */
+    info->top= ((usoffset *) (arena->base + arena->top->chunk))[0]&USSIZEMASK;
+    if(info->top > info->free) info->top= info->free;
+    }
+if(arena->fast) {
+    info->fast= arena->fast->bytes;
+    if(info->fast > info->free) info->fast= info->free;
+    }
+memcpy(info->binqty,arena->binqty,USMAXFREEBIN*sizeof(unsigned long));
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* ustrim: this function returns the arena's free memory to the operating system {{{2
+ *   The whole pages of every free chunk, past its first pad bytes, are
+ *   released (see TrimChunk()); free chunks that outgrow CONF_TRIMSIZE
+ *   have this done as they're freed.  Queued frees are done and the
+ *   fastbins consolidated first;
+ *   then only the multi-size bins (and the top chunk) hold chunks big
+ *   enough to span a page.
+ *   Returns: qty of bytes punched out (resident or not), or -1 (errno=EINVAL)
+ */
+long ustrim(
+  usptr_t *arena,
+  size_t   pad)
+{
+int      ibin;
+long     released= 0;
+usoffset ichunk;
+
+
+if(!arena || !arena->trim) {
+    errno= EINVAL;
+    return -1;
+    }
+
+usarena= arena;
+usarenalock(usarena);
+RemoteDrain();
+FastMerge();
+for(ibin= USMAXONESIZE+1; ibin < USMAXFREEBIN; ++ibin) {
+    for(ichunk= usarena->bin[ibin].hd; ichunk; ichunk= getnxtchunk(ichunk)) {
+        released+= (long) TrimChunk(ichunk,(usoffset) pad,ichunk,ichunk + getsizebgn(ichunk));
+        }
+    }
+ichunk= usarena->top->chunk;
+if(ichunk) released+= (long) TrimChunk(ichunk,(usoffset) pad,ichunk,ichunk + getsizebgn(ichunk));
+ReleaseBins();
+
+return released;
+}
+
 /* =====================================================================
  * Support Routines: {{{1
  */
@@ -250,25 +576,26 @@ static usoffset getnxtneighbor(usoffset ichunk)
 {
 
 ichunk+= getsizebgn(ichunk);
-if(ichunk > usarena->memsize) ichunk= 0;
+if(ichunk >= usarena->memsize) ichunk= 0;
 
 return ichunk;
 }
 
 /* --------------------------------------------------------------------- */
-/* getprvneighbor: this function returns a usoffset to the preceding neighboring chunk {{{2
+/* getprvneighbor: this function returns a usoffset to the preceding neighboring chunk if it's free {{{2
  *  free chunk : size/status=free
  *               index to next chunk in bin
  *               index to prev chunk in bin
  *               ..unused space..
  *               size
+ *  Only free chunks end with their size, so an inuse one yields 0.
  */
 static usoffset getprvneighbor(usoffset ichunk)
 {
 usoffset iszchunk;
 
 
-iszchunk= ((usoffset *)(usarena->base+ichunk))[-1];
+iszchunk= isprvfree(ichunk)? ((usoffset *)(usarena->base+ichunk))[-1] : 0;
 if     (iszchunk == 0)     ichunk  = 0;
 else if(iszchunk > ichunk) ichunk  = 0;
 else                       ichunk -= iszchunk;
@@ -277,52 +604,58 @@ return ichunk;
 }
 
 /* --------------------------------------------------------------------- */
-/* hashsize: maps sz to [0,155] {{{2
- *  The first [0,63] are one-size-only bins
+/* hashsize: maps sz to [0,USMAXFREEBIN-1] {{{2
+ *  The first [0,63] are one-size-only bins.  The multi-size bins then
+ *  split each power of two of sizes into USSUBBINS ranges, picked by the
+ *  USBINSHIFT bits below the leading one.  Sizes are less than 2^47 (see
+ *  USSIZEMASK), so the last bin is reached only by the largest of them.
+ *
+ * overhead for inuse chunk: 8 bytes  (size: ...)
+ * overhead for free  chunk: 32 bytes (size:nxt:prv:...:size)
+ * So the minimum chunk must have 32 bytes.
+ * All chunks assumed to be in multiples of 8 bytes (for alignment purposes).
  */
 int ushashsize(usoffset sz)
 {
-int           hash;
-unsigned long isz;         /* temporary sz */
-unsigned long ssz    = sz; /* shifted      */
-unsigned long offset = 0;
+int           lg;
+unsigned long ssz= sz>>3; /* in 8-byte units */
 
 
-/* overhead for inuse chunk: 8 bytes  (size: ... : size)
- * overhead for free  chunk: 16 bytes (size:nxt:prv:...:size)
- * So the minimum chunk must have 16 bytes.
- * All chunks assumed to be in multiples of 8 bytes (for alignment purposes).
- * bins 0-63 : each hold one size only
- */
-if     (sz <= 512) hash= (sz>>3)-1; /* ie. hash/8, maps [1,512] -> [0,63] */
-else {
-    ssz= sz>>3;
-    isz= ssz;
-    
-    hash= 1;
-    if(isz & 0xffff0000) hash+= 16, isz&= 0xffff0000; /* 11111111 11111111 00000000 00000000 */
-    if(isz & 0xff00ff00) hash+=  8, isz&= 0xff00ff00; /* 11111111 00000000 11111111 00000000 */
-    if(isz & 0xf0f0f0f0) hash+=  4, isz&= 0xf0f0f0f0; /* 11110000 11110000 11110000 11110000 */
-    if(isz & 0xcccccccc) hash+=  2, isz&= 0xcccccccc; /* 11001100 11001100 11001100 11001100 */
-    if(isz & 0xaaaaaaaa) hash+=  1, isz&= 0xaaaaaaaa; /* 10101010 10101010 10101010 10101010 */
-    
-    offset = (ssz>>(hash-3))&(~4); /* extract two bits to the right of the leftmost 1 */
-    hash   = ((hash<<2)|offset) + 36;
-    }
+if(sz <= 8*(USMAXONESIZE+1)) return (int) ssz - 1; /* maps [8,512] -> [0,63] */
 
+lg= 63 - __builtin_clzl(ssz); /* its leading one; ssz > 64, so lg >= 6 */
+return USMAXONESIZE + 1 + ((lg - 6) << USBINSHIFT) + (int) ((ssz >> (lg - USBINSHIFT)) & (USSUBBINS - 1));
+}
+
+/* --------------------------------------------------------------------- */
+/* usbinminsize: this function returns the smallest chunk size ushashsize() maps to ibin {{{2 */
+usoffset usbinminsize(int ibin)
+{
+int      lg;
+usoffset sz;
+
+
+if(ibin <= USMAXONESIZE) return 8*(usoffset) (ibin + 1);
 
-return hash;
+ibin-= USMAXONESIZE + 1;
+lg   = 6 + (ibin >> USBINSHIFT);
+sz   = ((usoffset) (USSUBBINS + (ibin & (USSUBBINS - 1))) << (lg - USBINSHIFT)) << 3;
+if(sz <= 8*(USMAXONESIZE+1)) sz= 8*(USMAXONESIZE+1) + 8; /* the one-size bins took the rest */
+
+return sz;
 }
 
 /* --------------------------------------------------------------------- */
 /* resize: this function resizes a user request by requiring that a chunk: {{{2
  *  - has at least sz bytes available for the user to use
- *  - begins at an eight-byte boundary
+ *  - begins at an eight-byte (or, see CONF_MINALIGN, sixteen-byte) boundary
  *  - is at least 16 bytes (four usoffsets) long, so that when it is free'd, it can go into a free-bin-list
  *
  * rounding upwards
- * to the nearest eight-byte boundary.  In addition, a minimum of
- * 16 bytes is imposed
+ * to the nearest multiple of the arena's alignment.  In addition, a minimum of
+ * MINCHUNKSIZE bytes is imposed.  As the first chunk begins eight bytes
+ * before an alignment boundary and every chunk is a multiple of it long,
+ * every chunk's user memory is aligned.
  */
 static usoffset resize(usoffset sz)
 {
@@ -330,19 +663,23 @@ usoffset rsz;
 
 
 if(sz < MINCHUNKSIZE) rsz= MINCHUNKSIZE;
-else                  rsz= ((sz-1)&(~0x7)) + 8;
+else                  rsz= ((sz-1)&~((usoffset) usarena->align - 1)) + usarena->align;
 
 return rsz;
 }
 
 /* --------------------------------------------------------------------- */
-/* sizecheck: this function checks sizes and will issue a SIGBUS to {{{2
- *  cause a core dump if the sizes don't match.
- *
- *  When beginning and ending sizes match: returns size of chunk.
- *  Else issues a SIGBUS, which generally causes a core dump.
- *       If the user bypasses the core dump and this routine continues,
- *       a size of zero will be returned.
+/* sizecheck: this function checks a chunk, at the arena's check level {{{2
+ *   US_CHECKCHEAP: the header's check byte agrees with the chunk's offset
+ *                  and size (catches overwritten headers and pointers
+ *                  that aren't usmalloc()'s, without touching the trailer)
+ *   US_CHECKFULL : also, a free chunk's trailing size agrees with its leading
+ *                  size; an inuse chunk's next neighbor has an intact header
+ *                  that doesn't call the chunk free (catches overruns)
+ *  When the chunk passes: returns size of chunk.
+ *  Else calls the corruption handler (see uscorruptfn()), which by default
+ *       raises a SIGBUS; should the handler return, a size of zero will be
+ *       returned.
  */
 static usoffset sizecheck(usoffset ichunk)
 {
@@ -351,18 +688,144 @@ usoffset sz2;
 
 
 sz1 = getsizebgn(ichunk);
-sz2 = getsizeend(ichunk,sz1);
-if(sz1 != sz2) { /* looks like memory is corrupted! */
-    int status;
-    fprintf(stderr,"(usmemuse) shared memory corruption detected concerning <%s>! (sz=%lu != endsz=%lu)\n",
-      usmemdesc(chunk2ptr(ichunk),NULL),
-      sz1,sz2);
-    kill(0,SIGBUS); /* normally should get a core dump out of this */
-    wait(&status);
-    sz1= 0;
+if(uscheck(US_CHECKCHEAP) && getcheckbyte(ichunk) != uscheckbyte(ichunk,sz1)) {
+    uscorrupt(chunk2ptr(ichunk),"bad chunk header (sz=%lu)",sz1);
+    return 0;
     }
+if(uscheck(US_CHECKFULL)) {
+    if(isfree(ichunk)) { /* free chunks end with their size */
+        sz2= getsizeend(ichunk,sz1);
+        if(sz1 != sz2) { /* looks like memory is corrupted! */
+            uscorrupt(chunk2ptr(ichunk),"sz=%lu != endsz=%lu",sz1,sz2);
+            return 0;
+            }
+        }
+    else if(ichunk + sz1 < usarena->memsize) { /* inuse chunks are followed by an intact header */
+        sz2= getsizebgn(ichunk+sz1);
+        if(getcheckbyte(ichunk+sz1) != uscheckbyte(ichunk+sz1,sz2) || isprvfree(ichunk+sz1)) {
+            uscorrupt(chunk2ptr(ichunk),"sz=%lu overran the next chunk's header",sz1);
+            return 0;
+            }
+        }
+    }
+
+return sz1;
+}
+
+/* --------------------------------------------------------------------- */
+/* uscorrupt: this function reports corruption of the chunk holding ptr {{{2
+ *   to this process' corruption handler.
+ */
+void uscorrupt(
+  void       *ptr,
+  const char *fmt,
+  ...)
+{
+char    msg[128];
+va_list args;
+
+
+va_start(args,fmt);
+vsnprintf(msg,sizeof(msg),fmt,args);
+va_end(args);
+(corruptfn? corruptfn : CorruptDefault)(usarena,ptr,msg);
+}
+
+/* --------------------------------------------------------------------- */
+/* uscorruptfn: this function sets this process' corruption handler (CONF_CORRUPTFN) {{{2
+ *   The handler is called with the arena, the user pointer of the corrupted
+ *   chunk, and a description; the arena's locks may be held.  If it returns,
+ *   the operation that found the corruption is abandoned (usfree() doesn't
+ *   free, usrealloc() returns NULL) where it can be.  NULL restores the
+ *   default handler, which reports the corruption and raises SIGBUS in this
+ *   process (normally a core dump).
+ *   Returns: the previous handler
+ */
+uscorrupt_t uscorruptfn(uscorrupt_t fn)
+{
+uscorrupt_t old= corruptfn? corruptfn : CorruptDefault;
+
+corruptfn= (fn == CorruptDefault)? NULL : fn;
+
+return old;
+}
+
+/* --------------------------------------------------------------------- */
+/* ClaimBin: this function makes sure that the lock guarding bin ibin is held {{{2
+ *  The one-size bin lock may be picked up late by a holder of USLK_BIG
+ *  (that's the lock ordering); a holder of just USLK_SMALL never touches
+ *  the multi-size bins.
+ */
+static void ClaimBin(int ibin)
+{
+if(ibin <= USMAXONESIZE && !usbinheld(USLK_SMALL)) usbinlock(usarena,USLK_SMALL);
+}
+
+/* --------------------------------------------------------------------- */
+/* CorruptDefault: this is the default corruption handler {{{2 */
+static void CorruptDefault(
+  usptr_t    *arena,
+  void       *ptr,
+  const char *msg)
+{
+fprintf(stderr,"(usmalloc) shared memory corruption detected concerning <%s>! (%s)\n",
+  ustagname(arena,usgettag(arena,ptr)),
+  msg);
+raise(SIGBUS); /* normally should get a core dump out of this */
+}
+
+/* --------------------------------------------------------------------- */
+/* CountMalloc: this function counts a successful allocation of ichunk under lock ilk {{{2
+ *  The peak is the arena-wide inuse as seen by this lock's holder; the other
+ *  lock's inuse is read without its lock, which is close enough for a peak.
+ */
+static void CountMalloc(
+  int      ilk,
+  usoffset ichunk)
+{
+USStats *stats= &usarena->stats[ilk];
+long     inuse;
 
-return sz1&(~7);
+
+stats->inuse+= (long) getsizebgn(ichunk);
+++stats->nmalloc;
+inuse= usarena->stats[USLK_BIG].inuse + usarena->stats[USLK_SMALL].inuse;
+if(inuse > (long) stats->peak) stats->peak= (unsigned long) inuse;
+}
+
+/* --------------------------------------------------------------------- */
+/* ReleaseBins: this function releases whatever bin locks are held, in reverse order {{{2 */
+static void ReleaseBins(void)
+{
+if(usbinheld(USLK_SMALL)) usbinunlock(usarena,USLK_SMALL);
+if(usbinheld(USLK_BIG))   usbinunlock(usarena,USLK_BIG);
+}
+
+/* --------------------------------------------------------------------- */
+/* FreeNeedsSmall: determines if freeing ichunk may touch the one-size bins {{{2
+ *  Holders of only USLK_SMALL never modify a multi-size chunk nor free a
+ *  sliver beside one (see SplitChunk()), and a one-size chunk remains
+ *  one-size while they work on it.  So a multi-size chunk whose
+ *  neighbors are multi-size can be freed (and merged) while holding
+ *  only USLK_BIG.  The previous neighbor matters only when it's
+ *  free (it's merged); its size is then read from its trailing size.  The
+ *  next neighbor's prvfree bit is set, so its size is always read.
+ */
+static int FreeNeedsSmall(usoffset ichunk)
+{
+usoffset nxtchunk;
+usoffset prvsz;
+
+
+if(isonesize(getsizebgn(ichunk))) return 1;
+
+prvsz= isprvfree(ichunk)? ((usoffset *)(usarena->base+ichunk))[-1] : 0;
+if(prvsz && isonesize(prvsz)) return 1;
+
+nxtchunk= getnxtneighbor(ichunk);
+if(nxtchunk && isonesize(getsizebgn(nxtchunk))) return 1;
+
+return 0;
 }
 
 /* --------------------------------------------------------------------- */
@@ -374,18 +837,26 @@ static void ExtractChunk(usoffset ichunk)
 usoffset prvchunk;
 usoffset nxtchunk;
 usoffset zero= 0;
-int      ibin= 0;
+int      ibin= ushashsize(getsizebgn(ichunk));
 
 
 
+ClaimBin(ibin);
 prvchunk = getprvchunk(ichunk);
 nxtchunk = getnxtchunk(ichunk);
+if(uscheck(US_CHECKFULL)) { /* its neighbors in the bin must link back to it */
+    if((prvchunk? getnxtchunk(prvchunk) : usarena->bin[ibin].hd) != ichunk ||
+       (nxtchunk? getprvchunk(nxtchunk) : usarena->bin[ibin].tl) != ichunk) {
+        uscorrupt(chunk2ptr(ichunk),"free chunk %lu: bin[%d] links don't lead back to it (prv=%lu nxt=%lu)",ichunk,ibin,prvchunk,nxtchunk);
+        return;
+        }
+    }
+--usarena->binqty[ibin];
 
 if(prvchunk) {
     setnxtchunk(prvchunk,nxtchunk);
     }
 else { /* ichunk must be head-of-binlist */
-    ibin                  = ushashsize(getsizebgn(ichunk));
     usarena->bin[ibin].hd = nxtchunk;
     }
 
@@ -393,9 +864,9 @@ if(nxtchunk) {
     setprvchunk(nxtchunk,prvchunk);
     }
 else { /* ichunk must be tail-of-binlist */
-    if(!ibin) ibin= ushashsize(getsizebgn(ichunk));
     usarena->bin[ibin].tl = prvchunk;
     }
+if(!prvchunk && !nxtchunk) usarena->binmap[ibin>>6]&= ~(1UL << (ibin&63)); /* the bin's now empty */
 
 setnxtchunk(ichunk,zero);
 setprvchunk(ichunk,zero);
@@ -403,12 +874,83 @@ setprvchunk(ichunk,zero);
 
 }
 
+/* --------------------------------------------------------------------- */
+/* FastChunk: this function takes a needsz chunk from its fastbin {{{2
+ *  The caller holds USLK_SMALL.  Only exact sizes are kept there, so
+ *  the chunk needs neither splitting nor any bin but its fastbin.
+ *  Returns: the (inuse) chunk, or 0 if the fastbin is empty
+ */
+static usoffset FastChunk(usoffset needsz)
+{
+int      ibin;
+usoffset ichunk;
+usoffset nxtchunk;
+
+
+ibin= ushashsize(resize(needsz));
+if(ibin >= USMAXFASTBIN || !usarena->fast->hd[ibin]) return 0;
+
+ichunk  = usarena->fast->hd[ibin];
+nxtchunk= getnxtchunk(ichunk);
+if(!sizecheck(ichunk)) return 0;
+if(uscheck(US_CHECKFULL) && nxtchunk && (nxtchunk >= usarena->memsize || (nxtchunk&0x7) || !isfast(nxtchunk))) {
+    uscorrupt(chunk2ptr(ichunk),"fast[%d] chunk %lu: its link %lu isn't a fastbin chunk (written after usfree()?)",ibin,ichunk,nxtchunk);
+    return 0;
+    }
+usarena->fast->hd[ibin]= nxtchunk;
+usarena->fast->bytes  -= getsizebgn(ichunk);
+clrfast(ichunk);
+
+return ichunk;
+}
+
+/* --------------------------------------------------------------------- */
+/* FastMerge: this function consolidates the fastbins {{{2
+ *  Their chunks are freed for real, merging with their free neighbors
+ *  (and one another).  The caller holds USLK_BIG and USLK_SMALL.
+ */
+static void FastMerge(void)
+{
+int      ibin;
+usoffset ichunk;
+
+
+for(ibin= 0; ibin < USMAXFASTBIN; ++ibin) {
+    while((ichunk= usarena->fast->hd[ibin])) {
+        usarena->fast->hd[ibin]= getnxtchunk(ichunk);
+        clrfast(ichunk);
+        setfree(ichunk);
+        MergeFreeChunk(ichunk);
+        }
+    }
+usarena->fast->bytes= 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* FastPark: this function parks inuse chunk ichunk in its fastbin {{{2
+ *  The caller holds USLK_SMALL, and has checked that it fits (CONF_FASTMAX,
+ *  USFASTBYTES).
+ */
+static void FastPark(usoffset ichunk)
+{
+int ibin= ushashsize(getsizebgn(ichunk));
+
+
+setfast(ichunk);
+setnxtchunk(ichunk,usarena->fast->hd[ibin]);
+usarena->fast->hd[ibin]= ichunk;
+usarena->fast->bytes  += getsizebgn(ichunk);
+}
+
 /* --------------------------------------------------------------------- */
 /* FindChunk: this function finds a suitable free chunk for conversion {{{2
  *            into a inuse chunk.  Splits the chunk, assuming it finds
- *            a suitable free chunk.
+ *            a suitable free chunk.  Only bins [needszhash,maxbin] are
+ *            searched; the caller must hold the lock(s) for that range.
  */
-static usoffset FindChunk(usoffset needsz)
+static usoffset FindChunk(
+  usoffset needsz,
+  int      maxbin)
 {
 int      ibin;
 int      needszhash;
@@ -418,9 +960,14 @@ usoffset ichunk     = 0;
 
 needsz     = resize(needsz);
 needszhash = ushashsize(needsz);
+if(needszhash <= USMAXONESIZE) ClaimBin(needszhash);
+if(maxbin == USMAXFREEBIN-1 && __atomic_load_n(&usarena->remote->hd,__ATOMIC_RELAXED)) { /* free what's been queued (needs USLK_BIG) */
+    RemoteDrain();
+    if(needszhash < USMAXFASTBIN && (ichunk= FastChunk(needsz))) return ichunk;
+    }
 
 /* look for a non-empty free space bin >= needszhash */
-for(ibin= needszhash; ibin < USMAXFREEBIN; ++ibin) if(usarena->bin[ibin].hd) break;
+ibin= NextBin(needszhash,maxbin);
 
 /* If ibin == needszhash, then since the bins hold multiple sizes,
  * there still may not be a free chunk with needsz bytes.
@@ -434,20 +981,23 @@ if(ibin == needszhash) {
         /* looks like the tail of the bin has a free chunk exactly of the size
          * needed to accomodate the request.
          */
+        usprobe3(findchunk,needsz,ibin,usarena->bin[ibin].tl);
         ichunk= SplitChunk(usarena->bin[ibin].tl,needsz);
         return ichunk;
         }
     else if(needsz > fsz) {
-        for(++ibin; ibin < USMAXFREEBIN; ++ibin) if(usarena->bin[ibin].hd) break;
+        ibin= NextBin(ibin+1,maxbin);
         }
     }
 
-if(ibin >= USMAXFREEBIN) { /* whoops! unable to find a free chunk big enough to handle needsz */
-    /* if this was normal memory, this place is where one
-     * would test a "wilderness" chunk and then attempt to
-     * sbrk more as needed
-     */
-    ichunk= 0;
+usprobe3(findchunk,needsz,ibin,(ibin > maxbin)? 0UL : usarena->bin[ibin].hd);
+if(ibin > maxbin) { /* no binned chunk is big enough: carve the top chunk (needs USLK_BIG) */
+    ichunk= (maxbin == USMAXFREEBIN-1)? TopChunk(needsz) : 0;
+    if(!ichunk && maxbin == USMAXFREEBIN-1 && usarena->fast->bytes) { /* merge the fastbins' chunks and look again */
+        ClaimBin(0);
+        FastMerge();
+        return FindChunk(needsz,maxbin);
+        }
     }
 else if(ibin <= USMAXONESIZE) { /* single-size bin */
     ichunk= SplitChunk(usarena->bin[ibin].hd,needsz);
@@ -497,22 +1047,23 @@ return ichunk;
  */
 static void InsertFreeChunk(usoffset ichunk)
 {
-int          ibin;
-usoffset     isz;
-usoffset     zero      = 0;
-
+int           ibin;
+usoffset      isz;
+usoffset      zero      = 0;
+unsigned long t0        = uslatbgn(usarena);
 
-(void)sizecheck(ichunk);
 
 setfree(ichunk);
 isz = getsizebgn(ichunk);
 ibin= ushashsize(isz);
+ClaimBin(ibin);
+++usarena->binqty[ibin];
 
 if(usarena->bin[ibin].hd == 0) { /* the first chunk for this bin */
     setnxtchunk(ichunk,zero);
     setprvchunk(ichunk,zero);
-    (void)sizecheck(ichunk);
     usarena->bin[ibin].hd= usarena->bin[ibin].tl= ichunk;
+    usarena->binmap[ibin>>6]|= 1UL << (ibin&63);
     }
 
 else {
@@ -585,7 +1136,7 @@ else {
             }
         }
     }
-
+uslatend(usarena,US_LATINSERT,t0);
 
 }
 
@@ -593,6 +1144,8 @@ else {
 /* MergeFreeChunk: this function merges a chunk with either or both of {{{2
  * its neighbors (if they are already free chunks).  Does not
  * extract ichunk; assumes its already been extracted!
+ * Once the top chunk has been used up, the next free chunk to end the
+ * heap becomes the top chunk.
  */
 static void MergeFreeChunk(usoffset ichunk)
 {
@@ -602,6 +1155,9 @@ usoffset isz;
 usoffset newsz;
 usoffset nxtsz;
 usoffset prvsz;
+usoffset bgn;
+usoffset end;
+usoffset zero= 0;
 
 
 
@@ -609,6 +1165,8 @@ usoffset prvsz;
 if(!isfree(ichunk)) {
     return;
     }
+bgn= ichunk;                     /* the memory being freed */
+end= ichunk + getsizebgn(ichunk);
 
 /* these two don't refer to the binlist links, but to neighbors */
 prvchunk= getprvneighbor(ichunk);
@@ -620,22 +1178,114 @@ if(prvchunk && isfree(prvchunk)) { /* merge prvchunk,ichunk */
     ExtractChunk(prvchunk);
     newsz   = isz + prvsz;
     setsize(prvchunk,newsz);
+    if(usarena->verify->cursor == ichunk) usarena->verify->cursor= prvchunk; /* keep usverifystep() on a chunk */
     ichunk  = prvchunk;
     }
 
 if(nxtchunk && isfree(nxtchunk)) { /* merge ichunk,nxtchunk */
     isz   = getsizebgn(ichunk);
     nxtsz = getsizebgn(nxtchunk);
-    ExtractChunk(nxtchunk);
+    if(nxtchunk == usarena->top->chunk) usarena->top->chunk= ichunk; /* the top chunk grows down */
+    else                                ExtractChunk(nxtchunk);
     newsz = isz + nxtsz;
     setsize(ichunk,newsz);
+    setfree(ichunk);
+    if(usarena->verify->cursor == nxtchunk) usarena->verify->cursor= ichunk;
     }
 
-/* insert free chunk into binlists */
-InsertFreeChunk(ichunk);
+/* a free chunk ending the heap becomes the top chunk, if there's none (see TopChunk()) */
+if(!usarena->top->chunk && ichunk + getsizebgn(ichunk) == usarena->memsize) {
+    usarena->top->chunk= ichunk;
+    setnxtchunk(ichunk,zero);
+    setprvchunk(ichunk,zero);
+    }
+
+/* a big enough free chunk gives its pages back to the operating system */
+if(*usarena->trim && getsizebgn(ichunk) > *usarena->trim) TrimChunk(ichunk,*usarena->trim,bgn,end);
+
+/* insert free chunk into binlists (the top chunk stays out of them) */
+usprobe2(merge,ichunk,getsizebgn(ichunk));
+if(ichunk != usarena->top->chunk) InsertFreeChunk(ichunk);
 
 }
 
+/* --------------------------------------------------------------------- */
+/* NextBin: this function returns the first non-empty bin in [ibin,maxbin] {{{2
+ *  The bins' bitmap is searched a word (64 bins) at a time.  Its first
+ *  word covers just the one-size bins, so a holder of only USLK_SMALL
+ *  (maxbin == USMAXONESIZE) reads no more than it.
+ *  Returns: the bin, or maxbin+1 if they're all empty
+ */
+static int NextBin(
+  int ibin,
+  int maxbin)
+{
+int           iword;
+unsigned long bits;
+
+
+if(ibin > maxbin) return maxbin + 1;
+iword= ibin>>6;
+bits = usarena->binmap[iword] & (~0UL << (ibin&63));
+while(!bits) {
+    if(++iword > (maxbin>>6)) return maxbin + 1;
+    bits= usarena->binmap[iword];
+    }
+ibin= (iword<<6) + __builtin_ctzl(bits);
+
+return (ibin <= maxbin)? ibin : maxbin + 1;
+}
+
+/* --------------------------------------------------------------------- */
+/* RemoteDrain: this function frees the chunks usfree() has queued (CONF_REMOTEFREE) {{{2
+ *  The whole queue is taken with one exchange; usfree()s go on pushing
+ *  onto a fresh one meanwhile.  Small chunks are parked in their fastbins,
+ *  as usfree() would have, and the rest merged.  The caller holds
+ *  USLK_BIG; the one-size bin lock is picked up.
+ */
+static void RemoteDrain(void)
+{
+usoffset ichunk;
+usoffset nxtchunk;
+usoffset isz;
+
+
+ClaimBin(0);
+for(ichunk= __atomic_exchange_n(&usarena->remote->hd,0,__ATOMIC_ACQUIRE); ichunk; ichunk= nxtchunk) {
+    nxtchunk= getnxtchunk(ichunk);
+    isz     = getsizebgn(ichunk);
+    clrqueued(ichunk);
+    usarena->stats[USLK_BIG].inuse-= (long) isz;
+    ++usarena->stats[USLK_BIG].nfree;
+    if(isz - sizeof(usoffset) <= usarena->fast->max && usarena->fast->bytes + isz <= USFASTBYTES) FastPark(ichunk);
+    else {
+        setfree(ichunk);
+        MergeFreeChunk(ichunk);
+        }
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* RemoteMark: this function marks inuse chunk ichunk queued, atomically {{{2
+ *  The check for fast or queued and the marking are one compare-and-swap,
+ *  so of two usfree()s of the same chunk racing to queue it, only one
+ *  sees it unmarked.  (A fetch-or of the queued bits would do for that,
+ *  but would briefly make a fast chunk look queued to a lock holder.)
+ *  Returns: the header as it was; if its fast bit (0x4) was set, the chunk
+ *           was fast or queued already and has been left alone.
+ */
+static usoffset RemoteMark(usoffset ichunk)
+{
+usoffset hdr= __atomic_load_n(&ushdr(ichunk),__ATOMIC_RELAXED);
+
+
+do {
+    if(hdr&0x4) break;
+    } while(!__atomic_compare_exchange_n(&ushdr(ichunk),&hdr,hdr|0x6,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED));
+
+return hdr;
+}
+
 /* --------------------------------------------------------------------- */
 /* SplitChunk: this function splits a chunk into sz and original_size-sz {{{2
  * byte chunks.  The original_size-sz chunk is placed back into the free
@@ -649,7 +1299,7 @@ InsertFreeChunk(ichunk);
  *
  *  free chunk : size/status=free             inuse chunk:  size/status=inuse
  *               index to next chunk in bin                 ..user space..
- *               index to prev chunk in bin                 size
+ *               index to prev chunk in bin
  *               ..unused space..
  *               size
  */
@@ -657,6 +1307,7 @@ static usoffset SplitChunk(
   usoffset ichunk,  /* this chunk will be split                        */
   usoffset needsz)  /* this is the needed size of the to-be-used chunk */
 {
+int      nxtbig;     /* next-neighbor chunk is multi-size            */
 int      nxtfree;    /* free/inuse status of next-neighbor chunk     */
 int      prvfree;    /* free/inuse status of previous-neighbor chunk */
 usoffset fchunk;     /* new free chunk                               */
@@ -670,6 +1321,7 @@ usoffset prvsz;      /* size of previous-neighbor chunk              */
 
 sizecheck(ichunk);
 isz= getsizebgn(ichunk); /* size of to-be-split chunk */
+usprobe3(split,ichunk,isz,needsz);
 ExtractChunk(ichunk);
 
 /* Of course, if isz==needsz, no splitting needed, just use ichunk.
@@ -685,16 +1337,29 @@ else if(isz > needsz) {
     prvchunk = getprvneighbor(ichunk);
     prvfree  = prvchunk? isfree(prvchunk) : 0;
     nxtfree  = nxtchunk? isfree(nxtchunk) : 0;
+    nxtbig   = nxtchunk? !isonesize(getsizebgn(nxtchunk)) : 0;
 
-    if(!prvfree && !nxtfree) {
-        /* insert free space sliver into binlists */
+    if(!prvfree && !nxtfree && (!nxtbig || usbinheld(USLK_BIG))) {
+        /* insert free space sliver into binlists (if it is a one-size sliver,
+         * InsertFreeChunk() picks up the one-size bin lock)
+         */
         fchunk= ichunk + needsz;
-        setsize(fchunk,fsz);
+        initsize(fchunk,fsz);
         setfree(fchunk);
         setsize(ichunk,needsz);
         setinuse(ichunk);
         InsertFreeChunk(fchunk);
         }
+    else if(!usbinheld(USLK_BIG)) {
+        /* free chunks don't normally neighbor free chunks; but if they do,
+         * merging may reach into the multi-size bins, which a holder of
+         * just the one-size bin lock may not touch.  Nor may it leave a
+         * free sliver beside a multi-size chunk: a holder of just USLK_BIG
+         * may be freeing that one, and neither would merge with the other.
+         * Don't split.
+         */
+        setinuse(ichunk);
+        }
     else {
         nxtsz = getsizebgn(nxtchunk);
         prvsz = getsizebgn(prvchunk);
@@ -702,14 +1367,16 @@ else if(isz > needsz) {
             /* merge free space sliver with prvfree */
             fchunk  = ichunk;
             ichunk += fsz;
+            setsize(fchunk,fsz);
+            initsize(ichunk,needsz);
             }
         else {
             /* merge free space sliver with nxtfree */
             fchunk= ichunk + needsz;
+            initsize(fchunk,fsz);
+            setsize(ichunk,needsz);
             }
-        setsize(fchunk,fsz);
         setfree(fchunk);
-        setsize(ichunk,needsz);
         setinuse(ichunk);
         InsertFreeChunk(fchunk);
         MergeFreeChunk(fchunk);
@@ -720,12 +1387,196 @@ else fprintf(stderr,"(SplitChunk) requested %lu bytes from a chunk having only %
 return ichunk;
 }
 
+/* --------------------------------------------------------------------- */
+/* TopChunk: this function carves a needsz chunk off the bottom of the top chunk {{{2
+ *  The top chunk is the free chunk ending the heap.  It's kept out of the
+ *  bins, so it's carved only when no binned chunk fits; the heap is thus
+ *  used from its bottom up, and long-lived chunks stay densely packed
+ *  rather than scattered over the whole arena.  Chunks freed next to it
+ *  merge back into it.  The caller holds USLK_BIG.
+ *  Carving the whole top chunk leaves none, until a freed chunk ends the
+ *  heap (see MergeFreeChunk()).
+ *
+ *  The arena's file starts out as a hole, and the top chunk's memory at
+ *  and above top->zero (but for its trailing size) has never been
+ *  written, or has been punched out again (see TrimChunk()); it reads
+ *  zero.  Carving past that mark raises it.  dirtyqty is left with the
+ *  qty of the chunk's leading bytes below the mark: all uscalloc() needs
+ *  to clear.  A top chunk made of a freed chunk has no memory marked zero.
+ *  Returns: the (inuse) chunk, or 0 if the top chunk can't supply it
+ */
+static usoffset TopChunk(usoffset needsz)
+{
+usoffset ichunk= usarena->top->chunk;
+usoffset isz;
+usoffset zero  = 0;
+
+
+if(!ichunk) return 0;
+isz= getsizebgn(ichunk);
+if(isz < needsz) return 0;
+if(isz <= needsz + MINCHUNKSIZE) needsz= isz; /* leave no sliver of a top chunk */
+if(TopCommit(ichunk + needsz + 3*sizeof(usoffset))) return 0;
+
+dirtyqty= (usarena->top->zero > ichunk + sizeof(usoffset))? (size_t) (usarena->top->zero - ichunk - sizeof(usoffset)) : 0;
+if(needsz < isz) { /* the top chunk shrinks up */
+    usarena->top->chunk= ichunk + needsz;
+    initsize(ichunk + needsz,isz - needsz);
+    setfree(ichunk + needsz);
+    setnxtchunk(ichunk + needsz,zero);
+    setprvchunk(ichunk + needsz,zero);
+    if(usarena->top->zero < ichunk + needsz + sizeof(usoffset)) usarena->top->zero= ichunk + needsz + sizeof(usoffset);
+    }
+else {
+    usarena->top->chunk= 0;
+    usarena->top->zero = usarena->memsize;
+    ((usoffset *)(usarena->base+ichunk+isz))[-1]= 0; /* its trailing size, now user memory */
+    }
+setsize(ichunk,needsz);
+setinuse(ichunk);
+
+return ichunk;
+}
+
+/* --------------------------------------------------------------------- */
+/* TopCommit: this function commits the top chunk's memory below end {{{2
+ *  The arena's file is sparse: its pages take memory only once touched,
+ *  so the arena's footprint grows as the top chunk is carved.  Small
+ *  chunks are carved one after another and soon touched, so their pages
+ *  are committed USTOPCOMMIT bytes at a time, with MADV_POPULATE_WRITE:
+ *  one system call rather than a page fault per page, and a full file
+ *  system fails the allocation rather than raising SIGBUS later on.  A
+ *  chunk reaching further than that is left to be committed page by page
+ *  as it's touched, as are all chunks without MADV_POPULATE_WRITE.
+ *  Trimming the top chunk lowers the commit mark again (see TrimChunk()).
+ *  Returns: 0=success  -1=failure
+ */
+static int TopCommit(usoffset end)
+{
+unsigned long lo;
+unsigned long hi;
+
+
+if(end <= usarena->top->commit) return 0;
+if(end - usarena->top->commit > USTOPCOMMIT) { /* a big chunk */
+    usarena->top->commit= end;
+    return 0;
+    }
+
+#ifdef MADV_POPULATE_WRITE
+if(!pagesize) pagesize= (unsigned long) sysconf(_SC_PAGESIZE);
+lo= ((unsigned long) (usarena->base + usarena->top->commit))&~(pagesize - 1);
+hi= ((unsigned long) (usarena->base + usarena->top->commit + USTOPCOMMIT) + pagesize - 1)&~(pagesize - 1);
+if(hi > (unsigned long) (usarena->base + usarena->memsize)) hi= ((unsigned long) (usarena->base + usarena->memsize) + pagesize - 1)&~(pagesize - 1);
+if(madvise((void *) lo,(size_t) (hi - lo),MADV_POPULATE_WRITE)) {
+    if(errno != EINVAL) return -1;    /* no memory for it            */
+    usarena->top->commit= usarena->memsize; /* not supported: leave it to the page faults */
+    return 0;
+    }
+usarena->top->commit= (usoffset) (hi - (unsigned long) usarena->base);
+#else
+usarena->top->commit= usarena->memsize;
+#endif
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* TrimChunk: this function releases the pages of free chunk ichunk that [bgn,end) touches {{{2
+ *  Only whole pages past the chunk's first keep bytes (and its header,
+ *  with the bin links) and before its trailing size are released, so the
+ *  boundary tags stay intact.  They're punched out of the arena's file
+ *  with MADV_REMOVE (as fallocate(FALLOC_FL_PUNCH_HOLE) would), so every
+ *  process mapping the arena loses them; they read back as zeros and
+ *  take memory again once touched.  [bgn,end) is widened by the boundary
+ *  tags next to it, which may just have been merged into the chunk.  If
+ *  the arena's file system can't punch holes, trimming is turned off.
+ *  Returns: qty of bytes released
+ */
+static usoffset TrimChunk(
+  usoffset ichunk,  /* free chunk                                  */
+  usoffset keep,    /* qty of its leading bytes to leave resident  */
+  usoffset bgn,     /* memory just freed into it: [bgn,end)        */
+  usoffset end)
+{
+unsigned long lo;
+unsigned long hi;
+unsigned long klo;
+unsigned long khi;
+
+
+if(!pagesize) pagesize= (unsigned long) sysconf(_SC_PAGESIZE);
+if(keep < 3*sizeof(usoffset)) keep= 3*sizeof(usoffset);
+if(keep >= getsizebgn(ichunk)) return 0;
+
+lo = ((unsigned long) (usarena->base + bgn - sizeof(usoffset)))&~(pagesize - 1);
+hi = ((unsigned long) (usarena->base + end + 3*sizeof(usoffset)) + pagesize - 1)&~(pagesize - 1);
+klo= ((unsigned long) (usarena->base + ichunk + keep) + pagesize - 1)&~(pagesize - 1);
+khi= ((unsigned long) (usarena->base + ichunk + getsizebgn(ichunk) - sizeof(usoffset)))&~(pagesize - 1);
+if(lo < klo) lo= klo;
+if(hi > khi) hi= khi;
+if(lo >= hi) return 0;
+
+if(madvise((void *) lo,(size_t) (hi - lo),MADV_REMOVE)) {
+    if(errno == EINVAL || errno == EOPNOTSUPP) *usarena->trim= 0;
+    return 0;
+    }
+if(ichunk == usarena->top->chunk) {
+    if((usoffset) (lo - (unsigned long) usarena->base) < usarena->top->commit) {
+        usarena->top->commit= (usoffset) (lo - (unsigned long) usarena->base); /* to be committed again as it's carved */
+        }
+    if((usoffset) (lo - (unsigned long) usarena->base) < usarena->top->zero &&
+       (usoffset) (hi - (unsigned long) usarena->base) >= usarena->top->zero) {
+        usarena->top->zero= (usoffset) (lo - (unsigned long) usarena->base); /* it reads zero from lo on */
+        }
+    }
+
+return (usoffset) (hi - lo);
+}
+
+/* --------------------------------------------------------------------- */
+/* ZeroFill: this function clears n bytes of memory at p {{{2
+ *  A multi-megabyte uscalloc() cleared with memset() would push
+ *  everything else out of the caches, for memory that mostly won't be
+ *  touched again soon.  So USZEROSTREAM bytes and up are cleared with
+ *  non-temporal stores, which go around the caches, where available.
+ */
+static void ZeroFill(
+  void   *p,
+  size_t  n)
+{
+#ifdef __SSE2__
+unsigned char *c= (unsigned char *) p;
+size_t         lead;
+__m128i        zero;
+
+
+if(n >= USZEROSTREAM) {
+    lead= (size_t) ((16 - ((unsigned long) c & 15)) & 15); /* the stores must be 16-byte aligned */
+    memset(c,0,lead);
+    c   += lead;
+    n   -= lead;
+    zero = _mm_setzero_si128();
+    for(; n >= 64; c+= 64, n-= 64) {
+        _mm_stream_si128((__m128i *) (c     ),zero);
+        _mm_stream_si128((__m128i *) (c + 16),zero);
+        _mm_stream_si128((__m128i *) (c + 32),zero);
+        _mm_stream_si128((__m128i *) (c + 48),zero);
+        }
+    _mm_sfence(); /* order them before the caller's stores */
+    p= c;
+    }
+#endif
+memset(p,0,n);
+}
+
 /* --------------------------------------------------------------------- */
 /* usmemuse: this function displays memory usage {{{2
  *   mode & 1 : print out free memory bins
  *   mode & 2 : print out all shared memory
  *   mode & 4 : only use debugging output
  *   mode & 8 : print out total bytes used
+ *   mode &16 : print out bytes used per tag (see ustag())
  */
 void usmemuse(
   USArena *arena,
@@ -790,6 +1641,22 @@ if(mode & 1) {
                 }
             }
         }
+    for(ibin= 0; ibin < USMAXFASTBIN; ++ibin) {
+        for(ichunk= arena->fast->hd[ibin]; ichunk; ichunk= getnxtchunk(ichunk)) {
+            sz= getsizebgn(ichunk);
+            if(!(mode & 4)) printf("   %10lu: fast[%2d]                                   sz=%10lu\n",ichunk,ibin,sz);
+#ifdef USMEMUSEDBG
+            dprintf(1,"   %10lu: fast[%2d]                                   sz=%10lu\n",ichunk,ibin,sz);
+#endif
+            }
+        }
+    if(arena->top->chunk) {
+        sz= getsizebgn(arena->top->chunk);
+        if(!(mode & 4)) printf("   %10lu: top                                        sz=%10lu committed to %lu\n",arena->top->chunk,sz,arena->top->commit);
+#ifdef USMEMUSEDBG
+        dprintf(1,"   %10lu: top                                        sz=%10lu committed to %lu\n",arena->top->chunk,sz,arena->top->commit);
+#endif
+        }
 #ifdef USMEMUSEDBG
     dprintf(1,"}\n");
 #endif
@@ -837,18 +1704,19 @@ if(mode & 2) {
                 }
             }
         else {
-            sz    = getsizebgn(ichunk);
-            endsz = getsizeend(ichunk,sz);
-            if(!(mode & 4)) printf(" inuse %10lu: sz=%10lu endsz=%10lu: %s\n",
+            sz    = getsizebgn(ichunk);          /* inuse chunks have no trailing size */
+            if(!(mode & 4)) printf(" %s %10lu: sz=%10lu prvfree=%d: %s\n",
+              isqueued(ichunk)? "queue" : isfast(ichunk)? "fast " : "inuse",
               ichunk,
               sz,
-              endsz,
+              isprvfree(ichunk),
               usmemdesc(chunk2ptr(ichunk),NULL));
 #ifdef USMEMUSEDBG
-            dprintf(1," inuse %10lu: sz=%10lu endsz=%10lu %s\n",
+            dprintf(1," %s %10lu: sz=%10lu prvfree=%d %s\n",
+              isqueued(ichunk)? "queue" : isfast(ichunk)? "fast " : "inuse",
               ichunk,
               sz,
-              endsz,
+              isprvfree(ichunk),
               usmemdesc(chunk2ptr(ichunk),NULL));
 #endif
             /* sanity check */
@@ -865,125 +1733,162 @@ if(mode & 2) {
 #endif
     }
 
-if(mode & 8) { /* print out total bytes in use */
-    unsigned long totfree= 0L;
-    unsigned long inuse  = 0L;
-    /* this is done by taking the total allocated for shared memory use
-     * and subtracting all free chunk sizes
-     */
-    if(!arena) inuse= 0;
-    else {
-        inuse= arena->memsize;
-        for(ibin= 0; ibin < USMAXFREEBIN; ++ibin) {
-            for(ichunk= arena->bin[ibin].hd; ichunk; ichunk= nxt) {
-                nxt   = getnxtchunk(ichunk);
-                prv   = getprvchunk(ichunk);
-                sz    = getsizebgn(ichunk);
-                endsz = getsizeend(ichunk,sz);
-                totfree+= sz;
-                }
-            }
-        inuse-= totfree;
-        if(!(mode & 4)) printf("Totals:  inuse=%ld bytes   free=%ld bytes\n",inuse,totfree); 
+if(mode & 8) { /* print out total bytes in use (from the usmallinfo() counters) */
+    struct usmallinfo info;
+    usmallinfo(arena,&info);
+    if(!(mode & 4)) printf("Totals:  inuse=%ld bytes   free=%ld bytes\n",(long) info.inuse,(long) info.free); 
+#ifdef USMEMUSEDBG
+    dprintf(1,"Totals:  inuse=%ld bytes   free=%ld bytes\n",(long) info.inuse,(long) info.free); 
+#endif
+    }
+
+if(mode & 16) { /* print out bytes in use per tag */
+    int itag;
+    for(itag= 1; itag < (int) arena->tags->qty; ++itag) {
+        if(!(mode & 4)) printf("Tag %-*s inuse=%ld bytes\n",USTAGNAMELEN,arena->tags->name[itag],arena->tags->bytes[itag]);
 #ifdef USMEMUSEDBG
-        dprintf(1,"Totals:  inuse=%ld bytes   free=%ld bytes\n",inuse,totfree); 
+        dprintf(1,"Tag %-*s inuse=%ld bytes\n",USTAGNAMELEN,arena->tags->name[itag],arena->tags->bytes[itag]);
 #endif
         }
     }
 }
 
 /* --------------------------------------------------------------------- */
+/* ustag: this function interns a tag name, returning its tag {{{2
+ *   Tags are kept in the arena, so every process (and usstat) sees the
+ *   same names; an existing name is found without locking the arena.
+ *   Names longer than USTAGNAMELEN-1 are truncated.
+ *   Returns: tag in [1,USMAXTAGS-1], or 0 if the name is null or the table is full
+ */
+int ustag(
+  usptr_t    *arena,
+  const char *name)
+{
+unsigned itag;
+unsigned qty;
+USTags  *tags;
+
+
+if(!arena || !arena->tags || !name || !*name) {
+    return 0;
+    }
+tags= arena->tags;
+
+qty= __atomic_load_n(&tags->qty,__ATOMIC_ACQUIRE);
+for(itag= 1; itag < qty; ++itag) if(!strncmp(tags->name[itag],name,USTAGNAMELEN-1)) return (int) itag;
+
+usarenalock(arena);
+for(itag= 1; itag < tags->qty; ++itag) if(!strncmp(tags->name[itag],name,USTAGNAMELEN-1)) break;
+if(itag == tags->qty) { /* a new tag */
+    if(itag < USMAXTAGS) {
+        strncpy(tags->name[itag],name,USTAGNAMELEN-1);
+        tags->name[itag][USTAGNAMELEN-1]= '\0';
+        __atomic_store_n(&tags->qty,itag+1,__ATOMIC_RELEASE);
+        }
+    else itag= 0;
+    }
+usarenaunlock(arena);
+
+return (int) itag;
+}
+
+/* --------------------------------------------------------------------- */
+/* ustagname: this function returns the name of a tag ("" if untagged or unknown) {{{2 */
+const char *ustagname(
+  usptr_t *arena,
+  int      tag)
+{
+if(!arena || !arena->tags || tag <= 0 || (unsigned) tag >= arena->tags->qty) {
+    return "";
+    }
+
+return arena->tags->name[tag];
+}
 
 /* --------------------------------------------------------------------- */
-#define USMEMDESCSIZ    1000
-typedef struct UsMemDesc_str     UsMemDesc;
+/* ussettag: this function tags an inuse chunk (tag 0 removes its tag) {{{2
+ *   The tag lives in the top byte of the chunk's size word, so tagging
+ *   costs no memory and no lock; usfree() drops the tag.  The bytes held
+ *   per tag are kept in the arena (see usmemuse() and usstat).
+ *   Returns: 0=success  -1=failure
+ */
+int ussettag(
+  usptr_t *arena,
+  void    *ptr,
+  int      tag)
+{
+int      oldtag;
+usoffset ichunk;
+usoffset sz;
+
 
-struct UsMemDesc_str {
-    usoffset   chunk;
-    char      *desc;
-    UsMemDesc *nxt;
-    UsMemDesc *prv;
-    };
-static UsMemDesc *usmemdeschd[USMEMDESCSIZ];
-static UsMemDesc *usmemdesctl[USMEMDESCSIZ];
+if(!arena || !arena->tags || !ptr || tag < 0 || tag >= USMAXTAGS) {
+    return -1;
+    }
+
+usarena= arena;
+ichunk = ptr2chunk(ptr);
+if(isfree(ichunk)) {
+    return -1;
+    }
+sz    = getsizebgn(ichunk);
+oldtag= gettag(ichunk);
+if(oldtag != tag) {
+    if(oldtag) __atomic_fetch_sub(&arena->tags->bytes[oldtag],(long) sz,__ATOMIC_RELAXED);
+    if(tag)    __atomic_fetch_add(&arena->tags->bytes[tag],(long) sz,__ATOMIC_RELAXED);
+    settag(ichunk,tag);
+    }
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* usgettag: this function returns an inuse chunk's tag (0: untagged) {{{2 */
+int usgettag(
+  usptr_t *arena,
+  void    *ptr)
+{
+if(!arena || !ptr) {
+    return 0;
+    }
+usarena= arena;
+
+return isfree(ptr2chunk(ptr))? 0 : gettag(ptr2chunk(ptr));
+}
 
 /* --------------------------------------------------------------------- */
 /* usmemdesc: this function helps usmemuse() be more explanatory {{{2
  *   Usage:  immediately after doing a usmalloc, etc, do a usmemdesc(ptr,"description")
  *           The usmemuse() function will use usmemdesc(ptr,NULL) to look up the description
+ *   The description is interned as a tag (see ustag()) of the arena last
+ *   used by this process, and is visible to all processes.
  */
 char *usmemdesc(
   void *ptr, 
   char *desc)
 {
-static int  first  = 1;
-UsMemDesc  *usdesc = NULL;
-usoffset    chunk;
-usoffset    hash;
-
-if(first) {
-    memset(usmemdeschd,0,USMEMDESCSIZ*sizeof(UsMemDesc *));
-    memset(usmemdesctl,0,USMEMDESCSIZ*sizeof(UsMemDesc *));
-    first= 0;
-    }
-
 /* avoid problems with null pointers */
 if(!ptr) {
     return "null ptr";
     }
 
-/* compute hash of pointer */
-chunk = ptr2chunk(ptr);
-hash  = chunk % USMEMDESCSIZ;
-for(usdesc= usmemdeschd[hash]; usdesc; usdesc= usdesc->nxt) if(usdesc->chunk == chunk) break;
-
-if(desc) { /* enter description into hash */
-/*    printf("(usmemdesc) ptr=%px chunk#%9lu hash=%4lu desc<%s>\n",ptr,ptr2chunk(ptr),hash,sprt(desc));*/
-    if(usdesc) { /* re-use memory */
-        if(usdesc->desc) free(usdesc->desc);
-        usdesc->desc  = NULL;
-        usdesc->chunk = 0;
-        }
-    else { /* new memory */
-        double_link(UsMemDesc,usmemdeschd[hash],usmemdesctl[hash],"enter usmemdesc");
-        usdesc= usmemdesctl[hash];
-        }
-    stralloc(usdesc->desc,desc,"usmemdesc desc");
-    usdesc->chunk= chunk;
+if(desc) { /* tag the chunk with the description */
+    ussettag(usarena,ptr,ustag(usarena,desc));
     }
 else { /* look up description */
-    desc= usdesc? usdesc->desc : "";
+    desc= (char *) ustagname(usarena,usgettag(usarena,ptr));
     }
 
 return desc;
 }
 
 /* --------------------------------------------------------------------- */
-/* usmemdescfree: this function {{{2 */
+/* usmemdescfree: this function removes a chunk's description {{{2
+ *   usfree() does this itself; there's no need to call it any more.
+ */
 void usmemdescfree(void *ptr)
 {
-usoffset   hash;
-usoffset   chunk;
-UsMemDesc *usdesc;
-
-
-/* avoid problems with null pointers */
-if(!ptr) {
-    return;
-    }
-
-/* compute hash of pointer */
-chunk = ptr2chunk(ptr);
-hash  = chunk % USMEMDESCSIZ;
-
-/* locate pointer in hash table and free it */
-for(usdesc= usmemdeschd[hash]; usdesc; usdesc= usdesc->nxt) if(usdesc->chunk == chunk) {
-    if(usdesc->desc) free(usdesc->desc);
-    usdesc->desc= NULL;
-    delete_double_link(UsMemDesc,usdesc,usmemdeschd[hash],usmemdesctl[hash]);
-    break;
-    }
-
+if(ptr) ussettag(usarena,ptr,0);
 }
 
 /* =====================================================================
@@ -0,0 +1,51 @@
+/* usprobe.h: statically defined tracepoints (USDT) for the usarena library
+ *   Author:	Charles E. Campbell, Jr.
+ *   Date:	Oct 18, 2026
+ *
+ *   The probes (provider "usarena") are compiled in when <sys/sdt.h>
+ *   (systemtap-sdt-dev) is available, unless USNOPROBES is defined (see
+ *   Src/Makefile).  Each is a single nop until perf, bpftrace, or the like
+ *   attaches to it; see Doc/usprobes and the bpftrace scripts in Util.
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{1
+ */
+#ifndef __USPROBE_H__
+# define __USPROBE_H__
+# if !defined(USNOPROBES) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#   include <sys/sdt.h>
+#   define USPROBES
+#  endif
+# endif
+
+/* ------------------------------------------------------------------------
+ * Definitions: {{{1
+ */
+# ifdef USPROBES
+#  define usprobe1(name,a)            DTRACE_PROBE1(usarena,name,a)
+#  define usprobe2(name,a,b)          DTRACE_PROBE2(usarena,name,a,b)
+#  define usprobe3(name,a,b,c)        DTRACE_PROBE3(usarena,name,a,b,c)
+# else
+#  define usprobe1(name,a)            ((void) 0)
+#  define usprobe2(name,a,b)          ((void) 0)
+#  define usprobe3(name,a,b,c)        ((void) 0)
+# endif
+
+/* uslockevent: fires the lock_contend, lock_acquire, or lock_release probe
+ * and records the event in the lock history (see ushistevent())
+ */
+# define uslockevent(hist,event,lockid,waitns) do {                            \
+    if     ((event) == US_HISTWAIT)    usprobe1(lock_contend,lockid);           \
+    else if((event) == US_HISTACQUIRE) usprobe2(lock_acquire,lockid,waitns);    \
+    else                               usprobe1(lock_release,lockid);           \
+    ushistevent(hist,event,lockid,waitns);                                      \
+    } while(0)
+
+#endif	/*  __USPROBE_H__ */
+
+/* ---------------------------------------------------------------------
+ * Modelines: {{{1
+ * vim: fdm=marker
+ */
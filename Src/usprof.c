@@ -0,0 +1,305 @@
+/* usprof.c: this program samples allocations for a heap profile
+ *   When on (CONF_PROFON), an allocation is sampled about once every
+ *   rate bytes allocated: its stack is captured with backtrace() and kept,
+ *   with the chunk's offset, in a table in the arena.  The chunk's header
+ *   is marked (issampled()), so usfree() looks for a sample only when
+ *   there is one to drop.  The table holds the live sampled chunks of
+ *   every process, and is written out (usprofdump()) in the legacy pprof
+ *   heap profile format:
+ *
+ *       heap profile: objects: bytes [objects: bytes] @ heap_v2/rate
+ *       1: size [1: size] @ pc pc ...
+ *       ...
+ *       MAPPED_LIBRARIES:
+ *       ...the dumping process' /proc/self/maps...
+ *
+ *   The table is open-addressed on the chunk offset and needs no lock:
+ *   a slot is claimed with a compare-and-swap, filled, and published by
+ *   storing the chunk's offset.  Freed slots are marked dead and reused.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <execinfo.h>
+#include <time.h>
+#define USINTERNAL
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Data: {{{2
+ */
+extern USArena *usarena;
+
+/* ------------------------------------------------------------------------
+ * Local Definitions: {{{2
+ */
+#define USPROFDEAD  ((usoffset) 1)  /* USProfRec.ichunk: slot's sample was dropped */
+#define USPROFBUSY  ((usoffset) 2)  /* USProfRec.ichunk: slot is being filled      */
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static long          profleft= 0; /* bytes to be allocated before the next sample */
+static unsigned long profrand= 0; /* ProfNext()'s random state                    */
+static pid_t         profpid = 0; /* process profrand was seeded for              */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+static long ProfNext(unsigned long);      /* usprof.c */
+static unsigned long ProfHash(usoffset);  /* usprof.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* usprofon: this function turns the heap profiler on (CONF_PROFON) {{{2
+ *   rate is the mean qty of bytes allocated between samples (0: USPROFRATE).
+ *   The sample table is allocated from the arena the first time; its size
+ *   is taken from CONF_PROFSIZE (default: USPROFSIZE samples).  Sampling is
+ *   turned on for every process using the arena.
+ *   Returns: 0=success  -1=failure
+ */
+int usprofon(
+  usptr_t       *arena,
+  unsigned long  rate)
+{
+unsigned   size;
+void      *pc[2];
+USProfRec *table;
+
+
+if(!arena || !arena->prof) {
+    return -1;
+    }
+
+if(!arena->prof->table) {
+    size = arena->profsize? arena->profsize : USPROFSIZE;
+    table= (USProfRec *) uscalloc((size_t) size,sizeof(USProfRec),arena);
+    if(!table) {
+        return -1;
+        }
+    usarenalock(arena);
+    if(!arena->prof->table) { /* somebody else may have beaten us to it */
+        arena->prof->size   = size;
+        arena->prof->dropped= 0;
+        arena->prof->table  = ((usbase *) table) - arena->mempool;
+        table               = NULL;
+        }
+    usarenaunlock(arena);
+    if(table) usfree(table,arena);
+    }
+backtrace(pc,2); /* its first call may load libgcc; best not done while sampling */
+arena->prof->rate= rate? rate : USPROFRATE;
+arena->prof->on  = 1;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* usprofoff: this function turns the heap profiler off (CONF_PROFOFF) {{{2
+ *   The live samples are kept (and still dropped when freed); see usprofdump().
+ */
+int usprofoff(usptr_t *arena)
+{
+if(!arena || !arena->prof) {
+    return -1;
+    }
+arena->prof->on= 0;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* usprofsample: this function counts an allocation, sampling it if it's due {{{2
+ *   usmalloc() calls this (when the profiler is on) after releasing the
+ *   arena locks; ichunk is inuse and this process' until it returns.
+ */
+void usprofsample(
+  usptr_t  *arena,
+  usoffset  ichunk,
+  size_t    size)
+{
+int           iprobe;
+int           depth;
+unsigned long islot;
+usoffset      old;
+void         *pc[USPROFDEPTH+1];
+USProfCtl    *prof= arena->prof;
+USProfRec    *table;
+USProfRec    *rec;
+
+
+if(__atomic_sub_fetch(&profleft,(long) size,__ATOMIC_RELAXED) > 0) return;
+__atomic_add_fetch(&profleft,ProfNext(prof->rate),__ATOMIC_RELAXED);
+if(!prof->table || !prof->size) return;
+
+table= (USProfRec *) (arena->mempool + prof->table);
+for(iprobe= 0, islot= ProfHash(ichunk)%prof->size; iprobe < USPROFPROBE; ++iprobe, islot= (islot+1)%prof->size) {
+    rec= &table[islot];
+    old= __atomic_load_n(&rec->ichunk,__ATOMIC_RELAXED);
+    if(old != 0 && old != USPROFDEAD) continue;
+    if(__atomic_compare_exchange_n(&rec->ichunk,&old,USPROFBUSY,0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)) break;
+    }
+if(iprobe >= USPROFPROBE) {
+    __atomic_add_fetch(&prof->dropped,1UL,__ATOMIC_RELAXED);
+    return;
+    }
+
+depth= backtrace(pc,USPROFDEPTH+1) - 1; /* pc[0] is usprofsample() */
+if(depth < 0) depth= 0;
+memcpy(rec->pc,pc+1,(size_t) depth*sizeof(void *));
+rec->depth= depth;
+rec->size = size;
+rec->pid  = getpid();
+__atomic_store_n(&rec->ichunk,ichunk,__ATOMIC_RELEASE);
+usarena= arena;
+setsampled(ichunk);
+}
+
+/* --------------------------------------------------------------------- */
+/* usproffree: this function drops a freed chunk's sample {{{2
+ *   usfree() calls this for chunks marked as sampled.
+ */
+void usproffree(
+  usptr_t  *arena,
+  usoffset  ichunk)
+{
+int           iprobe;
+unsigned long islot;
+usoffset      old;
+USProfCtl    *prof= arena->prof;
+USProfRec    *table;
+
+
+if(!prof->table || !prof->size) return;
+
+table= (USProfRec *) (arena->mempool + prof->table);
+for(iprobe= 0, islot= ProfHash(ichunk)%prof->size; iprobe < USPROFPROBE; ++iprobe, islot= (islot+1)%prof->size) {
+    old= __atomic_load_n(&table[islot].ichunk,__ATOMIC_ACQUIRE);
+    if(old == ichunk) {
+        __atomic_store_n(&table[islot].ichunk,USPROFDEAD,__ATOMIC_RELEASE);
+        return;
+        }
+    if(old == 0) return; /* samples are never placed past a never-used slot */
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* usprofdump: this function writes the live heap profile to file (CONF_PROFDUMP) {{{2
+ *   merged=0: just this process' samples
+ *   merged=1: the samples of every process using the arena.  The stack
+ *             addresses are interpreted with this process' mappings, so
+ *             the processes should share their layout (ie. be forked from
+ *             one parent); otherwise have each process dump its own
+ *             samples and let pprof merge the files.
+ *   Returns: 0=success  -1=failure
+ */
+int usprofdump(
+  usptr_t    *arena,
+  const char *file,
+  int         merged)
+{
+int            c;
+int            ipc;
+unsigned       islot;
+unsigned long  objects= 0;
+unsigned long  bytes  = 0;
+pid_t          pid    = getpid();
+FILE          *fp;
+FILE          *maps;
+USProfRec     *table;
+USProfRec      rec;
+
+
+if(!arena || !arena->prof || !file) {
+    errno= EINVAL;
+    return -1;
+    }
+fp= fopen(file,"w");
+if(!fp) {
+    return -1;
+    }
+table= arena->prof->table? (USProfRec *) (arena->mempool + arena->prof->table) : NULL;
+
+/* the totals, then one line per live sample */
+for(c= 0; c < 2; ++c) {
+    if(c) fprintf(fp,"heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%lu\n",objects,bytes,objects,bytes,arena->prof->rate? arena->prof->rate : USPROFRATE);
+    for(islot= 0; table && islot < arena->prof->size; ++islot) {
+        rec.ichunk= __atomic_load_n(&table[islot].ichunk,__ATOMIC_ACQUIRE);
+        if(rec.ichunk < 8) continue;
+        memcpy(&rec,&table[islot],sizeof(USProfRec));
+        if(__atomic_load_n(&table[islot].ichunk,__ATOMIC_ACQUIRE) != rec.ichunk) continue; /* changed while copied */
+        if(!merged && rec.pid != pid) continue;
+        if(!c) {
+            ++objects;
+            bytes+= rec.size;
+            continue;
+            }
+        fprintf(fp,"1: %lu [1: %lu] @",(unsigned long) rec.size,(unsigned long) rec.size);
+        for(ipc= 0; ipc < rec.depth && ipc < USPROFDEPTH; ++ipc) fprintf(fp," %p",rec.pc[ipc]);
+        fputc('\n',fp);
+        }
+    }
+
+/* pprof needs the mappings to symbolize the addresses */
+fprintf(fp,"\nMAPPED_LIBRARIES:\n");
+maps= fopen("/proc/self/maps","r");
+if(maps) {
+    while((c= fgetc(maps)) != EOF) fputc(c,fp);
+    fclose(maps);
+    }
+
+return fclose(fp)? -1 : 0;
+}
+
+/* =====================================================================
+ * Support Routines: {{{1
+ */
+
+/* ProfNext: this function returns the qty of bytes until the next sample {{{2
+ *   Exponentially distributed with mean rate (as pprof's heap_v2 unsampling
+ *   assumes): rate*ln(1/u), for u uniform in (0,1].  log2(1/u) is taken from
+ *   the random number's leading zeros, plus a quadratic fit of log2(1+f)
+ *   for its fraction (within 0.01), so no libm is needed.
+ */
+static long ProfNext(unsigned long rate)
+{
+int           lz;
+double        f;
+unsigned long x;
+
+
+if(profpid != getpid()) { /* forked processes mustn't all sample the same allocations */
+    profpid = getpid();
+    profrand= ((unsigned long) profpid << 32) ^ usclock() ^ 0x9e3779b97f4a7c15UL;
+    }
+profrand^= profrand << 13; /* xorshift64 */
+profrand^= profrand >> 7;
+profrand^= profrand << 17;
+x = profrand? profrand : 1;
+lz= __builtin_clzl(x);
+f = (double) ((x << lz << 1) >> 11)/9007199254740992.; /* bits past the leading one, in [0,1) */
+
+return 1 + (long) ((double) rate*0.6931471805599453*((double) (lz+1) - f*(1.3465 - 0.3465*f)));
+}
+
+/* --------------------------------------------------------------------- */
+/* ProfHash: this function maps a chunk offset to a sample table slot {{{2 */
+static unsigned long ProfHash(usoffset ichunk)
+{
+return ((ichunk >> 3)*0x9e3779b97f4a7c15UL) >> 17;
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
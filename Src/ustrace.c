@@ -0,0 +1,264 @@
+/* ustrace.c: this program records a process' allocations into a trace file
+ *   When on (CONF_TRACEON), every usmalloc(), usfree(), and usrealloc()
+ *   of the process is recorded as a USTraceRec (time, size, chunks) in a
+ *   ring of USTRACESIZE records kept in the process' own memory.  Callers
+ *   reserve a record with one atomic increment and take no lock.  Each
+ *   time half the ring fills, the caller that filled it appends that half
+ *   to the trace file as one block: a USTraceHdr (which carries the pid)
+ *   followed by its records.  The rest is written by CONF_TRACEFLUSH,
+ *   CONF_TRACEOFF, and at exit.
+ *
+ *   The file is opened for appending, so processes forked while tracing
+ *   (and any others tracing into the same file) write their blocks into
+ *   one trace; the records' CLOCK_MONOTONIC times order them.  Frees are
+ *   timed before, and allocations after, the arena is changed, so a chunk
+ *   freed by one process and allocated by another appears in that order.
+ *   Util/usreplay replays a trace.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/uio.h>
+#define USINTERNAL
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Local Data Structures: {{{2
+ */
+typedef struct TraceSlot_str TraceSlot;
+struct TraceSlot_str {           /* TraceSlot: one ring record            */
+    unsigned long seq;           /* 1+record number; 0 while being written */
+    USTraceRec    rec;           /* the record                             */
+    };
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static int            tracefd      = -1;   /* trace file                            */
+static int            traceinit    = 0;    /* atexit()/pthread_atfork() registered? */
+static int            tracedraining= 0;    /* a TraceDrain() is under way           */
+static pid_t          tracepid     = 0;    /* getpid(), for the block headers       */
+static usptr_t       *tracearena   = NULL; /* arena being traced                    */
+static unsigned long  tracehead    = 0;    /* qty of records ever reserved          */
+static unsigned long  tracetail    = 0;    /* qty of records ever written out       */
+static TraceSlot     *tracering    = NULL; /* USTRACESIZE records                   */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+static int TraceDrain(unsigned long); /* ustrace.c */
+static void traceexit(void);          /* ustrace.c */
+static void traceforked(void);        /* ustrace.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* ustraceon: this function starts recording this process' allocations (CONF_TRACEON) {{{2
+ *   Records are appended to file (created if need be).  One arena at a
+ *   time may be traced.
+ *   Returns: 0=success  -1=failure
+ */
+int ustraceon(
+  usptr_t    *arena,
+  const char *file)
+{
+if(!arena || !file) {
+    errno= EINVAL;
+    return -1;
+    }
+if(tracearena) {
+    errno= EBUSY;
+    return -1;
+    }
+
+if(!tracering) {
+    tracering= (TraceSlot *) calloc((size_t) USTRACESIZE,sizeof(TraceSlot));
+    if(!tracering) {
+        return -1;
+        }
+    }
+tracefd= open(file,O_WRONLY|O_CREAT|O_APPEND,(mode_t) (arena->permission? arena->permission : 0644));
+if(tracefd < 0) {
+    return -1;
+    }
+if(!traceinit) {
+    atexit(traceexit);
+    pthread_atfork(NULL,NULL,traceforked);
+    traceinit= 1;
+    }
+tracepid   = getpid();
+tracetail  = tracehead; /* the slots' seqs go on counting up, so none is mistaken for a new record */
+tracearena = arena;
+arena->trace= 1;
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* ustraceoff: this function stops recording and writes out the rest (CONF_TRACEOFF) {{{2
+ *   Returns: 0=success  -1=failure (the trace file is closed regardless)
+ */
+int ustraceoff(void)
+{
+int ret;
+
+
+if(!tracearena) {
+    return 0;
+    }
+tracearena->trace= 0;
+ret              = TraceDrain(__atomic_load_n(&tracehead,__ATOMIC_ACQUIRE));
+if(close(tracefd)) ret= -1;
+tracefd   = -1;
+tracearena= NULL;
+
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* ustraceflush: this function writes out the records so far (CONF_TRACEFLUSH) {{{2
+ *   Processes that leave with _exit() should call this (or ustraceoff()) first.
+ *   Returns: 0=success  -1=failure
+ */
+int ustraceflush(void)
+{
+if(!tracearena) {
+    return 0;
+    }
+
+return TraceDrain(__atomic_load_n(&tracehead,__ATOMIC_ACQUIRE));
+}
+
+/* --------------------------------------------------------------------- */
+/* ustracerec: this function records one allocator call {{{2
+ *   usmalloc.c calls this when arena->trace is set.  Should the ring
+ *   fill faster than it can be written out, callers wait.
+ */
+void ustracerec(
+  int       op,
+  usoffset  ichunk,
+  usoffset  old,
+  size_t    size)
+{
+unsigned long  idx;
+TraceSlot     *slot;
+
+
+if(!tracering) return;
+
+idx = __atomic_fetch_add(&tracehead,1UL,__ATOMIC_RELAXED);
+while(idx - __atomic_load_n(&tracetail,__ATOMIC_ACQUIRE) >= USTRACESIZE) sched_yield();
+slot= &tracering[idx%USTRACESIZE];
+
+slot->rec.time  = usclock();
+slot->rec.size  = size;
+slot->rec.op    = (unsigned long) op;
+slot->rec.ichunk= ichunk;
+slot->rec.old   = old;
+__atomic_store_n(&slot->seq,idx+1,__ATOMIC_RELEASE);
+
+if((idx+1)%(USTRACESIZE/2) == 0) TraceDrain(idx+1);
+}
+
+/* =====================================================================
+ * Support Routines: {{{1
+ */
+
+/* TraceDrain: this function writes out the records before record end {{{2
+ *   One block per call, written with one writev(), so blocks appended
+ *   by several processes don't interleave.  Drains take turns; each
+ *   waits for the records it writes to be completed.
+ *   Returns: 0=success  -1=failure
+ */
+static int TraceDrain(unsigned long end)
+{
+int            iov;
+int            ret= 0;
+ssize_t        wrote;
+unsigned long  idx;
+unsigned long  first;
+unsigned long  qty;
+USTraceRec    *buf;
+USTraceHdr     hdr;
+struct iovec   vec[2];
+
+
+while(__atomic_exchange_n(&tracedraining,1,__ATOMIC_ACQUIRE)) sched_yield();
+
+first= __atomic_load_n(&tracetail,__ATOMIC_RELAXED);
+if(end > first && tracefd >= 0) {
+    qty= end - first;
+    buf= (USTraceRec *) malloc(qty*sizeof(USTraceRec));
+    if(!buf) ret= -1;
+    else {
+        for(idx= first; idx < end; ++idx) { /* the records are copied out, so the slots can be reused at once */
+            while(__atomic_load_n(&tracering[idx%USTRACESIZE].seq,__ATOMIC_ACQUIRE) != idx+1) sched_yield();
+            buf[idx - first]= tracering[idx%USTRACESIZE].rec;
+            }
+        __atomic_store_n(&tracetail,end,__ATOMIC_RELEASE);
+
+        hdr.magic      = USTRACEMAGIC;
+        hdr.pid        = tracepid;
+        hdr.qty        = qty;
+        vec[0].iov_base= &hdr;
+        vec[0].iov_len = sizeof(USTraceHdr);
+        vec[1].iov_base= buf;
+        vec[1].iov_len = qty*sizeof(USTraceRec);
+        for(iov= 0; iov < 2; ) { /* finish a short write */
+            wrote= writev(tracefd,vec+iov,2-iov);
+            if(wrote < 0) {
+                if(errno == EINTR) continue;
+                ret= -1;
+                break;
+                }
+            while(iov < 2 && (size_t) wrote >= vec[iov].iov_len) wrote-= (ssize_t) vec[iov++].iov_len;
+            if(iov < 2) {
+                vec[iov].iov_base= ((char *) vec[iov].iov_base) + wrote;
+                vec[iov].iov_len-= (size_t) wrote;
+                }
+            }
+        free(buf);
+        }
+    }
+
+__atomic_store_n(&tracedraining,0,__ATOMIC_RELEASE);
+
+return ret;
+}
+
+/* --------------------------------------------------------------------- */
+/* traceexit: this function writes out this process' remaining records at exit {{{2 */
+static void traceexit(void)
+{
+ustraceoff();
+}
+
+/* --------------------------------------------------------------------- */
+/* traceforked: this function starts a forked child's trace afresh {{{2
+ *   The parent writes out the records it made before the fork, so the
+ *   child drops its copies and goes on appending to the same file under
+ *   its own pid.
+ */
+static void traceforked(void)
+{
+if(!tracearena) return;
+tracepid     = getpid();
+tracetail    = tracehead;
+tracedraining= 0;
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
@@ -0,0 +1,653 @@
+/* usverify.c: this program checks the arena's heap for corruption
+ *   usverify()     checks the whole heap, dividing it among threads
+ *   usverifystep() checks the next few chunks of the heap, so that a
+ *                  background thread can check a large arena without
+ *                  holding its locks for long
+ *
+ *   Every chunk is checked for
+ *     - a header check byte that agrees with its offset and size
+ *     - free chunks' leading and trailing sizes that agree (boundary tags),
+ *       prvfree bits that agree with the chunks before them, and chunks
+ *       that exactly tile the arena
+ *     - free chunks: bin links that agree in both directions, with
+ *       neighbors in the bin ushashsize() picks for the chunk (sorted, in
+ *       a multi-size bin); the bin's head (tail) has no prv (nxt)
+ *     - no two adjacent free chunks (they should have been merged)
+ *     - the top chunk: a free chunk, out of the bins, that ends the heap
+ *   usverify() also checks that each bin's list reaches its tail, that
+ *   binqty[] and the bins' bitmap agree with it, and that the bins hold
+ *   exactly the heap's free chunks (but for the top chunk); that the
+ *   fastbins hold exactly the chunks marked fast, each in the fastbin of
+ *   its size; and that the chunks queued by usfree() (CONF_REMOTEFREE)
+ *   are marked queued.  As
+ *   usfree() queues chunks without a lock, more may be marked queued than
+ *   the queue held when it was walked.
+ *
+ *   Offsets and sizes are range-checked before being followed, so a
+ *   corrupted heap (or one changing under an unlocked check, as with
+ *   usstat) yields errors rather than a segfault.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#define USINTERNAL
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Typedefs: {{{2
+ */
+typedef struct VerHeap_str   VerHeap;
+typedef struct VerThread_str VerThread;
+
+/* ------------------------------------------------------------------------
+ * Local Data Structures: {{{2
+ */
+struct VerHeap_str {                  /* VerHeap: the heap being checked               */
+    usbase          *base;            /* beginning of allocatable memory               */
+    usoffset         memsize;         /* bytes of allocatable memory                   */
+    USFreeBin       *bin;             /* free chunk bins                               */
+    usoffset         top;             /* top chunk (0: none)                           */
+    USFastCtl       *fast;            /* fastbins                                      */
+    unsigned long    fastqty;         /* usverify(): qty of chunks in the fastbins     */
+    usoffset         remote;          /* usfree()'s queue, as of the check's start     */
+    unsigned long    remoteqty;       /* usverify(): qty of chunks in it               */
+    unsigned long   *binqty;          /* qty of free chunks per bin                    */
+    unsigned long   *binmap;          /* bitmap of the non-empty bins                  */
+    unsigned         tagqty;          /* qty of tags in use                            */
+    usoffset        *free;            /* usverify(): the bins' chunks, sorted          */
+    unsigned long    freeqty;         /* qty of chunks in free                         */
+    int              nthread;         /* qty of threads                                */
+    usoffset         start[USVERIFYTHREADS+1]; /* usverify(): heap regions             */
+    };
+struct VerThread_str {                /* VerThread: one usverify() thread              */
+    pthread_t        thread;
+    int              ithread;         /* thread number: which bins and region it checks */
+    int              started;         /* pthread_create() succeeded                    */
+    VerHeap         *heap;
+    usoffset        *free;            /* chunks found in this thread's bins            */
+    unsigned long    freeqty;         /* qty of chunks in free                         */
+    unsigned long    freesize;        /* qty of chunks free has room for               */
+    unsigned long    walked;          /* qty of free chunks walked in its region       */
+    unsigned long    fastwalked;      /* qty of fastbin chunks walked in its region    */
+    unsigned long    queuewalked;     /* qty of queued chunks walked in its region     */
+    int              aborted;         /* region's walk hit a bad chunk                 */
+    struct usverify  rpt;             /* what it found                                 */
+    };
+
+/* ------------------------------------------------------------------------
+ * Data: {{{2
+ */
+extern USArena *usarena;
+
+/* ------------------------------------------------------------------------
+ * Local Definitions: {{{2
+ */
+#define verword(heap,ichunk,i)  (((volatile usoffset *)((heap)->base + (ichunk)))[i])
+#define versize(heap,ichunk)    (verword(heap,ichunk,0)&USSIZEMASK)
+#define verfree(heap,ichunk)    (verword(heap,ichunk,0)&1)
+#define verfast(heap,ichunk)    ((verword(heap,ichunk,0)&0x6) == 0x4)
+#define verqueued(heap,ichunk)  ((verword(heap,ichunk,0)&0x6) == 0x6)
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+static void VerBad(struct usverify *,usoffset,const char *,...) __attribute__((format(printf,3,4))); /* usverify.c */
+static int VerOffset(VerHeap *,usoffset);                          /* usverify.c */
+static usoffset VerChunk(VerHeap *,usoffset,struct usverify *);    /* usverify.c */
+static void VerHeapInit(VerHeap *,usptr_t *);                      /* usverify.c */
+static void VerMerge(struct usverify *,struct usverify *);         /* usverify.c */
+static int VerCmp(const void *,const void *);                      /* usverify.c */
+static void *VerBins(void *);                                      /* usverify.c */
+static void VerFast(VerHeap *,struct usverify *);                  /* usverify.c */
+static void VerRemote(VerHeap *,struct usverify *);                /* usverify.c */
+static void *VerRegion(void *);                                    /* usverify.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* usverify: this function checks the whole heap, using nthread threads {{{2
+ *   The bins are divided among the threads and walked, collecting the free
+ *   chunks; the heap is then divided into nthread regions, each beginning
+ *   at a free chunk (which is known to begin a chunk), and the regions are
+ *   walked in parallel.  nthread <= 0 means one thread per online cpu.
+ *
+ *   The arena's locks are held during the check, unless the calling
+ *   thread already holds them (other threads' locks don't count).
+ *   Returns: qty of errors found (see rpt)  -1=failure
+ */
+int usverify(
+  usptr_t         *arena,
+  int              nthread,
+  struct usverify *rpt)
+{
+int            ithread;
+int            aborted   = 0;
+int            locked    = 0;
+unsigned long  walked    = 0;
+unsigned long  fastwalked= 0;
+unsigned long  queued    = 0;
+unsigned long  lo;
+unsigned long  hi;
+usoffset       target;
+VerHeap        heap;
+VerThread     *thr;
+
+
+if(!arena || !arena->base || !arena->bin || !rpt) {
+    errno= EINVAL;
+    return -1;
+    }
+memset(rpt,0,sizeof(struct usverify));
+if(nthread <= 0)              nthread= (int) sysconf(_SC_NPROCESSORS_ONLN);
+if(nthread <= 0)              nthread= 1;
+if(nthread > USVERIFYTHREADS) nthread= USVERIFYTHREADS;
+thr= (VerThread *) calloc((size_t) nthread,sizeof(VerThread));
+if(!thr) {
+    return -1;
+    }
+
+usarena= arena;
+if(!usbinheld(USLK_BIG)) {
+    usarenalock(arena);
+    usbinlock(arena,USLK_SMALL);
+    locked= 1;
+    }
+VerHeapInit(&heap,arena);
+heap.nthread= nthread;
+
+/* phase 1: walk the bins, collecting their chunks */
+for(ithread= 0; ithread < nthread; ++ithread) {
+    thr[ithread].ithread= ithread;
+    thr[ithread].heap   = &heap;
+    thr[ithread].started= ithread && !pthread_create(&thr[ithread].thread,NULL,VerBins,&thr[ithread]);
+    }
+for(ithread= 0; ithread < nthread; ++ithread) {
+    if(thr[ithread].started) pthread_join(thr[ithread].thread,NULL);
+    else                     VerBins(&thr[ithread]);
+    }
+
+/* phase 2: the chunks in the bins, sorted */
+for(ithread= 0; ithread < nthread; ++ithread) heap.freeqty+= thr[ithread].freeqty;
+heap.free= (usoffset *) malloc((heap.freeqty + 1)*sizeof(usoffset));
+if(!heap.free) {
+    if(locked) {
+        usbinunlock(arena,USLK_SMALL);
+        usarenaunlock(arena);
+        }
+    for(ithread= 0; ithread < nthread; ++ithread) free(thr[ithread].free);
+    free(thr);
+    return -1;
+    }
+for(heap.freeqty= 0, ithread= 0; ithread < nthread; ++ithread) {
+    if(thr[ithread].freeqty) memcpy(heap.free + heap.freeqty,thr[ithread].free,thr[ithread].freeqty*sizeof(usoffset));
+    heap.freeqty+= thr[ithread].freeqty;
+    free(thr[ithread].free);
+    thr[ithread].free= NULL;
+    }
+qsort(heap.free,heap.freeqty,sizeof(usoffset),VerCmp);
+for(lo= 1; lo < heap.freeqty; ++lo) if(heap.free[lo] == heap.free[lo-1]) {
+    VerBad(&thr[0].rpt,heap.free[lo],"free chunk is in the bins twice");
+    }
+
+if(heap.top && (!VerOffset(&heap,heap.top) || !verfree(&heap,heap.top))) {
+    VerBad(&thr[0].rpt,heap.top,"top chunk %lu isn't a free chunk",heap.top);
+    }
+VerFast(&heap,&thr[0].rpt);
+VerRemote(&heap,&thr[0].rpt);
+
+/* phase 3: walk the heap, a region per thread.  Region i begins at the
+ * first free chunk at or past i/nthread of the heap.
+ */
+heap.start[0]      = 8;
+heap.start[nthread]= heap.memsize;
+for(ithread= 1; ithread < nthread; ++ithread) {
+    target= 8 + (heap.memsize - 8)/nthread*ithread;
+    for(lo= 0, hi= heap.freeqty; lo < hi; ) { /* lo: first free chunk >= target */
+        if(heap.free[(lo+hi)/2] < target) lo= (lo+hi)/2 + 1;
+        else                              hi= (lo+hi)/2;
+        }
+    heap.start[ithread]= (lo < heap.freeqty)? heap.free[lo] : heap.memsize;
+    if(heap.start[ithread] < heap.start[ithread-1]) heap.start[ithread]= heap.start[ithread-1];
+    }
+for(ithread= 0; ithread < nthread; ++ithread) {
+    thr[ithread].started= ithread && !pthread_create(&thr[ithread].thread,NULL,VerRegion,&thr[ithread]);
+    }
+for(ithread= 0; ithread < nthread; ++ithread) {
+    if(thr[ithread].started) pthread_join(thr[ithread].thread,NULL);
+    else                     VerRegion(&thr[ithread]);
+    }
+
+if(locked) {
+    usbinunlock(arena,USLK_SMALL);
+    usarenaunlock(arena);
+    }
+
+/* combine the threads' reports */
+for(ithread= 0; ithread < nthread; ++ithread) {
+    VerMerge(rpt,&thr[ithread].rpt);
+    walked    += thr[ithread].walked;
+    fastwalked+= thr[ithread].fastwalked;
+    queued    += thr[ithread].queuewalked;
+    aborted   |= thr[ithread].aborted;
+    }
+if(!aborted && walked < heap.freeqty) { /* (an aborted walk missed some) */
+    VerBad(rpt,heap.free[0],"%lu chunks in the bins aren't chunks of the heap",heap.freeqty - walked);
+    }
+if(!aborted && fastwalked != heap.fastqty) {
+    VerBad(rpt,heap.fast? heap.fast->hd[0] : 0,"%lu chunks are marked fast, but the fastbins hold %lu",fastwalked,heap.fastqty);
+    }
+if(!aborted && queued < heap.remoteqty) {
+    VerBad(rpt,heap.remote,"%lu chunks are marked queued, but usfree()'s queue holds %lu",queued,heap.remoteqty);
+    }
+free(heap.free);
+free(thr);
+
+return (int) ((rpt->errors > (unsigned long) (~0U>>1))? ~0U>>1 : rpt->errors);
+}
+
+/* --------------------------------------------------------------------- */
+/* usverifystep: this function checks the next nchunk chunks of the heap {{{2
+ *   The arena remembers where the last step left off (MergeFreeChunk()
+ *   moves that cursor back if its chunk is merged away), so successive
+ *   calls, from any process, walk the heap; rpt->pass counts the walks
+ *   completed.  The locks are held for just the nchunk chunks.  A step
+ *   that meets a chunk too damaged to walk past starts the next pass.
+ *   Returns: qty of errors found (see rpt)  -1=failure
+ */
+int usverifystep(
+  usptr_t         *arena,
+  unsigned long    nchunk,
+  struct usverify *rpt)
+{
+int            locked= 0;
+usoffset       ichunk;
+usoffset       sz;
+VerHeap        heap;
+
+
+if(!arena || !arena->base || !arena->verify || !rpt) {
+    errno= EINVAL;
+    return -1;
+    }
+memset(rpt,0,sizeof(struct usverify));
+
+usarena= arena;
+if(!usbinheld(USLK_BIG)) {
+    usarenalock(arena);
+    usbinlock(arena,USLK_SMALL);
+    locked= 1;
+    }
+VerHeapInit(&heap,arena);
+
+ichunk= arena->verify->cursor;
+if(ichunk < 8 || ichunk >= heap.memsize || (ichunk&0x7)) ichunk= 8;
+while(nchunk--) {
+    sz= VerChunk(&heap,ichunk,rpt);
+    if(sz) ichunk+= sz;
+    if(!sz || ichunk >= heap.memsize) { /* end of this pass */
+        if(sz && ichunk != heap.memsize) VerBad(rpt,ichunk - sz,"last chunk overruns the heap");
+        ++arena->verify->pass;
+        ichunk= 8;
+        break;
+        }
+    }
+arena->verify->cursor= ichunk;
+rpt->pass            = arena->verify->pass;
+
+if(locked) {
+    usbinunlock(arena,USLK_SMALL);
+    usarenaunlock(arena);
+    }
+
+return (int) ((rpt->errors > (unsigned long) (~0U>>1))? ~0U>>1 : rpt->errors);
+}
+
+/* =====================================================================
+ * Support Routines: {{{1
+ */
+
+/* VerBad: this function records an error found in chunk ichunk {{{2
+ *   The report keeps the lowest bad chunk's message.
+ */
+static void VerBad(
+  struct usverify *rpt,
+  usoffset         ichunk,
+  const char      *fmt,
+  ...)
+{
+va_list args;
+
+
+++rpt->errors;
+if(rpt->badchunk && rpt->badchunk <= ichunk) return;
+
+rpt->badchunk= ichunk;
+va_start(args,fmt);
+vsnprintf(rpt->msg,sizeof(rpt->msg),fmt,args);
+va_end(args);
+}
+
+/* --------------------------------------------------------------------- */
+/* VerOffset: this function determines if ichunk could begin a free chunk {{{2
+ *   ie. it is aligned, and its first three words are in the heap
+ */
+static int VerOffset(
+  VerHeap  *heap,
+  usoffset  ichunk)
+{
+return ichunk >= 8 && !(ichunk&0x7) && ichunk + MINCHUNKSIZE <= heap->memsize;
+}
+
+/* --------------------------------------------------------------------- */
+/* VerChunk: this function checks chunk ichunk {{{2
+ *   Returns: ichunk's size, or 0 if the heap can't be walked past ichunk
+ */
+static usoffset VerChunk(
+  VerHeap         *heap,
+  usoffset         ichunk,
+  struct usverify *rpt)
+{
+int      ibin;
+usoffset sz;
+usoffset nxt;
+usoffset prv;
+usoffset nxtsz;
+usoffset prvsz;
+
+
+++rpt->chunks;
+if(!VerOffset(heap,ichunk)) {
+    VerBad(rpt,ichunk,"chunk offset isn't in the heap");
+    return 0;
+    }
+sz= versize(heap,ichunk);
+if(sz < MINCHUNKSIZE || sz > heap->memsize - ichunk) {
+    VerBad(rpt,ichunk,"bad size %lu",sz);
+    return 0;
+    }
+if((verword(heap,ichunk,0)&USCHECKMASK) != uscheckbyte(ichunk,sz)) {
+    VerBad(rpt,ichunk,"bad check byte (size %lu)",sz);
+    return 0;
+    }
+if(verfree(heap,ichunk) && verword(heap,ichunk+sz,-1) != sz) { /* only free chunks end with their size */
+    VerBad(rpt,ichunk,"size %lu != trailing size %lu",sz,verword(heap,ichunk+sz,-1));
+    return 0;
+    }
+if(ichunk == 8 && (verword(heap,ichunk,0)&USPRVFREE)) VerBad(rpt,ichunk,"first chunk's prvfree bit is set");
+if(ichunk + sz < heap->memsize && VerOffset(heap,ichunk+sz) &&
+   !(verword(heap,ichunk+sz,0)&USPRVFREE) != !verfree(heap,ichunk)) {
+    VerBad(rpt,ichunk,"next chunk %lu's prvfree bit is %s",ichunk+sz,verfree(heap,ichunk)? "clear" : "set");
+    }
+
+if(!verfree(heap,ichunk)) {
+    if((unsigned) (verword(heap,ichunk,0) >> USTAGSHIFT) >= heap->tagqty) {
+        VerBad(rpt,ichunk,"bad tag %u",(unsigned) (verword(heap,ichunk,0) >> USTAGSHIFT));
+        }
+    return sz;
+    }
+
+++rpt->freechunks;
+if(verword(heap,ichunk,0)&USTAGMASK) VerBad(rpt,ichunk,"free chunk is tagged");
+if(verword(heap,ichunk,0)&0x4)       VerBad(rpt,ichunk,"free chunk is marked fast or queued");
+if(ichunk + sz < heap->memsize && VerOffset(heap,ichunk+sz) && verfree(heap,ichunk+sz)) {
+    VerBad(rpt,ichunk,"free chunk adjoins free chunk %lu",ichunk+sz);
+    }
+if(ichunk == heap->top) { /* the top chunk has no bin */
+    if(ichunk + sz != heap->memsize) VerBad(rpt,ichunk,"top chunk ends at %lu, not at the heap's end",ichunk+sz);
+    return sz;
+    }
+
+/* its bin's links */
+ibin= ushashsize(sz);
+nxt = verword(heap,ichunk,1);
+prv = verword(heap,ichunk,2);
+if(ibin < 0 || ibin >= USMAXFREEBIN) {
+    VerBad(rpt,ichunk,"size %lu has no bin",sz);
+    return sz;
+    }
+if(!nxt) {
+    if(heap->bin[ibin].tl != ichunk) VerBad(rpt,ichunk,"nxt=0, but isn't bin[%d]'s tail",ibin);
+    }
+else if(!VerOffset(heap,nxt) || !verfree(heap,nxt)) {
+    VerBad(rpt,ichunk,"nxt=%lu isn't a free chunk",nxt);
+    }
+else {
+    nxtsz= versize(heap,nxt);
+    if(verword(heap,nxt,2) != ichunk)                 VerBad(rpt,ichunk,"nxt=%lu, but nxt->prv=%lu",nxt,verword(heap,nxt,2));
+    else if(ushashsize(nxtsz) != ibin)                VerBad(rpt,ichunk,"nxt=%lu is in bin[%d], not bin[%d]",nxt,ushashsize(nxtsz),ibin);
+    else if(ibin > USMAXONESIZE && nxtsz < sz)        VerBad(rpt,ichunk,"bin[%d] isn't sorted (nxt=%lu is smaller)",ibin,nxt);
+    }
+if(!prv) {
+    if(heap->bin[ibin].hd != ichunk) VerBad(rpt,ichunk,"prv=0, but isn't bin[%d]'s head",ibin);
+    }
+else if(!VerOffset(heap,prv) || !verfree(heap,prv)) {
+    VerBad(rpt,ichunk,"prv=%lu isn't a free chunk",prv);
+    }
+else {
+    prvsz= versize(heap,prv);
+    if(verword(heap,prv,1) != ichunk)                 VerBad(rpt,ichunk,"prv=%lu, but prv->nxt=%lu",prv,verword(heap,prv,1));
+    else if(ushashsize(prvsz) != ibin)                VerBad(rpt,ichunk,"prv=%lu is in bin[%d], not bin[%d]",prv,ushashsize(prvsz),ibin);
+    }
+
+return sz;
+}
+
+/* --------------------------------------------------------------------- */
+/* VerHeapInit: this function describes the arena's heap for checking {{{2 */
+static void VerHeapInit(
+  VerHeap *heap,
+  usptr_t *arena)
+{
+memset(heap,0,sizeof(VerHeap));
+heap->base   = arena->base;
+heap->memsize= arena->memsize;
+heap->bin    = arena->bin;
+heap->top    = arena->top? arena->top->chunk : 0;
+heap->fast   = arena->fast;
+heap->remote = arena->remote? __atomic_load_n(&arena->remote->hd,__ATOMIC_ACQUIRE) : 0;
+heap->binqty = arena->binqty;
+heap->binmap = arena->binmap;
+heap->tagqty = arena->tags? arena->tags->qty : 1;
+if(heap->tagqty > USMAXTAGS) heap->tagqty= USMAXTAGS;
+}
+
+/* --------------------------------------------------------------------- */
+/* VerMerge: this function adds a thread's report to the total {{{2 */
+static void VerMerge(
+  struct usverify *rpt,
+  struct usverify *thrrpt)
+{
+rpt->chunks    += thrrpt->chunks;
+rpt->freechunks+= thrrpt->freechunks;
+rpt->errors    += thrrpt->errors;
+if(thrrpt->badchunk && (!rpt->badchunk || thrrpt->badchunk < rpt->badchunk)) {
+    rpt->badchunk= thrrpt->badchunk;
+    memcpy(rpt->msg,thrrpt->msg,sizeof(rpt->msg));
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* VerCmp: this function compares two usoffsets for qsort() {{{2 */
+static int VerCmp(
+  const void *a,
+  const void *b)
+{
+usoffset x= *(const usoffset *) a;
+usoffset y= *(const usoffset *) b;
+
+return (x < y)? -1 : (x > y)? 1 : 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* VerBins: this function walks bins ithread, ithread+nthread, ... {{{2
+ *   collecting their chunks.  The chunks themselves, and their links,
+ *   are checked by the region walks.
+ */
+static void *VerBins(void *arg)
+{
+int            ibin;
+unsigned long  qty;
+unsigned long  maxqty;
+usoffset       ichunk;
+usoffset       last;
+usoffset      *more;
+VerThread     *thr = (VerThread *) arg;
+VerHeap       *heap= thr->heap;
+
+
+maxqty= heap->memsize/MINCHUNKSIZE;
+for(ibin= thr->ithread; ibin < USMAXFREEBIN; ibin+= heap->nthread) {
+    last= 0;
+    for(qty= 0, ichunk= heap->bin[ibin].hd; ichunk; ++qty, last= ichunk, ichunk= verword(heap,ichunk,1)) {
+        if(!VerOffset(heap,ichunk) || !verfree(heap,ichunk)) {
+            VerBad(&thr->rpt,ichunk,"bin[%d] links to %lu, which isn't a free chunk",ibin,ichunk);
+            break;
+            }
+        if(ichunk == heap->top) VerBad(&thr->rpt,ichunk,"bin[%d] holds the top chunk",ibin);
+        if(qty >= maxqty) {
+            VerBad(&thr->rpt,ichunk,"bin[%d] has a cycle",ibin);
+            break;
+            }
+        if(thr->freeqty >= thr->freesize) {
+            thr->freesize= thr->freesize? 2*thr->freesize : 1024;
+            more         = (usoffset *) realloc(thr->free,thr->freesize*sizeof(usoffset));
+            if(!more) {
+                VerBad(&thr->rpt,ichunk,"out of memory");
+                break;
+                }
+            thr->free= more;
+            }
+        thr->free[thr->freeqty++]= ichunk;
+        }
+    if(!ichunk && heap->bin[ibin].tl != last) {
+        VerBad(&thr->rpt,last,"bin[%d]'s tail is %lu, not its last chunk",ibin,heap->bin[ibin].tl);
+        }
+    if(heap->binqty && heap->binqty[ibin] != qty) {
+        VerBad(&thr->rpt,heap->bin[ibin].hd,"bin[%d] holds %lu chunks, not binqty=%lu",ibin,qty,heap->binqty[ibin]);
+        }
+    if(heap->binmap && !((heap->binmap[ibin>>6] >> (ibin&63))&1) != !heap->bin[ibin].hd) {
+        VerBad(&thr->rpt,heap->bin[ibin].hd,"bin[%d] is %sempty, but its binmap bit is %s",ibin,heap->bin[ibin].hd? "not " : "",heap->bin[ibin].hd? "clear" : "set");
+        }
+    }
+
+return NULL;
+}
+
+/* --------------------------------------------------------------------- */
+/* VerFast: this function walks the fastbins {{{2
+ *   Their chunks must be inuse chunks marked fast, of their fastbin's
+ *   size, and must add up to the fastbins' byte count.  The region walks
+ *   check that they're all the chunks marked fast.
+ */
+static void VerFast(
+  VerHeap         *heap,
+  struct usverify *rpt)
+{
+int           ibin;
+unsigned long qty;
+unsigned long maxqty;
+usoffset      ichunk;
+usoffset      bytes= 0;
+
+
+if(!heap->fast) return;
+maxqty= heap->memsize/MINCHUNKSIZE;
+for(ibin= 0; ibin < USMAXFASTBIN; ++ibin) {
+    for(qty= 0, ichunk= heap->fast->hd[ibin]; ichunk; ++qty, ichunk= verword(heap,ichunk,1)) {
+        if(!VerOffset(heap,ichunk) || verfree(heap,ichunk) || !verfast(heap,ichunk)) {
+            VerBad(rpt,ichunk,"fast[%d] links to %lu, which isn't a fastbin chunk",ibin,ichunk);
+            break;
+            }
+        if(ushashsize(versize(heap,ichunk)) != ibin) {
+            VerBad(rpt,ichunk,"fast[%d] holds a chunk of size %lu",ibin,versize(heap,ichunk));
+            }
+        if(qty >= maxqty) {
+            VerBad(rpt,ichunk,"fast[%d] has a cycle",ibin);
+            break;
+            }
+        bytes+= versize(heap,ichunk);
+        }
+    heap->fastqty+= qty;
+    }
+if(bytes != heap->fast->bytes) {
+    VerBad(rpt,heap->fast->hd[0],"the fastbins hold %lu bytes, not %lu",bytes,(unsigned long) heap->fast->bytes);
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* VerRemote: this function walks the chunks usfree() had queued when the check began {{{2
+ *   Only the lock holders take chunks off the queue, so that much of it
+ *   holds still, however many more chunks are pushed on meanwhile.
+ */
+static void VerRemote(
+  VerHeap         *heap,
+  struct usverify *rpt)
+{
+unsigned long qty;
+unsigned long maxqty;
+usoffset      ichunk;
+
+
+maxqty= heap->memsize/MINCHUNKSIZE;
+for(qty= 0, ichunk= heap->remote; ichunk; ++qty, ichunk= verword(heap,ichunk,1)) {
+    if(!VerOffset(heap,ichunk) || !verqueued(heap,ichunk)) {
+        VerBad(rpt,ichunk,"usfree()'s queue links to %lu, which isn't a queued chunk",ichunk);
+        break;
+        }
+    if(qty >= maxqty) {
+        VerBad(rpt,ichunk,"usfree()'s queue has a cycle");
+        break;
+        }
+    }
+heap->remoteqty= qty;
+}
+
+/* --------------------------------------------------------------------- */
+/* VerRegion: this function walks region ithread of the heap {{{2
+ *   Each free chunk walked must be one of the bins' chunks; the walk must
+ *   end exactly where the next region begins.
+ */
+static void *VerRegion(void *arg)
+{
+usoffset   ichunk;
+usoffset   end;
+usoffset   sz    = 1;
+VerThread *thr   = (VerThread *) arg;
+VerHeap   *heap  = thr->heap;
+
+
+end= heap->start[thr->ithread+1];
+for(ichunk= heap->start[thr->ithread]; ichunk < end; ichunk+= sz) {
+    sz= VerChunk(heap,ichunk,&thr->rpt);
+    if(!sz) {
+        thr->aborted= 1;
+        break;
+        }
+    if(verfree(heap,ichunk) && ichunk != heap->top) {
+        if(bsearch(&ichunk,heap->free,heap->freeqty,sizeof(usoffset),VerCmp)) ++thr->walked;
+        else VerBad(&thr->rpt,ichunk,"free chunk isn't in bin[%d]",ushashsize(sz));
+        }
+    else if(verfast(heap,ichunk))   ++thr->fastwalked;
+    else if(verqueued(heap,ichunk)) ++thr->queuewalked;
+    }
+if(sz && ichunk != end) {
+    VerBad(&thr->rpt,ichunk - sz,"chunk overruns %lu, where the %s begins",end,(end == heap->memsize)? "heap end" : "next region");
+    thr->aborted= 1;
+    }
+
+return NULL;
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
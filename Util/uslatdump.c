@@ -0,0 +1,148 @@
+/* uslatdump.c: this program displays an arena's latency histograms as percentiles
+ *   Usage: uslatdump [-on|-off|-reset|-buckets] arenafile
+ *     -on      : turn latency recording on for all processes using the arena
+ *     -off     : turn latency recording off
+ *     -reset   : zero the histograms (after displaying them)
+ *     -buckets : also display the non-empty buckets
+ *
+ *   Processes merge their counts into the arena every USLATMERGE records
+ *   and at exit, so the latest few thousand samples of a running process
+ *   may not be shown yet.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static char *metricname[US_LATQTY]= {
+    "usmalloc",
+    "usfree",
+    "usrealloc",
+    "uscalloc",
+    "usrecalloc",
+    "lockwait",
+    "FindChunk",
+    "InsertFreeChunk",
+    };
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+int main( int, char **);                  /* uslatdump.c */
+static void LatDump(uslat_t *,int);       /* uslatdump.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* main: it all starts here! {{{2 */
+int main(
+  int    argc,
+  char **argv)
+{
+int          iarg;
+int          buckets = 0;
+int          reset   = 0;
+int          turnon  = 0;
+int          turnoff = 0;
+char        *arenafile = NULL;
+struct stat  filestat;
+usptr_t     *arena;
+uslat_t      lat;
+
+
+for(iarg= 1; iarg < argc; ++iarg) {
+    if     (!strcmp(argv[iarg],"-on"))      turnon = 1;
+    else if(!strcmp(argv[iarg],"-off"))     turnoff= 1;
+    else if(!strcmp(argv[iarg],"-reset"))   reset  = 1;
+    else if(!strcmp(argv[iarg],"-buckets")) buckets= 1;
+    else if(argv[iarg][0] != '-')           arenafile= argv[iarg];
+    else {
+        arenafile= NULL;
+        break;
+        }
+    }
+if(!arenafile) {
+    fprintf(stderr,"usage: uslatdump [-on|-off|-reset|-buckets] arenafile\n");
+    return 1;
+    }
+if(stat(arenafile,&filestat)) { /* don't let usinit() create a new arena */
+    perror(arenafile);
+    return 1;
+    }
+
+arena= usinit(arenafile);
+if(!arena) {
+    perror("(uslatdump) usinit");
+    return 1;
+    }
+
+if(turnon && usconfig(CONF_LATON,arena) == -1) {
+    perror("(uslatdump) CONF_LATON");
+    return 1;
+    }
+if(turnoff) usconfig(CONF_LATOFF,arena);
+
+usconfig(CONF_LATFETCH,arena,&lat);
+LatDump(&lat,buckets);
+if(reset) usconfig(CONF_LATRESET,arena);
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* LatDump: this function prints sample counts and percentiles, in nanoseconds {{{2 */
+static void LatDump(
+  uslat_t *lat,
+  int      buckets)
+{
+int           ibkt;
+int           metric;
+unsigned long qty;
+
+
+printf("%-16s %12s %10s %10s %10s %10s %10s\n","metric","samples","p50","p90","p99","p99.9","max");
+for(metric= 0; metric < US_LATQTY; ++metric) {
+    for(qty= 0, ibkt= 0; ibkt < USLATBUCKETS; ++ibkt) qty+= lat->count[metric][ibkt];
+    printf("%-16s %12lu %10lu %10lu %10lu %10lu %10lu\n",
+      metricname[metric],
+      qty,
+      uslatpercentile(lat,metric,50.),
+      uslatpercentile(lat,metric,90.),
+      uslatpercentile(lat,metric,99.),
+      uslatpercentile(lat,metric,99.9),
+      uslatpercentile(lat,metric,100.));
+    }
+
+if(buckets) {
+    for(metric= 0; metric < US_LATQTY; ++metric) {
+        printf("%s:\n",metricname[metric]);
+        for(ibkt= 0; ibkt < USLATBUCKETS; ++ibkt) {
+            if(lat->count[metric][ibkt]) {
+                printf("  [%10lu,%10lu) %12lu\n",
+                  uslatns(ibkt),
+                  (ibkt < USLATBUCKETS-1)? uslatns(ibkt+1) : ~0UL,
+                  lat->count[metric][ibkt]);
+                }
+            }
+        }
+    }
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
@@ -0,0 +1,501 @@
+/* usreplay.c: this program replays an allocation trace against a fresh arena
+ *   Usage: usreplay [-p procs] [-i msecs] [-s bytes] [-l] [-n] [-c] tracefile
+ *     -p procs : qty of replaying processes (default: one per traced
+ *                process; 1: everything in one process, in time order)
+ *     -i msecs : interval between samples of the arena (default: 100)
+ *     -s bytes : arena size (default: twice the trace's peak, plus 4MB)
+ *     -l       : use US_LOCKPI locks (default: US_LOCKSEM)
+ *     -n       : don't time the lock waits (CONF_LATON), for throughput
+ *     -c       : print the samples as CSV (just them)
+ *
+ *   The trace is written by a program running with CONF_TRACEON (see
+ *   Doc/usreplay).  Its records are put in time order, and each traced
+ *   process' calls are replayed, as fast as possible, by one replaying
+ *   process; a chunk allocated by one process and freed by another is
+ *   so replayed, the freeing process waiting for the allocation if need
+ *   be; otherwise the processes keep their own pace.  Meanwhile the arena
+ *   is sampled every interval:
+ *
+ *     msecs calls inuse free largest fragmentation
+ *
+ *   and at the end, the throughput, lock contention and wait times,
+ *   peak footprint, and fragmentation are reported.
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Definitions: {{{2
+ */
+#define REPLAYNONE   (~0UL)      /* ReplayOp.old: none; ReplayShare.chunk[]: allocation failed */
+
+/* ------------------------------------------------------------------------
+ * Typedefs: {{{2
+ */
+typedef struct ReplayRec_str   ReplayRec;
+typedef struct ReplayOp_str    ReplayOp;
+typedef struct ReplayShare_str ReplayShare;
+
+/* ------------------------------------------------------------------------
+ * Local Data Structures: {{{2
+ */
+struct ReplayRec_str {             /* ReplayRec: one trace record       */
+    USTraceRec    rec;             /* as recorded                       */
+    pid_t         pid;             /* recording process                 */
+    unsigned long seq;             /* position in the file (ties)       */
+    };
+struct ReplayOp_str {              /* ReplayOp: one call to replay      */
+    int           op;              /* US_TRACEMALLOC etc                */
+    unsigned      proc;            /* replaying process                 */
+    unsigned long obj;             /* object allocated or freed         */
+    unsigned long old;             /* US_TRACEREALLOC: object moved     */
+    size_t        size;            /* bytes requested                   */
+    };
+struct ReplayShare_str {           /* ReplayShare: shared with the replaying processes */
+    int           go;              /* start!                            */
+    unsigned long done[64][8];     /* qty of calls replayed, per process (a cache line each) */
+    usoffset      top[64][8];      /* highest chunk end seen, per process */
+    unsigned long fail[64][8];     /* qty of failed allocations, per process */
+    };
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static ReplayRec     *rec     = NULL; /* the trace                         */
+static unsigned long  recqty  = 0;    /* qty of records                    */
+static ReplayOp      *op      = NULL; /* the calls to replay, in time order */
+static unsigned long  opqty   = 0;    /* qty of calls                      */
+static unsigned long  objqty  = 0;    /* qty of objects allocated          */
+static unsigned long  unmatched= 0;   /* frees of chunks allocated before the trace began */
+static unsigned long  peak    = 0;    /* peak bytes live during the trace  */
+static pid_t         *pids    = NULL; /* traced processes                  */
+static unsigned       pidqty  = 0;    /* qty of traced processes           */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+int main( int, char **);                                   /* usreplay.c */
+static int ReplayLoad(char *);                             /* usreplay.c */
+static int ReplayCmp(const void *,const void *);           /* usreplay.c */
+static void ReplayResolve(unsigned);                       /* usreplay.c */
+static void ReplayRun(usptr_t *,ReplayShare *,usoffset *,unsigned); /* usreplay.c */
+static usoffset ReplayLargest(usptr_t *,struct usmallinfo *); /* usreplay.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* main: it all starts here! {{{2 */
+int main(
+  int    argc,
+  char **argv)
+{
+int               iarg;
+int               csv      = 0;
+int               locktype = US_LOCKSEM;
+int               lat      = 1;
+int               status;
+int               running;
+unsigned          iproc;
+unsigned          procqty  = 0;
+unsigned long     interval = 100;
+unsigned long     ops;
+unsigned long     t0;
+unsigned long     t;
+unsigned long     fails;
+size_t            size     = 0;
+usoffset          largest;
+usoffset          top;
+usoffset         *chunk;
+double            frag;
+double            maxfrag  = 0.;
+double            secs;
+char             *tracefile= NULL;
+char              arenafile[64];
+pid_t            *child;
+usptr_t          *arena;
+ReplayShare      *share;
+uslat_t           wait;
+struct usmallinfo info;
+struct timespec   nap;
+
+
+for(iarg= 1; iarg < argc; ++iarg) {
+    if     (!strcmp(argv[iarg],"-p") && iarg+1 < argc) procqty = (unsigned) atoi(argv[++iarg]);
+    else if(!strcmp(argv[iarg],"-i") && iarg+1 < argc) interval= strtoul(argv[++iarg],NULL,0);
+    else if(!strcmp(argv[iarg],"-s") && iarg+1 < argc) size    = strtoul(argv[++iarg],NULL,0);
+    else if(!strcmp(argv[iarg],"-l"))                  locktype= US_LOCKPI;
+    else if(!strcmp(argv[iarg],"-n"))                  lat     = 0;
+    else if(!strcmp(argv[iarg],"-c"))                  csv     = 1;
+    else if(argv[iarg][0] != '-')                      tracefile= argv[iarg];
+    else {
+        tracefile= NULL;
+        break;
+        }
+    }
+if(!tracefile) {
+    fprintf(stderr,"usage: usreplay [-p procs] [-i msecs] [-s bytes] [-l] [-n] [-c] tracefile\n");
+    return 1;
+    }
+if(ReplayLoad(tracefile)) {
+    return 1;
+    }
+if(!procqty) procqty= pidqty;
+if(procqty < 1)  procqty= 1;
+if(procqty > 64) procqty= 64;
+if(!interval)    interval= 100;
+ReplayResolve(procqty);
+if(!size) size= 2*peak + ((size_t) 4 << 20);
+
+/* the shared bookkeeping: which chunk each object got */
+share= (ReplayShare *) mmap(NULL,sizeof(ReplayShare) + (objqty+1)*sizeof(usoffset),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,(off_t) 0);
+if(share == MAP_FAILED) {
+    perror("(usreplay) mmap");
+    return 1;
+    }
+chunk= (usoffset *) (share + 1);
+
+/* a fresh arena */
+snprintf(arenafile,sizeof(arenafile),"/dev/shm/usreplay.%d",(int) getpid());
+unlink(arenafile);
+usconfig(CONF_INITSIZE,size);
+usconfig(CONF_LOCKTYPE,locktype);
+arena= usinit(arenafile);
+if(!arena) {
+    perror("(usreplay) usinit");
+    return 1;
+    }
+if(lat && usconfig(CONF_LATON,arena) == -1) lat= 0; /* not compiled in */
+
+if(!csv) {
+    printf("trace: %lu records from %u processes; %lu calls (%lu unmatched frees dropped), %lu objects, peak %lu bytes\n",
+      recqty,pidqty,opqty,unmatched,objqty,peak);
+    printf("replay: %u processes, %s locks, %lu byte arena\n",procqty,(locktype == US_LOCKPI)? "US_LOCKPI" : "US_LOCKSEM",(unsigned long) size);
+    printf("%10s %12s %14s %14s %14s %8s\n","msecs","calls","inuse","free","largest","frag%");
+    }
+else printf("msecs,calls,inuse,free,largest,fragmentation\n");
+fflush(stdout);
+
+child= (pid_t *) calloc((size_t) procqty,sizeof(pid_t));
+for(iproc= 0; child && iproc < procqty; ++iproc) {
+    child[iproc]= fork();
+    if(child[iproc] == 0) {
+        ReplayRun(arena,share,chunk,iproc);
+        _exit(0);
+        }
+    if(child[iproc] < 0) {
+        perror("(usreplay) fork");
+        return 1;
+        }
+    }
+
+/* go, and sample the arena until they're done */
+t0= usclock();
+__atomic_store_n(&share->go,1,__ATOMIC_RELEASE);
+nap.tv_sec = (time_t) (interval/1000);
+nap.tv_nsec= (long) (interval%1000)*1000000L;
+for(running= (int) procqty; running > 0; ) {
+    nanosleep(&nap,NULL);
+    for(iproc= 0; iproc < procqty; ++iproc) {
+        if(child[iproc] > 0 && waitpid(child[iproc],&status,WNOHANG) == child[iproc]) {
+            child[iproc]= 0;
+            --running;
+            }
+        }
+    t= usclock();
+    for(ops= 0, iproc= 0; iproc < procqty; ++iproc) ops+= __atomic_load_n(&share->done[iproc][0],__ATOMIC_RELAXED);
+    usmallinfo(arena,&info);
+    largest= ReplayLargest(arena,&info);
+    frag   = info.free? 1. - (double) largest/(double) info.free : 0.;
+    if(frag > maxfrag) maxfrag= frag;
+    printf(csv? "%lu,%lu,%lu,%lu,%lu,%.4f\n" : "%10lu %12lu %14lu %14lu %14lu %8.1f\n",
+      (t - t0)/1000000UL,ops,(unsigned long) info.inuse,(unsigned long) info.free,largest,csv? frag : 100.*frag);
+    fflush(stdout);
+    }
+t= usclock();
+
+/* the summary */
+if(!csv) {
+    for(top= 0, fails= 0, iproc= 0; iproc < procqty; ++iproc) {
+        if(share->top[iproc][0] > top) top= share->top[iproc][0];
+        fails+= share->fail[iproc][0];
+        }
+    secs= (double) (t - t0)/1e9;
+    printf("\n");
+    printf("elapsed     : %.3f secs (includes up to one sample interval)\n",secs);
+    printf("throughput  : %.0f calls/sec\n",secs > 0.? (double) opqty/secs : 0.);
+    printf("locks       : %lu acquisitions, %lu contended (%.1f%%)\n",
+      info.nlock,info.ncontend,info.nlock? 100.*(double) info.ncontend/(double) info.nlock : 0.);
+    if(lat && usconfig(CONF_LATFETCH,arena,&wait) != -1) {
+        printf("lock wait   : p50 %luns  p99 %luns  p99.9 %luns  max %luns\n",
+          uslatpercentile(&wait,US_LATLOCKWAIT,50.),
+          uslatpercentile(&wait,US_LATLOCKWAIT,99.),
+          uslatpercentile(&wait,US_LATLOCKWAIT,99.9),
+          uslatpercentile(&wait,US_LATLOCKWAIT,100.));
+        }
+    printf("footprint   : peak inuse %lu bytes, highest chunk end %lu bytes\n",(unsigned long) info.peak,top);
+    printf("fragmentation: %.1f%% at the end, %.1f%% at worst\n",100.*(1. - (info.free? (double) ReplayLargest(arena,&info)/(double) info.free : 1.)),100.*maxfrag);
+    printf("failures    : %lu allocations\n",fails);
+    }
+
+usfreearena(arena);
+unlink(arenafile);
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* ReplayLoad: this function reads a trace file {{{2
+ *   Returns: 0=success  -1=failure
+ */
+static int ReplayLoad(char *tracefile)
+{
+unsigned      ipid;
+unsigned long irec;
+unsigned long maxqty= 0;
+FILE         *fp;
+USTraceHdr    hdr;
+USTraceRec    trec;
+
+
+fp= fopen(tracefile,"r");
+if(!fp) {
+    perror(tracefile);
+    return -1;
+    }
+
+while(fread(&hdr,sizeof(USTraceHdr),(size_t) 1,fp) == 1) {
+    if(hdr.magic != USTRACEMAGIC) {
+        fprintf(stderr,"(usreplay) %s: not a trace (or damaged) at byte %ld\n",tracefile,ftell(fp) - (long) sizeof(USTraceHdr));
+        fclose(fp);
+        return -1;
+        }
+    for(ipid= 0; ipid < pidqty && pids[ipid] != hdr.pid; ++ipid) ;
+    if(ipid >= pidqty) {
+        pids= (pid_t *) realloc(pids,(pidqty+1)*sizeof(pid_t));
+        if(!pids) break;
+        pids[pidqty++]= hdr.pid;
+        }
+    for(irec= 0; irec < hdr.qty && fread(&trec,sizeof(USTraceRec),(size_t) 1,fp) == 1; ++irec) {
+        if(recqty >= maxqty) {
+            maxqty= maxqty? 2*maxqty : 65536;
+            rec   = (ReplayRec *) realloc(rec,maxqty*sizeof(ReplayRec));
+            if(!rec) {
+                perror("(usreplay) realloc");
+                fclose(fp);
+                return -1;
+                }
+            }
+        rec[recqty].rec= trec;
+        rec[recqty].pid= hdr.pid;
+        rec[recqty].seq= recqty;
+        ++recqty;
+        }
+    }
+fclose(fp);
+
+if(!recqty) {
+    fprintf(stderr,"(usreplay) %s: empty trace\n",tracefile);
+    return -1;
+    }
+qsort(rec,(size_t) recqty,sizeof(ReplayRec),ReplayCmp);
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* ReplayCmp: this function orders trace records by time (then file position) {{{2 */
+static int ReplayCmp(
+  const void *a,
+  const void *b)
+{
+const ReplayRec *ra= (const ReplayRec *) a;
+const ReplayRec *rb= (const ReplayRec *) b;
+
+
+if(ra->rec.time != rb->rec.time) return (ra->rec.time < rb->rec.time)? -1 : 1;
+
+return (ra->seq < rb->seq)? -1 : (ra->seq > rb->seq);
+}
+
+/* --------------------------------------------------------------------- */
+/* ReplayResolve: this function turns the records into calls on objects {{{2
+ *   A traced chunk offset is reused once freed, so each allocation gets
+ *   an object number; the replay maps objects to its own chunks.  The
+ *   traced processes are dealt out to procqty replaying processes.
+ */
+static void ReplayResolve(unsigned procqty)
+{
+unsigned      ipid;
+unsigned long irec;
+unsigned long h;
+unsigned long mask;
+unsigned long live= 0;
+unsigned long obj;
+usoffset     *key;
+unsigned long *val;
+size_t       *objsize;
+ReplayOp     *o;
+
+
+for(mask= 1; mask < 2*recqty; mask<<= 1) ;
+key    = (usoffset *)      calloc((size_t) mask,sizeof(usoffset));
+val    = (unsigned long *) calloc((size_t) mask,sizeof(unsigned long));
+objsize= (size_t *)        calloc((size_t) recqty+1,sizeof(size_t));
+op     = (ReplayOp *)      calloc((size_t) recqty,sizeof(ReplayOp));
+if(!key || !val || !objsize || !op) {
+    perror("(usreplay) calloc");
+    exit(1);
+    }
+--mask;
+
+/* key[]: traced chunk offsets (open addressing); val[]: 1+the object now there (0: none) */
+#define ReplayFind(ichunk) for(h= ((ichunk) >> 3)*0x9e3779b97f4a7c15UL >> 20; key[h&mask] && key[h&mask] != (ichunk); ++h) ; h&= mask
+for(irec= 0; irec < recqty; ++irec) {
+    for(ipid= 0; pids[ipid] != rec[irec].pid; ++ipid) ;
+    o      = &op[opqty];
+    o->op  = (int) rec[irec].rec.op;
+    o->proc= ipid%procqty;
+    o->size= (size_t) rec[irec].rec.size;
+    o->old = REPLAYNONE;
+    if(o->op == US_TRACEFREE || o->op == US_TRACEREALLOC) {
+        ReplayFind(o->op == US_TRACEFREE? rec[irec].rec.ichunk : rec[irec].rec.old);
+        if(!key[h] || !val[h]) { /* allocated before the trace began */
+            ++unmatched;
+            if(o->op == US_TRACEFREE) continue;
+            o->op= US_TRACEMALLOC;
+            }
+        else {
+            o->old= val[h] - 1;
+            val[h]= 0;
+            live -= objsize[o->old];
+            if(o->op == US_TRACEFREE) {
+                o->obj= o->old;
+                ++opqty;
+                continue;
+                }
+            }
+        }
+    if(o->op != US_TRACEMALLOC && o->op != US_TRACEREALLOC) continue;
+    obj         = objqty++;
+    o->obj      = obj;
+    objsize[obj]= o->size;
+    live       += o->size;
+    if(live > peak) peak= live;
+    ReplayFind(rec[irec].rec.ichunk);
+    key[h]= rec[irec].rec.ichunk;
+    val[h]= obj + 1;
+    ++opqty;
+    }
+#undef ReplayFind
+
+free(key);
+free(val);
+free(objsize);
+free(rec);
+rec= NULL;
+}
+
+/* --------------------------------------------------------------------- */
+/* ReplayRun: this function replays one process' calls {{{2
+ *   chunk[obj] holds 1+the offset of obj's chunk from the arena's base
+ *   (0: not allocated yet, REPLAYNONE: allocation failed).
+ */
+static void ReplayRun(
+  usptr_t     *arena,
+  ReplayShare *share,
+  usoffset    *chunk,
+  unsigned     iproc)
+{
+unsigned long  iop;
+usoffset       at;
+usoffset       end;
+usoffset       top  = 0;
+unsigned long  fail = 0;
+void          *ptr;
+ReplayOp      *o;
+
+
+while(!__atomic_load_n(&share->go,__ATOMIC_ACQUIRE)) sched_yield();
+
+for(iop= 0; iop < opqty; ++iop) {
+    o= &op[iop];
+    if(o->proc != iproc) continue;
+
+    ptr= NULL;
+    if(o->old != REPLAYNONE) { /* wait for another process to have allocated it */
+        while(!(at= __atomic_load_n(&chunk[o->old],__ATOMIC_ACQUIRE))) sched_yield();
+        if(at != REPLAYNONE) ptr= (void *) (arena->base + at - 1);
+        }
+    switch(o->op) {
+    case US_TRACEFREE:
+        if(ptr) usfree(ptr,arena);
+        break;
+
+    case US_TRACEMALLOC:
+    case US_TRACEREALLOC:
+        ptr= (o->op == US_TRACEREALLOC && ptr)? usrealloc(ptr,o->size,arena) : usmalloc(o->size,arena);
+        if(!ptr) {
+            ++fail;
+            at= REPLAYNONE;
+            }
+        else {
+            at = (usoffset) ((usbase *) ptr - arena->base) + 1;
+            end= at - 1 + o->size;
+            if(end > top) top= end;
+            }
+        __atomic_store_n(&chunk[o->obj],at,__ATOMIC_RELEASE);
+        break;
+        }
+    __atomic_store_n(&share->done[iproc][0],share->done[iproc][0]+1,__ATOMIC_RELAXED);
+    }
+
+share->top[iproc][0] = top;
+share->fail[iproc][0]= fail;
+uslatmerge(arena);
+}
+
+/* --------------------------------------------------------------------- */
+/* ReplayLargest: this function returns the size of the largest free chunk {{{2
+ *   The bins are sorted on size, so it's the tail of the last non-empty bin
+ *   (or the top chunk).
+ */
+static usoffset ReplayLargest(
+  usptr_t           *arena,
+  struct usmallinfo *info)
+{
+int      ibin;
+usoffset tl;
+usoffset sz= 0;
+
+
+for(ibin= USMAXFREEBIN-1; ibin >= 0 && !info->binqty[ibin]; --ibin) ;
+if(ibin < 0) return info->top;
+
+usarenalock(arena);
+tl= arena->bin[ibin].tl;
+if(tl) sz= ((usoffset *) (arena->base + tl))[0]&USSIZEMASK;
+usarenaunlock(arena);
+
+return (sz > info->top)? sz : info->top;
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */
@@ -0,0 +1,463 @@
+/* usstat.c: this program inspects an arena from outside the processes using it
+ *   Usage: usstat [-j] [-L] [-V] [-T threads] [-w secs] arenafile
+ *     -j      : JSON output, one object per line (per report, in watch mode)
+ *     -L      : lock the arena while reading it, for an exact report
+ *     -V      : verify the heap, too (see usverify())
+ *     -T qty  : qty of threads -V uses (default: one per cpu)
+ *     -w secs : watch: report every secs seconds
+ *
+ *   Reports the counters, the locks, the free bins, and the bytes in use
+ *   per tag (see ustag()).
+ *
+ *   The arena file is mapped read-only and, by default, the arena lock is
+ *   not taken; the processes using the arena are not disturbed.  Since the
+ *   heap may then change while it is being read, every chunk offset and
+ *   size is range-checked before it is followed, and a report that ran
+ *   into an inconsistency says so ("consistent": false).
+ *
+ *   Date:   Oct 18, 2026
+ */
+
+/* =====================================================================
+ * Header Section: {{{1
+ */
+
+/* ---------------------------------------------------------------------
+ * Includes: {{{2
+ */
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+
+/* ------------------------------------------------------------------------
+ * Typedefs: {{{2
+ */
+typedef struct StatBin_str  StatBin;
+typedef struct StatLock_str StatLock;
+
+/* ------------------------------------------------------------------------
+ * Local Data Structures: {{{2
+ */
+struct StatBin_str {               /* StatBin: one free-chunk bin      */
+    unsigned long qty;             /* qty of free chunks               */
+    unsigned long bytes;           /* bytes in free chunks             */
+    unsigned long largest;         /* largest free chunk               */
+    };
+struct StatLock_str {              /* StatLock: one semaphore or mutex */
+    int           held;            /* 1=held  0=free  -1=unknown       */
+    int           pid;             /* SEM: last process to operate on it; PI: owner's thread id */
+    int           waiting;         /* qty of processes waiting for it  */
+    };
+
+/* ------------------------------------------------------------------------
+ * Local Data: {{{2
+ */
+static USArenaShare *share    = NULL; /* the arena file, mapped       */
+static usbase       *base     = NULL; /* beginning of allocatable mem */
+static usoffset      memsize  = 0;    /* bytes of allocatable mem     */
+static int           semid    = -1;   /* arena's semaphore set        */
+static int           consistent;      /* report is self-consistent?   */
+static int           locked   = 0;    /* -L: arena locked while read  */
+static int           verify   = 0;    /* -V: verify the heap          */
+static int           vthreads = 0;    /* -T: qty of verifier threads  */
+
+/* ------------------------------------------------------------------------
+ * Prototypes: {{{2
+ */
+int main( int, char **);                           /* usstat.c */
+static int StatMap(char *,int);                    /* usstat.c */
+static int StatLockArena(int);                     /* usstat.c */
+static void StatBins(StatBin *);                   /* usstat.c */
+static void StatLocks(StatLock *);                 /* usstat.c */
+static void StatReport(char *,int);                /* usstat.c */
+
+/* ========================================================================
+ * Functions: {{{1
+ */
+
+/* --------------------------------------------------------------------- */
+/* main: it all starts here! {{{2 */
+int main(
+  int    argc,
+  char **argv)
+{
+int   iarg;
+int   json      = 0;
+int   lock      = 0;
+int   watch     = 0;
+char *arenafile = NULL;
+
+
+for(iarg= 1; iarg < argc; ++iarg) {
+    if     (!strcmp(argv[iarg],"-j"))                  json = 1;
+    else if(!strcmp(argv[iarg],"-L"))                  lock = 1;
+    else if(!strcmp(argv[iarg],"-V"))                  verify= 1;
+    else if(!strcmp(argv[iarg],"-T") && iarg+1 < argc) vthreads= atoi(argv[++iarg]);
+    else if(!strcmp(argv[iarg],"-w") && iarg+1 < argc) watch= atoi(argv[++iarg]);
+    else if(argv[iarg][0] != '-')                      arenafile= argv[iarg];
+    else {
+        arenafile= NULL;
+        break;
+        }
+    }
+if(!arenafile) {
+    fprintf(stderr,"usage: usstat [-j] [-L] [-V] [-T threads] [-w secs] arenafile\n");
+    return 1;
+    }
+if(StatMap(arenafile,lock)) {
+    return 1;
+    }
+locked= lock;
+
+do {
+    if(lock && StatLockArena(1)) {
+        perror("(usstat) locking the arena");
+        return 1;
+        }
+    StatReport(arenafile,json);
+    if(lock) StatLockArena(0);
+    fflush(stdout);
+    if(watch > 0) sleep((unsigned) watch);
+    } while(watch > 0);
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* StatMap: this function maps the arena file (read-only, unless locking is wanted) {{{2
+ *   Returns: 0=success  -1=failure
+ */
+static int StatMap(
+  char *arenafile,
+  int   lock)
+{
+int          fd;
+struct stat  filestat;
+void        *mempool;
+
+
+fd= open(arenafile,lock? O_RDWR : O_RDONLY);
+if(fd == -1 || fstat(fd,&filestat)) {
+    perror(arenafile);
+    return -1;
+    }
+if((size_t) filestat.st_size < sizeof(USArenaShare)) {
+    fprintf(stderr,"(usstat) %s is too small to be an arena\n",arenafile);
+    return -1;
+    }
+
+mempool= mmap(NULL,(size_t) filestat.st_size,lock? PROT_READ|PROT_WRITE : PROT_READ,MAP_SHARED,fd,(off_t) 0);
+close(fd);
+if(mempool == MAP_FAILED) {
+    perror("(usstat) mmap");
+    return -1;
+    }
+
+share  = (USArenaShare *) mempool;
+if(share->magic != USSHAREMAGIC || share->version != USSHAREVERSION || share->sharesize != (unsigned) sizeof(USArenaShare)) {
+    fprintf(stderr,"(usstat) %s is not an arena of layout version %d\n",arenafile,USSHAREVERSION);
+    return -1;
+    }
+base   = ((usbase *) mempool) + ((sizeof(USArenaShare) + 7)&(~0x7));
+memsize= share->memsize;
+if(memsize + (usoffset) (base - (usbase *) mempool) > (usoffset) filestat.st_size) {
+    fprintf(stderr,"(usstat) %s: arena size (%lu) exceeds the file size\n",arenafile,memsize);
+    return -1;
+    }
+if(share->locktype == US_LOCKSEM) semid= semget(share->key,0,0);
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* StatLockArena: this function locks (lock=1) or unlocks (lock=0) both arena locks {{{2
+ *   The locks are taken in the library's order: USLK_BIG, then USLK_SMALL.
+ *   Returns: 0=success  -1=failure
+ */
+static int StatLockArena(int lock)
+{
+int           ilk;
+struct sembuf sops[2];
+
+
+for(ilk= 0; ilk < USLK_QTY; ++ilk) {
+    int jlk= lock? ilk : USLK_QTY-1-ilk;
+    if(share->locktype == US_LOCKPI) {
+        if(lock) {
+            if(uspimutexlock(&share->lock[jlk].mutex,0)) return -1;
+            }
+        else pthread_mutex_unlock(&share->lock[jlk].mutex);
+        }
+    else {
+        if(semid == -1) return -1;
+        sops[0].sem_num= sops[1].sem_num= share->maxusers + jlk;
+        sops[0].sem_flg= sops[1].sem_flg= SEM_UNDO;
+        sops[0].sem_op = lock? 0 : -1;
+        sops[1].sem_op = 1;
+        if(semop(semid,sops,lock? 2 : 1) == -1) return -1;
+        }
+    }
+
+return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* StatBins: this function walks the free-chunk bins {{{2
+ *   Without the arena lock, a bin may change under the walk; a link that
+ *   leaves the arena, a chunk that isn't free, or a walk longer than the
+ *   arena could hold ends that bin's walk and marks the report inconsistent.
+ */
+static void StatBins(StatBin *bin)
+{
+int           ibin;
+usoffset      ichunk;
+usoffset      sz;
+unsigned long steps;
+unsigned long maxsteps= memsize/MINCHUNKSIZE + 1;
+
+
+memset(bin,0,USMAXFREEBIN*sizeof(StatBin));
+for(ibin= 0; ibin < USMAXFREEBIN; ++ibin) {
+    ichunk= ((volatile USFreeBin *) share->bin)[ibin].hd;
+    for(steps= 0; ichunk; ++steps) {
+        if(ichunk < 8 || ichunk >= memsize || (ichunk&0x7) || steps > maxsteps) {
+            consistent= 0;
+            break;
+            }
+        sz= ((volatile usoffset *) (base + ichunk))[0];
+        if(!(sz&1) || (sz&USSIZEMASK) < MINCHUNKSIZE || (sz&USSIZEMASK) > memsize - ichunk) {
+            consistent= 0;
+            break;
+            }
+        sz&= USSIZEMASK;
+        ++bin[ibin].qty;
+        bin[ibin].bytes+= sz;
+        if(sz > bin[ibin].largest) bin[ibin].largest= sz;
+        ichunk= ((volatile usoffset *) (base + ichunk))[1];
+        }
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* StatLocks: this function reports on the arena locks and the user semaphores {{{2
+ *   lk[0..USLK_QTY-1]               : the arena locks (USLK_BIG, USLK_SMALL)
+ *   lk[USLK_QTY..USLK_QTY+maxusers-1]: US_LOCKSEM user semaphores
+ */
+static void StatLocks(StatLock *lk)
+{
+int ilk;
+int isem;
+int val;
+
+
+for(ilk= 0; ilk < USLK_QTY + (int) share->maxusers; ++ilk) {
+    lk[ilk].held   = -1;
+    lk[ilk].pid    = 0;
+    lk[ilk].waiting= 0;
+    }
+
+if(share->locktype == US_LOCKPI) { /* glibc: the owner's thread id */
+    for(ilk= 0; ilk < USLK_QTY; ++ilk) {
+        lk[ilk].pid = ((volatile pthread_mutex_t *) &share->lock[ilk].mutex)->__data.__owner;
+        lk[ilk].held= lk[ilk].pid != 0;
+        }
+    return;
+    }
+if(semid == -1) return;
+
+for(ilk= 0; ilk < USLK_QTY + (int) share->maxusers; ++ilk) {
+    isem= (ilk < USLK_QTY)? (int) share->maxusers + ilk : ilk - USLK_QTY;
+    val            = semctl(semid,isem,GETVAL);
+    lk[ilk].held   = val > 0 && val != US_SEMUNUSED;
+    lk[ilk].pid    = semctl(semid,isem,GETPID);
+    lk[ilk].waiting= semctl(semid,isem,GETZCNT);
+    }
+}
+
+/* --------------------------------------------------------------------- */
+/* StatReport: this function reports on the arena, as text or as JSON {{{2 */
+static void StatReport(
+  char *arenafile,
+  int   json)
+{
+int               ibin;
+int               ilk;
+int               first;
+int               itag;
+int               tagqty;
+double            frag;
+unsigned long     freebytes= 0;
+unsigned long     largest  = 0;
+StatBin           bin[USMAXFREEBIN];
+StatLock         *lk;
+USArena           arena;
+struct usmallinfo info;
+struct usverify   vrpt;
+
+
+/* the counters: usmallinfo() needs only these USArena members */
+memset(&arena,0,sizeof(USArena));
+arena.mempool= (usbase *) share;
+arena.base   = base;
+arena.memsize= memsize;
+arena.stats  = share->stats;
+arena.binqty = share->binqty;
+arena.top    = &share->top;
+arena.fast   = &share->fast;
+arena.remote = &share->remote;
+usmallinfo(&arena,&info);
+
+consistent= 1;
+StatBins(bin);
+freebytes= info.top + info.fast; /* the top chunk and the fastbins aren't in the bins */
+largest  = info.top;
+for(ibin= 0; ibin < USMAXFREEBIN; ++ibin) {
+    freebytes+= bin[ibin].bytes;
+    if(bin[ibin].largest > largest) largest= bin[ibin].largest;
+    }
+frag= freebytes? 1. - (double) largest/(double) freebytes : 0.;
+tagqty= (int) share->tags.qty;
+if(tagqty > USMAXTAGS) tagqty= USMAXTAGS;
+
+/* the heap check: usverify() also needs these; usstat does its own locking */
+if(verify) {
+    arena.bin     = share->bin;
+    arena.tags    = &share->tags;
+    *uslockheld()= (1<<USLK_BIG)|(1<<USLK_SMALL);
+    if(usverify(&arena,vthreads,&vrpt) < 0) {
+        perror("(usstat) usverify");
+        verify= 0;
+        }
+    *uslockheld()= 0;
+    }
+
+lk= (StatLock *) calloc((size_t) (USLK_QTY + share->maxusers),sizeof(StatLock));
+if(!lk) {
+    perror("(usstat) calloc");
+    return;
+    }
+StatLocks(lk);
+
+if(json) {
+    printf("{\"arena\":\"%s\",\"time\":%ld,\"memsize\":%lu,\"maxusers\":%lu,\"locktype\":\"%s\",\"consistent\":%s,",
+      arenafile,
+      (long) time(NULL),
+      memsize,
+      share->maxusers,
+      (share->locktype == US_LOCKPI)? "pi" : "sem",
+      consistent? "true" : "false");
+    printf("\"inuse\":%lu,\"free\":%lu,\"freewalked\":%lu,\"top\":%lu,\"fast\":%lu,\"peak\":%lu,\"largestfree\":%lu,\"fragmentation\":%.4f,",
+      (unsigned long) info.inuse,
+      (unsigned long) info.free,
+      freebytes,
+      (unsigned long) info.top,
+      (unsigned long) info.fast,
+      (unsigned long) info.peak,
+      largest,
+      frag);
+    printf("\"nmalloc\":%lu,\"nfree\":%lu,\"nfail\":%lu,\"nlock\":%lu,\"ncontend\":%lu,",
+      info.nmalloc,info.nfree,info.nfail,info.nlock,info.ncontend);
+    printf("\"locks\":[");
+    for(first= 1, ilk= 0; ilk < USLK_QTY + (int) share->maxusers; ++ilk) {
+        if(ilk >= USLK_QTY && lk[ilk].held != 1) continue;
+        printf("%s{\"lock\":",first? "" : ",");
+        if(ilk < USLK_QTY) printf("\"%s\"",(ilk == USLK_BIG)? "USLK_BIG" : "USLK_SMALL");
+        else               printf("%d",ilk - USLK_QTY);
+        printf(",\"held\":%d,\"pid\":%d,\"waiting\":%d}",lk[ilk].held,lk[ilk].pid,lk[ilk].waiting);
+        first= 0;
+        }
+    printf("],\"bins\":[");
+    for(first= 1, ibin= 0; ibin < USMAXFREEBIN; ++ibin) {
+        if(!bin[ibin].qty) continue;
+        printf("%s{\"bin\":%d,\"minsize\":%lu,\"chunks\":%lu,\"bytes\":%lu,\"largest\":%lu}",
+          first? "" : ",",
+          ibin,
+          usbinminsize(ibin),
+          bin[ibin].qty,
+          bin[ibin].bytes,
+          bin[ibin].largest);
+        first= 0;
+        }
+    printf("],\"tags\":[");
+    for(first= 1, itag= 1; itag < tagqty; ++itag) {
+        printf("%s{\"tag\":\"%.*s\",\"bytes\":%ld}",
+          first? "" : ",",
+          USTAGNAMELEN-1,
+          share->tags.name[itag],
+          share->tags.bytes[itag]);
+        first= 0;
+        }
+    printf("]");
+    if(verify) {
+        printf(",\"verify\":{\"chunks\":%lu,\"freechunks\":%lu,\"errors\":%lu,\"badchunk\":%lu,\"msg\":\"%s\",\"locked\":%s}",
+          vrpt.chunks,
+          vrpt.freechunks,
+          vrpt.errors,
+          (unsigned long) vrpt.badchunk,
+          vrpt.msg,
+          locked? "true" : "false");
+        }
+    printf("}\n");
+    }
+
+else {
+    time_t now= time(NULL);
+    printf("arena %s: %lu bytes  maxusers=%lu  locktype=%s  %s",
+      arenafile,
+      memsize,
+      share->maxusers,
+      (share->locktype == US_LOCKPI)? "pi" : "sem",
+      ctime(&now));
+    printf("  inuse=%lu  free=%lu  top=%lu  fast=%lu  peak=%lu  largest free=%lu  fragmentation=%.1f%%%s\n",
+      (unsigned long) info.inuse,
+      freebytes,
+      (unsigned long) info.top,
+      (unsigned long) info.fast,
+      (unsigned long) info.peak,
+      largest,
+      100.*frag,
+      consistent? "" : "  (heap changed while being read)");
+    printf("  nmalloc=%lu  nfree=%lu  nfail=%lu  nlock=%lu  ncontend=%lu\n",
+      info.nmalloc,info.nfree,info.nfail,info.nlock,info.ncontend);
+    for(ilk= 0; ilk < USLK_QTY + (int) share->maxusers; ++ilk) {
+        if(ilk >= USLK_QTY && lk[ilk].held != 1) continue;
+        if(ilk < USLK_QTY) printf("  lock %-10s ",(ilk == USLK_BIG)? "USLK_BIG" : "USLK_SMALL");
+        else               printf("  lock sem#%-6d ",ilk - USLK_QTY);
+        if(lk[ilk].held < 0)       printf("unknown\n");
+        else if(share->locktype == US_LOCKPI) {
+            if(lk[ilk].held)       printf("held by thread %d\n",lk[ilk].pid);
+            else                   printf("free\n");
+            }
+        else                       printf("%-4s  last pid=%d  waiting=%d\n",lk[ilk].held? "held" : "free",lk[ilk].pid,lk[ilk].waiting);
+        }
+    printf("  %4s %12s %10s %14s %12s\n","bin","minsize","chunks","bytes","largest");
+    for(ibin= 0; ibin < USMAXFREEBIN; ++ibin) {
+        if(!bin[ibin].qty) continue;
+        printf("  %4d %12lu %10lu %14lu %12lu\n",
+          ibin,
+          usbinminsize(ibin),
+          bin[ibin].qty,
+          bin[ibin].bytes,
+          bin[ibin].largest);
+        }
+    if(tagqty > 1) printf("  %-*s %14s\n",USTAGNAMELEN,"tag","bytes");
+    for(itag= 1; itag < tagqty; ++itag) {
+        printf("  %-*.*s %14ld\n",USTAGNAMELEN,USTAGNAMELEN-1,share->tags.name[itag],share->tags.bytes[itag]);
+        }
+    if(verify) {
+        printf("  verify: chunks=%lu  free=%lu  errors=%lu\n",vrpt.chunks,vrpt.freechunks,vrpt.errors);
+        if(vrpt.errors) printf("  verify: first bad chunk %lu: %s%s\n",
+          (unsigned long) vrpt.badchunk,
+          vrpt.msg,
+          locked? "" : "  (the heap may have changed while being read; use -L)");
+        }
+    }
+
+free(lk);
+}
+
+/* =====================================================================
+ * Modelines: {{{1
+ * vim: sw=4 sts=4 et fdm=marker ts=4
+ */